@@ -141,6 +141,9 @@ Your puzzle answer was 3951.
 */
 #include <cstdio>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
 
 enum Opcode
 {
@@ -231,21 +234,134 @@ int actual_code[] = {
     1,0,0,3,1,1,2,3,1,3,4,3,1,5,0,3,2,9,1,19,1,19,5,23,1,9,23,27,2,27,6,31,1,5,31,35,2,9,35,39,2,6,39,43,2,43,13,47,2,13,47,51,1,10,51,55,1,9,55,59,1,6,59,63,2,63,9,67,1,67,6,71,1,71,13,75,1,6,75,79,1,9,79,83,2,9,83,87,1,87,6,91,1,91,13,95,2,6,95,99,1,10,99,103,2,103,9,107,1,6,107,111,1,10,111,115,2,6,115,119,1,5,119,123,1,123,13,127,1,127,5,131,1,6,131,135,2,135,13,139,1,139,2,143,1,143,10,0,99,2,0,14,0
 };
 
+// Runs the program with the given noun and verb on memory (a copy of
+// program, so the program itself is never modified) and returns address 0.
+int run_with(const int *program, int size, int noun, int verb, int *memory)
+{
+    memcpy(memory, program, size * sizeof(int));
+    memory[1] = noun;
+    memory[2] = verb;
+    Code code = { .data = memory, .size = size };
+    State state = {};
+    while (step(&state, code) != -1);
+    return memory[0];
+}
+
+// A noun and verb pair, noun is -1 when no pair was found.
+struct NounVerb
+{
+    int noun;
+    int verb;
+};
+
+struct Search
+{
+    const int *program;
+    int size;
+    int target;
+    int max;          // nouns and verbs are 0..max-1
+
+    int next_noun;    // atomic
+    int found;        // atomic, set by the worker that stores result
+    NounVerb result;
+};
+
+// Takes nouns one at a time and tries every verb for them.
+void search_worker(Search *search)
+{
+    int *memory = (int*)malloc(search->size * sizeof(int));
+    while (!__atomic_load_n(&search->found, __ATOMIC_RELAXED))
+    {
+        int noun = __atomic_fetch_add(&search->next_noun, 1, __ATOMIC_RELAXED);
+        if (noun >= search->max) break;
+        for (int verb = 0; verb < search->max; verb++)
+        {
+            if (run_with(search->program, search->size, noun, verb, memory) == search->target)
+            {
+                if (!__atomic_exchange_n(&search->found, 1, __ATOMIC_RELAXED)) search->result = { noun, verb };
+                break;
+            }
+        }
+    }
+    free(memory);
+}
+
+// Tries all the noun/verb pairs on every core. Returns a pair that gives
+// target.
+NounVerb search_noun_verb(const int *program, int size, int target, int max = 100)
+{
+    Search search = { program, size, target, max, 0, 0, { -1, 0 } };
+    int thread_num = std::thread::hardware_concurrency();
+    if (thread_num <= 0) thread_num = 1;
+    std::thread *threads = new std::thread[thread_num];
+    for (int i = 0; i < thread_num; i++) threads[i] = std::thread(search_worker, &search);
+    for (int i = 0; i < thread_num; i++) threads[i].join();
+    delete[] threads;
+    return search.result;
+}
+
+// The programs only add and multiply, and noun and verb usually end up
+// added or multiplied by constants, so the output is
+//
+//     out = base + a * noun + b * verb
+//
+// Three runs give base, a and b, a fourth one checks that the program
+// really is affine. Then only the verbs are looped over. Returns false if
+// the program is not affine, otherwise sets *result to a pair that gives
+// target.
+bool solve_affine_noun_verb(const int *program, int size, int target, NounVerb *result, int max = 100)
+{
+    int *memory = (int*)malloc(size * sizeof(int));
+    int64_t base = run_with(program, size, 0, 0, memory);
+    int64_t a = run_with(program, size, 1, 0, memory) - base;
+    int64_t b = run_with(program, size, 0, 1, memory) - base;
+    int check_noun = (max > 7) ? 7 : max - 1;
+    int check_verb = (max > 3) ? 3 : max - 1;
+    int64_t check = run_with(program, size, check_noun, check_verb, memory);
+    bool affine = check == base + a * check_noun + b * check_verb;
+    *result = { -1, 0 };
+    if (affine)
+    {
+        for (int verb = 0; verb < max && result->noun < 0; verb++)
+        {
+            int64_t rest = target - base - b * verb;
+            if (a == 0 ? rest != 0 : rest % a != 0) continue;
+            int64_t noun = (a == 0) ? 0 : rest / a;
+            if (noun < 0 || noun >= max) continue;
+            // Confirm with a real run
+            if (run_with(program, size, noun, verb, memory) == target) *result = { (int)noun, verb };
+        }
+    }
+    free(memory);
+    return affine;
+}
+
 int main(int argc, const char **argv)
 {
-    // Part one
-    //actual_code[1] = 12;
-    //actual_code[2] = 2;
+    const int target = 19690720;
+    int size = sizeof(actual_code) / sizeof(actual_code[0]);
 
-    // Part two, manually testing values
-    actual_code[1] = 39;
-    actual_code[2] = 51;
+    // Part one
+    int *memory = (int*)malloc(sizeof(actual_code));
+    printf("Part 1: %d\n", run_with(actual_code, size, 12, 2, memory));
 
-    Code code = to_code(actual_code);
+    // Part two, "day02 search" tries every pair
+    bool search = argc > 1 && strcmp(argv[1], "search") == 0;
+    NounVerb answer;
+    if (search || !solve_affine_noun_verb(actual_code, size, target, &answer))
+    {
+        if (!search) printf("Output is not affine in noun and verb, searching\n");
+        answer = search_noun_verb(actual_code, size, target);
+    }
+    if (answer.noun < 0) printf("Part 2: no noun and verb give %d\n", target);
+    else printf("Part 2: %d\n", 100 * answer.noun + answer.verb);
 
-    State state = {};
-    while (step(&state, code) != -1);
-    print_code(code);
+    if (answer.noun >= 0)
+    {
+        run_with(actual_code, size, answer.noun, answer.verb, memory);
+        Code code = { .data = memory, .size = size };
+        print_code(code);
+    }
+    free(memory);
     return 0;
 }
-
@@ -187,221 +187,61 @@ Your puzzle answer was 7161591.
 #include <cstdio>
 #include <cstdint>
 
-#define OPCODES \
-    OPCODE(Add, 1)\
-    OPCODE(Mul, 2)\
-    OPCODE(Inp, 3)\
-    OPCODE(Out, 4)\
-    OPCODE(Jnz, 5)\
-    OPCODE(Jz, 6)\
-    OPCODE(Lt, 7)\
-    OPCODE(Equ, 8)\
-    OPCODE(Halt, 99)
-
-#define OPCODE(op, x) OP_ ## op = x,
-enum Opcode
-{
-    OPCODES
-
-    Opcode_Max
-};
-#undef OPCODE
-
-static const char* Opcode_names[Opcode_Max] = { };
-#define OPCODE(op, x) Opcode_names[x] = #op;
-bool init_opcode_names()
-{
-    OPCODES
-    return true;
-}
-#undef OPCODE
-static bool init = init_opcode_names();
-
-struct State
-{
-    int position;
-};
+#include "../intcode/intcode.h"
 
-struct Code
-{
-    int *data;
-    int size;
-
-    int operator[](int pos) const
-    {
-        return data[pos];
-    }
-    int& operator[](int pos)
-    {
-        return data[pos];
-    }
-};
-
-template <int N>
-Code to_code(int (&c)[N])
-{
-    return { .data = c, .size = N };
+IntWord actual_code[] = {
+    3,225,1,225,6,6,1100,1,238,225,104,0,1101,72,36,225,1101,87,26,225,2,144,13,224,101,-1872,224,224,4,224,102,8,223,223,1001,224,2,224,1,223,224,223,1102,66,61,225,1102,25,49,224,101,-1225,224,224,4,224,1002,223,8,223,1001,224,5,224,1,223,224,223,1101,35,77,224,101,-112,224,224,4,224,102,8,223,223,1001,224,2,224,1,223,224,223,1002,195,30,224,1001,224,-2550,224,4,224,1002,223,8,223,1001,224,1,224,1,224,223,223,1102,30,44,225,1102,24,21,225,1,170,117,224,101,-46,224,224,4,224,1002,223,8,223,101,5,224,224,1,224,223,223,1102,63,26,225,102,74,114,224,1001,224,-3256,224,4,224,102,8,223,223,1001,224,3,224,1,224,223,223,1101,58,22,225,101,13,17,224,101,-100,224,224,4,224,1002,223,8,223,101,6,224,224,1,224,223,223,1101,85,18,225,1001,44,7,224,101,-68,224,224,4,224,102,8,223,223,1001,224,5,224,1,223,224,223,4,223,99,0,0,0,677,0,0,0,0,0,0,0,0,0,0,0,1105,0,99999,1105,227,247,1105,1,99999,1005,227,99999,1005,0,256,1105,1,99999,1106,227,99999,1106,0,265,1105,1,99999,1006,0,99999,1006,227,274,1105,1,99999,1105,1,280,1105,1,99999,1,225,225,225,1101,294,0,0,105,1,0,1105,1,99999,1106,0,300,1105,1,99999,1,225,225,225,1101,314,0,0,106,0,0,1105,1,99999,7,677,226,224,102,2,223,223,1005,224,329,101,1,223,223,8,677,226,224,1002,223,2,223,1005,224,344,1001,223,1,223,1107,677,677,224,102,2,223,223,1005,224,359,1001,223,1,223,1107,226,677,224,102,2,223,223,1005,224,374,101,1,223,223,7,226,677,224,102,2,223,223,1005,224,389,101,1,223,223,8,226,677,224,1002,223,2,223,1005,224,404,101,1,223,223,1008,226,677,224,1002,223,2,223,1005,224,419,1001,223,1,223,107,677,677,224,102,2,223,223,1005,224,434,101,1,223,223,1108,677,226,224,1002,223,2,223,1006,224,449,101,1,223,223,1108,677,677,224,102,2,223,223,1006,224,464,101,1,223,223,1007,677,226,224,102,2,223,223,1006,224,479,101,1,223,223,1008,226,226,224,102,2,223,223,1006,224,494,101,1,223,223,108,226,226,224,1002,223,2,223,1006,224,509,101,1,223,223,107,226,226,224,102,2,223,223,1006,224,524,101,1,223,223,1107,677,226,224,102,2,223,223,1005,224,539,1001,223,1,223,108,226,677,224,1002,223,2,223,1005,224,554,101,1,223,223,1007,226,226,224,102,2,223,223,1005,224,569,101,1,223,223,8,226,226,224,102,2,223,223,1006,224,584,101,1,223,223,1008,677,677,224,1002,223,2,223,1005,224,599,1001,223,1,223,107,226,677,224,1002,223,2,223,1005,224,614,1001,223,1,223,1108,226,677,224,102,2,223,223,1006,224,629,101,1,223,223,7,677,677,224,1002,223,2,223,1005,224,644,1001,223,1,223,108,677,677,224,102,2,223,223,1005,224,659,101,1,223,223,1007,677,677,224,102,2,223,223,1006,224,674,101,1,223,223,4,223,99,226
 };
 
-void print_code(Code code)
+void print_outputs(Buffer *output)
 {
-    if (code.size > 0)
-    {
-        printf("%d", code[0]);
-        for (int i = 1; i < code.size; i++) printf(",%d", code[i]);
-        printf("\n");
-    }
+    IntWord out;
+    while (read(output, &out)) printf("%" PRId64 ",", out);
 }
 
-Opcode decode_instr(int instr, int *m1, int *m2, int *m3)
+void run(Code code, IntWord input_value)
 {
-    int op = instr % 100;
-    *m1 = (instr / 100) % 10;
-    *m2 = (instr / 1000) % 10;
-    *m3 = (instr / 10000) % 10;
-    return (Opcode)op;
-}
-
-int read(Code code, int pos, int mode)
-{
-    int a = code[pos];
-    return (mode == 1) ? a : code[a];
-}
+    Buffer input = {};
+    Buffer output = {};
+    State state = {};
+    state.input = &input;
+    state.output = &output;
 
-int step(State *s, Code code, int input)
-{
-    int pos = s->position;
-    int instr = code[pos];
-    int m1, m2, m3;
-    Opcode op = decode_instr(instr, &m1, &m2, &m3);
-    //printf("%s[%d, %d, %d]\n", Opcode_names[op], m1, m2, m3);
-    switch (op)
-    {
-    case OP_Add:
-        {
-            int oper1 = read(code, pos+1, m1);
-            int oper2 = read(code, pos+2, m2);
-            int res_pos = code[pos+3];
-            code[res_pos] = oper1 + oper2;
-            pos += 4;
-        } break;
-    case OP_Mul:
-        {
-            int oper1 = read(code, pos+1, m1);
-            int oper2 = read(code, pos+2, m2);
-            int res_pos = code[pos+3];
-            code[res_pos] = oper1 * oper2;
-            pos += 4;
-        } break;
-    case OP_Inp:
-        {
-            int res_pos = code[pos+1];
-            code[res_pos] = input;
-            pos += 2;
-        } break;
-    case OP_Out:
-        {
-            int out = read(code, pos+1, m1);
-            printf("%d,", out);
-            pos += 2;
-        } break;
-    case OP_Jnz:
-        {
-            int oper1 = read(code, pos+1, m1);
-            int oper2 = read(code, pos+2, m2);
-            if (oper1 != 0)
-            {
-                pos = oper2;
-            }
-            else
-            {
-                pos += 3;
-            }
-        } break;
-    case OP_Jz:
-        {
-            int oper1 = read(code, pos+1, m1);
-            int oper2 = read(code, pos+2, m2);
-            if (oper1 == 0)
-            {
-                pos = oper2;
-            }
-            else
-            {
-                pos += 3;
-            }
-        } break;
-    case OP_Lt:
-        {
-            int oper1 = read(code, pos+1, m1);
-            int oper2 = read(code, pos+2, m2);
-            int res_pos = code[pos+3];
-            code[res_pos] = (oper1 < oper2) ? 1 : 0;
-            pos += 4;
-        } break;
-    case OP_Equ:
-        {
-            int oper1 = read(code, pos+1, m1);
-            int oper2 = read(code, pos+2, m2);
-            int res_pos = code[pos+3];
-            code[res_pos] = (oper1 == oper2) ? 1 : 0;
-            pos += 4;
-        } break;
-    case OP_Halt:
-        return -1;
-        break;
-
-    case Opcode_Max:
-    //default:
-        printf("BUG!\n");
-        return -1;
-    }
-    s->position = pos;
-    return 1;
+    write(&input, input_value);
+    execute(&state, code);
+    print_outputs(&output);
+    //print_code(code);
+    free_buffer(&input);
+    free_buffer(&output);
 }
 
-
-
-int actual_code[] = {
-    3,225,1,225,6,6,1100,1,238,225,104,0,1101,72,36,225,1101,87,26,225,2,144,13,224,101,-1872,224,224,4,224,102,8,223,223,1001,224,2,224,1,223,224,223,1102,66,61,225,1102,25,49,224,101,-1225,224,224,4,224,1002,223,8,223,1001,224,5,224,1,223,224,223,1101,35,77,224,101,-112,224,224,4,224,102,8,223,223,1001,224,2,224,1,223,224,223,1002,195,30,224,1001,224,-2550,224,4,224,1002,223,8,223,1001,224,1,224,1,224,223,223,1102,30,44,225,1102,24,21,225,1,170,117,224,101,-46,224,224,4,224,1002,223,8,223,101,5,224,224,1,224,223,223,1102,63,26,225,102,74,114,224,1001,224,-3256,224,4,224,102,8,223,223,1001,224,3,224,1,224,223,223,1101,58,22,225,101,13,17,224,101,-100,224,224,4,224,1002,223,8,223,101,6,224,224,1,224,223,223,1101,85,18,225,1001,44,7,224,101,-68,224,224,4,224,102,8,223,223,1001,224,5,224,1,223,224,223,4,223,99,0,0,0,677,0,0,0,0,0,0,0,0,0,0,0,1105,0,99999,1105,227,247,1105,1,99999,1005,227,99999,1005,0,256,1105,1,99999,1106,227,99999,1106,0,265,1105,1,99999,1006,0,99999,1006,227,274,1105,1,99999,1105,1,280,1105,1,99999,1,225,225,225,1101,294,0,0,105,1,0,1105,1,99999,1106,0,300,1105,1,99999,1,225,225,225,1101,314,0,0,106,0,0,1105,1,99999,7,677,226,224,102,2,223,223,1005,224,329,101,1,223,223,8,677,226,224,1002,223,2,223,1005,224,344,1001,223,1,223,1107,677,677,224,102,2,223,223,1005,224,359,1001,223,1,223,1107,226,677,224,102,2,223,223,1005,224,374,101,1,223,223,7,226,677,224,102,2,223,223,1005,224,389,101,1,223,223,8,226,677,224,1002,223,2,223,1005,224,404,101,1,223,223,1008,226,677,224,1002,223,2,223,1005,224,419,1001,223,1,223,107,677,677,224,102,2,223,223,1005,224,434,101,1,223,223,1108,677,226,224,1002,223,2,223,1006,224,449,101,1,223,223,1108,677,677,224,102,2,223,223,1006,224,464,101,1,223,223,1007,677,226,224,102,2,223,223,1006,224,479,101,1,223,223,1008,226,226,224,102,2,223,223,1006,224,494,101,1,223,223,108,226,226,224,1002,223,2,223,1006,224,509,101,1,223,223,107,226,226,224,102,2,223,223,1006,224,524,101,1,223,223,1107,677,226,224,102,2,223,223,1005,224,539,1001,223,1,223,108,226,677,224,1002,223,2,223,1005,224,554,101,1,223,223,1007,226,226,224,102,2,223,223,1005,224,569,101,1,223,223,8,226,226,224,102,2,223,223,1006,224,584,101,1,223,223,1008,677,677,224,1002,223,2,223,1005,224,599,1001,223,1,223,107,226,677,224,1002,223,2,223,1005,224,614,1001,223,1,223,1108,226,677,224,102,2,223,223,1006,224,629,101,1,223,223,7,677,677,224,1002,223,2,223,1005,224,644,1001,223,1,223,108,677,677,224,102,2,223,223,1005,224,659,101,1,223,223,1007,677,677,224,102,2,223,223,1006,224,674,101,1,223,223,4,223,99,226
-};
-
 void test()
 {
-    int test_code[] = {
+    IntWord test_code[] = {
         3,21,1008,21,8,20,1005,20,22,107,8,21,20,1006,20,31,
         1106,0,36,98,0,0,1002,21,125,20,4,20,1105,1,46,104,
         999,1105,1,46,1101,1000,1,20,4,20,1105,1,46,98,99
     };
     Code code = to_code(test_code);
-    int input = 9;
-
-    State state = {};
-    while (step(&state, code, input) != -1);
-    //print_code(code);
+    run(code, 9);
+    free_code(code);
 }
 
 void part_one()
 {
     Code code = to_code(actual_code);
-    int input = 1;
-
-    State state = {};
-    while (step(&state, code, input) != -1);
-    //print_code(code);
+    run(code, 1);
+    free_code(code);
 }
 
 void part_two()
 {
     Code code = to_code(actual_code);
-    int input = 5;
-
-    State state = {};
-    while (step(&state, code, input) != -1);
-    //print_code(code);
+    run(code, 5);
+    free_code(code);
 }
 
-int main(int argc, const char **argv)
+int main()
 {
     test();
     printf("\n");
@@ -409,4 +249,3 @@ int main(int argc, const char **argv)
     part_two();
     return 0;
 }
-
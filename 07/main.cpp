@@ -149,254 +149,22 @@ Your puzzle answer was 9246095.
 #include <cstdlib>
 #include <cstring>
 #include <cassert>
+#include <chrono>
+#include <thread>
+#include <algorithm>
 
-#define OPCODES \
-    OPCODE(Add, 1)\
-    OPCODE(Mul, 2)\
-    OPCODE(Inp, 3)\
-    OPCODE(Out, 4)\
-    OPCODE(Jnz, 5)\
-    OPCODE(Jz, 6)\
-    OPCODE(Lt, 7)\
-    OPCODE(Equ, 8)\
-    OPCODE(Halt, 99)
-
-#define OPCODE(op, x) OP_ ## op = x,
-enum Opcode
-{
-    OPCODES
-
-    Opcode_Max
-};
-#undef OPCODE
-
-static const char* Opcode_names[Opcode_Max] = { };
-#define OPCODE(op, x) Opcode_names[x] = #op;
-bool init_opcode_names()
-{
-    OPCODES
-    return true;
-}
-#undef OPCODE
-static bool init = init_opcode_names();
-
-#define MAX_IO_BUFFER 100
-struct Buffer
-{
-    int write;
-    int read;
-    int data[MAX_IO_BUFFER];
-};
-
-void write(Buffer *buf, int x)
-{
-    buf->data[buf->write] = x;
-    buf->write++;
-    if (buf->write == MAX_IO_BUFFER)
-    {
-        buf->write = 0;
-    }
-}
-
-bool read(Buffer *buf, int *x)
-{
-    if (buf->read != buf->write)
-    {
-        *x = buf->data[buf->read];
-        buf->read++;
-        if (buf->read == MAX_IO_BUFFER)
-        {
-            buf->read = 0;
-        }
-        return true;
-    }
-    return false;
-}
-
-struct State
-{
-    int position;
-    bool halted;
-
-    //int input_p;
-    //int output_p;
-    //int input[MAX_IO_BUFFER];
-    //int output[MAX_IO_BUFFER];
-
-    Buffer *input;
-    Buffer *output;
-};
-
-struct Code
-{
-    int *data;
-    int size;
-
-    int operator[](int pos) const
-    {
-        return data[pos];
-    }
-    int& operator[](int pos)
-    {
-        return data[pos];
-    }
-};
-
-template <int N>
-Code to_code(int (&c)[N])
-{
-    int *data = (int*)malloc(sizeof(int) * N);
-    memcpy(data, c, sizeof(int) * N);
-    return { .data = data, .size = N };
-};
-
-void free_code(Code &c)
-{
-    free(c.data);
-    c = { };
-}
-
-void print_code(Code code)
-{
-    if (code.size > 0)
-    {
-        printf("%d", code[0]);
-        for (int i = 1; i < code.size; i++) printf(",%d", code[i]);
-        printf("\n");
-    }
-}
-
-Opcode decode_instr(int instr, int *m1, int *m2, int *m3)
-{
-    int op = instr % 100;
-    *m1 = (instr / 100) % 10;
-    *m2 = (instr / 1000) % 10;
-    *m3 = (instr / 10000) % 10;
-    return (Opcode)op;
-}
-
-int read(Code code, int pos, int mode)
-{
-    int a = code[pos];
-    return (mode == 1) ? a : code[a];
-}
-
-int step(State *s, Code code)
-{
-    int pos = s->position;
-    int instr = code[pos];
-    int m1, m2, m3;
-    Opcode op = decode_instr(instr, &m1, &m2, &m3);
-    printf("%s[%d, %d, %d]\n", Opcode_names[op], m1, m2, m3);
-    switch (op)
-    {
-    case OP_Add:
-        {
-            int oper1 = read(code, pos+1, m1);
-            int oper2 = read(code, pos+2, m2);
-            int res_pos = code[pos+3];
-            code[res_pos] = oper1 + oper2;
-            pos += 4;
-        } break;
-    case OP_Mul:
-        {
-            int oper1 = read(code, pos+1, m1);
-            int oper2 = read(code, pos+2, m2);
-            int res_pos = code[pos+3];
-            code[res_pos] = oper1 * oper2;
-            pos += 4;
-        } break;
-    case OP_Inp:
-        {
-            int res_pos = code[pos+1];
-            int res;
-            if (!read(s->input, &res))
-            {
-                printf("Waiting input...\n");
-                return 0;
-            }
-            printf("inp=%d\n", res);
-            code[res_pos] = res;
-            pos += 2;
-        } break;
-    case OP_Out:
-        {
-            int out = read(code, pos+1, m1);
-            write(s->output, out);
-            printf("out=%d\n", out);
-            pos += 2;
-        } break;
-    case OP_Jnz:
-        {
-            int oper1 = read(code, pos+1, m1);
-            int oper2 = read(code, pos+2, m2);
-            if (oper1 != 0)
-            {
-                pos = oper2;
-            }
-            else
-            {
-                pos += 3;
-            }
-        } break;
-    case OP_Jz:
-        {
-            int oper1 = read(code, pos+1, m1);
-            int oper2 = read(code, pos+2, m2);
-            if (oper1 == 0)
-            {
-                pos = oper2;
-            }
-            else
-            {
-                pos += 3;
-            }
-        } break;
-    case OP_Lt:
-        {
-            int oper1 = read(code, pos+1, m1);
-            int oper2 = read(code, pos+2, m2);
-            int res_pos = code[pos+3];
-            code[res_pos] = (oper1 < oper2) ? 1 : 0;
-            pos += 4;
-        } break;
-    case OP_Equ:
-        {
-            int oper1 = read(code, pos+1, m1);
-            int oper2 = read(code, pos+2, m2);
-            int res_pos = code[pos+3];
-            code[res_pos] = (oper1 == oper2) ? 1 : 0;
-            pos += 4;
-        } break;
-    case OP_Halt:
-        {
-            printf("Halt!");
-            s->halted = true;
-            return -1;
-        } break;
-
-    case Opcode_Max:
-    //default:
-        printf("BUG!\n");
-        return -1;
-    }
-    s->position = pos;
-    return 1;
-}
-
-void execute(State *state, Code code)
-{
-    while (step(state, code) == 1);
-}
+#include "../intcode/intcode.h"
+#include "../intcode/coro.h"
+#include "../intcode/warm.h"
 
 namespace sample01
 {
-    int code_data[] = { 3,15,3,16,1002,16,10,16,1,16,15,15,4,15,99,0,0 };
+    IntWord code_data[] = { 3,15,3,16,1002,16,10,16,1,16,15,15,4,15,99,0,0 };
     int best_phase_seq[] = {4,3,2,1,0};
     int max_thruster = 43210;
 }
 
-int actual_code[] = {
+IntWord actual_code[] = {
     3,8,1001,8,10,8,105,1,0,0,21,42,67,84,109,126,207,288,369,450,99999,3,9,102,4,9,9,1001,9,4,9,102,2,9,9,101,2,9,9,4,9,99,3,9,1001,9,5,9,1002,9,5,9,1001,9,5,9,1002,9,5,9,101,5,9,9,4,9,99,3,9,101,5,9,9,1002,9,3,9,1001,9,2,9,4,9,99,3,9,1001,9,2,9,102,4,9,9,101,2,9,9,102,4,9,9,1001,9,2,9,4,9,99,3,9,102,2,9,9,101,5,9,9,1002,9,2,9,4,9,99,3,9,1002,9,2,9,4,9,3,9,1002,9,2,9,4,9,3,9,1002,9,2,9,4,9,3,9,101,2,9,9,4,9,3,9,101,2,9,9,4,9,3,9,1001,9,2,9,4,9,3,9,101,2,9,9,4,9,3,9,1001,9,2,9,4,9,3,9,1002,9,2,9,4,9,3,9,1001,9,1,9,4,9,99,3,9,1001,9,2,9,4,9,3,9,1002,9,2,9,4,9,3,9,1002,9,2,9,4,9,3,9,1001,9,2,9,4,9,3,9,102,2,9,9,4,9,3,9,102,2,9,9,4,9,3,9,1001,9,2,9,4,9,3,9,102,2,9,9,4,9,3,9,1002,9,2,9,4,9,3,9,102,2,9,9,4,9,99,3,9,102,2,9,9,4,9,3,9,1001,9,1,9,4,9,3,9,101,1,9,9,4,9,3,9,101,1,9,9,4,9,3,9,1002,9,2,9,4,9,3,9,102,2,9,9,4,9,3,9,101,2,9,9,4,9,3,9,101,1,9,9,4,9,3,9,101,1,9,9,4,9,3,9,101,2,9,9,4,9,99,3,9,1001,9,2,9,4,9,3,9,101,1,9,9,4,9,3,9,101,2,9,9,4,9,3,9,1001,9,1,9,4,9,3,9,1001,9,2,9,4,9,3,9,1001,9,1,9,4,9,3,9,101,1,9,9,4,9,3,9,102,2,9,9,4,9,3,9,102,2,9,9,4,9,3,9,101,1,9,9,4,9,99,3,9,102,2,9,9,4,9,3,9,1001,9,1,9,4,9,3,9,101,2,9,9,4,9,3,9,1002,9,2,9,4,9,3,9,102,2,9,9,4,9,3,9,1001,9,1,9,4,9,3,9,1002,9,2,9,4,9,3,9,101,1,9,9,4,9,3,9,102,2,9,9,4,9,3,9,1001,9,2,9,4,9,99
 };
 
@@ -431,7 +199,7 @@ void permutations(int n, int *xs, int N, void callback(int *xs, int N, void *ptr
     }
 }
 
-int single_iteration1(int *phase_setting, int N)
+IntWord single_iteration1(int *phase_setting, int N)
 {
     //  p0    p1    p2    p3    p4    p5
     //  -->[A]-->[B]-->[C]-->[D]-->[E]--> result
@@ -448,46 +216,46 @@ int single_iteration1(int *phase_setting, int N)
         State state = {};
         state.input = &pipes[i];
         state.output = &pipes[i+1];
+        warm_start(&state, code);
         execute(&state, code);
+        free_code(code);
     }
 
-    int res = -1;
+    IntWord res = -1;
     read(&pipes[5], &res);
-    printf("res=%d\n", res); fflush(stdout);
+    printf("res=%" PRId64 "\n", res); fflush(stdout);
+    for (int i = 0; i < 6; i++) free_buffer(&pipes[i]);
     return res;
 }
 
 void iteration1(int *xs, int N, void *ptr)
 {
-    int *max = (int*)ptr;
-    int res = single_iteration1(xs, N);
+    IntWord *max = (IntWord*)ptr;
+    IntWord res = single_iteration1(xs, N);
     if (res > *max) *max = res;
 }
 
-int single_iteration2(int *phase_setting, int N)
+#define MAX_AMPLIFIERS 16
+
+// Runs the amplifiers in code[] round-robin on this thread, switching to the
+// next one whenever an amplifier blocks on input.
+IntWord feedback_loop(Code *code, int *phase_setting, int N)
 {
     //   p0    p1    p2    p3    p4    p0
     // -+-->[A]-->[B]-->[C]-->[D]-->[E]-+-> result
     //  +-------------------------------+
-    Buffer pipes[5] = {};
+    assert(N >= 1 && N <= MAX_AMPLIFIERS);
+    Buffer pipes[MAX_AMPLIFIERS] = {};
     for (int i = 0; i < N; i++) write(&pipes[i], phase_setting[i]);
 
     // input signal
     write(&pipes[0], 0);
 
-    Code code[5] = {
-        to_code(actual_code),
-        to_code(actual_code),
-        to_code(actual_code),
-        to_code(actual_code),
-        to_code(actual_code),
-    };
-
-    State states[5] = {};
+    State states[MAX_AMPLIFIERS] = {};
     for (int i = 0; i < N; i++)
     {
         states[i].input = &pipes[i];
-        states[i].output = &pipes[(i+1)%5];
+        states[i].output = &pipes[(i+1)%N];
     }
 
     int index = 0;
@@ -510,37 +278,462 @@ int single_iteration2(int *phase_setting, int N)
         execute(s, c);
     }
 
-    int res = -1;
+    IntWord res = -1;
     read(&pipes[0], &res);
-    printf("res=%d\n", res); fflush(stdout);
+    for (int i = 0; i < N; i++) free_buffer(&pipes[i]);
+    return res;
+}
+
+// Amplifier thread, runs until the program halts or its input is closed.
+void run_amplifier(State *s, Code code)
+{
+    while (true)
+    {
+        execute(s, code);
+        if (s->halted || !wait_readable(s->input)) break;
+    }
+}
+
+// One thread per amplifier for feedback_loop_threaded(). The threads are
+// started once and sleep between runs, a run only resets the pipes and
+// the states.
+struct AmplifierThreads
+{
+    int N;
+    std::thread threads[MAX_AMPLIFIERS];
+    Buffer pipes[MAX_AMPLIFIERS];
+    State states[MAX_AMPLIFIERS];
+    Code code[MAX_AMPLIFIERS];
+
+    uint32_t run;           // atomic, bumped to start a run
+    uint32_t last_finished; // atomic, 1 once the last amplifier is done
+    uint32_t finished;      // atomic, amplifiers done with the run
+    bool quit;
+};
+
+static AmplifierThreads *amplifier_threads = nullptr;
+
+// Sleeps until *counter is at least value.
+void wait_counter(uint32_t *counter, uint32_t value)
+{
+    uint32_t x;
+    while ((x = __atomic_load_n(counter, __ATOMIC_ACQUIRE)) < value) futex_wait(counter, x);
+}
+
+void amplifier_thread(AmplifierThreads *t, int i)
+{
+    uint32_t seen = 0;
+    while (true)
+    {
+        uint32_t run;
+        while ((run = __atomic_load_n(&t->run, __ATOMIC_ACQUIRE)) == seen) futex_wait(&t->run, seen);
+        seen = run;
+        if (t->quit) break;
+
+        run_amplifier(&t->states[i], t->code[i]);
+        if (i == t->N - 1)
+        {
+            __atomic_store_n(&t->last_finished, 1, __ATOMIC_RELEASE);
+            futex_wake(&t->last_finished);
+        }
+        __atomic_add_fetch(&t->finished, 1, __ATOMIC_RELEASE);
+        futex_wake(&t->finished);
+    }
+}
+
+// Starts the threads feedback_loop_threaded() runs N amplifiers on.
+void start_amplifier_threads(int N)
+{
+    assert(N >= 1 && N <= MAX_AMPLIFIERS);
+    assert(!amplifier_threads);
+    AmplifierThreads *t = new AmplifierThreads();
+    t->N = N;
+    for (int i = 0; i < N; i++) t->threads[i] = std::thread(amplifier_thread, t, i);
+    amplifier_threads = t;
+}
+
+void stop_amplifier_threads()
+{
+    AmplifierThreads *t = amplifier_threads;
+    t->quit = true;
+    __atomic_add_fetch(&t->run, 1, __ATOMIC_RELEASE);
+    futex_wake(&t->run);
+    for (int i = 0; i < t->N; i++) t->threads[i].join();
+    delete t;
+    amplifier_threads = nullptr;
+}
+
+// Same as feedback_loop(), but each amplifier runs on its own thread and
+// blocks on its input pipe. Done when the last amplifier halts. Runs on
+// the threads of start_amplifier_threads(N).
+IntWord feedback_loop_threaded(Code *code, int *phase_setting, int N)
+{
+    AmplifierThreads *t = amplifier_threads;
+    assert(t && t->N == N);
+    for (int i = 0; i < N; i++)
+    {
+        init_buffer(&t->pipes[i], 64, BUFFER_Shared | BUFFER_Blocking);
+        write(&t->pipes[i], phase_setting[i]);
+    }
+
+    // input signal
+    write(&t->pipes[0], 0);
+
+    for (int i = 0; i < N; i++)
+    {
+        t->states[i] = {};
+        t->states[i].input = &t->pipes[i];
+        t->states[i].output = &t->pipes[(i+1)%N];
+        t->code[i] = code[i];
+    }
+    t->last_finished = 0;
+    t->finished = 0;
+    __atomic_add_fetch(&t->run, 1, __ATOMIC_RELEASE);
+    futex_wake(&t->run);
+
+    wait_counter(&t->last_finished, 1);
+    // Wake up any amplifier still waiting for input.
+    for (int i = 0; i < N; i++) close_buffer(&t->pipes[i]);
+    wait_counter(&t->finished, N);
+
+    IntWord res = -1;
+    read(&t->pipes[0], &res);
+    for (int i = 0; i < N; i++) free_buffer(&t->pipes[i]);
+    return res;
+}
+
+// Takes the signals out of the last amplifier back to the first one.
+VmTask feed_back(Vm *last, Vm *first, IntWord *result)
+{
+    IntWord x;
+    while (co_await last->output(&x))
+    {
+        *result = x;
+        co_await first->input(x);
+    }
+}
+
+// Same as feedback_loop(), with the amplifiers as coroutine VMs. They are
+// connected directly, only the feedback from the last one goes through a
+// task.
+IntWord feedback_loop_coro(Code *code, int *phase_setting, int N)
+{
+    assert(N >= 1 && N <= MAX_AMPLIFIERS);
+    Scheduler scheduler = {};
+    Vm vms[MAX_AMPLIFIERS];
+    for (int i = 0; i < N; i++)
+    {
+        init_vm(&vms[i], &scheduler, code[i]);
+        write(&vms[i].in, phase_setting[i]);
+    }
+    for (int i = 0; i < N-1; i++) connect(&vms[i], &vms[i+1]);
+
+    // input signal
+    write(&vms[0].in, 0);
+
+    IntWord res = -1;
+    VmTask task = feed_back(&vms[N-1], &vms[0], &res);
+    run(&scheduler);
+    free_task(task);
+    for (int i = 0; i < N; i++) free_vm(&vms[i]);
+    return res;
+}
+
+static bool use_threads = false;
+static bool use_coroutines = false;
+
+IntWord single_iteration2(int *phase_setting, int N)
+{
+    Code code[5] = {
+        to_code(actual_code),
+        to_code(actual_code),
+        to_code(actual_code),
+        to_code(actual_code),
+        to_code(actual_code),
+    };
+
+    IntWord res;
+    if (use_threads) res = feedback_loop_threaded(code, phase_setting, N);
+    else if (use_coroutines) res = feedback_loop_coro(code, phase_setting, N);
+    else res = feedback_loop(code, phase_setting, N);
+    for (int i = 0; i < 5; i++) free_code(code[i]);
+
+    printf("res=%" PRId64 "\n", res); fflush(stdout);
     return res;
 }
 
 void iteration2(int *xs, int N, void *ptr)
 {
-    int *max = (int*)ptr;
-    int res = single_iteration2(xs, N);
+    IntWord *max = (IntWord*)ptr;
+    IntWord res = single_iteration2(xs, N);
     if (res > *max) *max = res;
 }
 
+// Parallel sweep over all the orderings of the phase settings.
+//
+// The permutations are numbered in lexicographic order and handed out to
+// the workers in chunks from an atomic counter. A worker unranks the first
+// permutation of its chunk and steps through the rest with
+// std::next_permutation(). Each worker keeps one VM per amplifier and only
+// resets their memory between permutations. The best thruster signal is
+// kept per worker and combined with a CAS loop at the end.
+
+struct Sweep
+{
+    Code code;
+    int phases[MAX_AMPLIFIERS]; // sorted
+    int N;
+    bool feedback;        // last amplifier feeds the first one
+
+    int64_t total;        // N!
+    int64_t chunk_size;
+    int64_t next_chunk;   // atomic
+    IntWord best;         // atomic
+};
+
+// Writes permutation number index (lexicographic) of the sorted phases to xs.
+void unrank_permutation(const int *phases, int N, int64_t index, int *xs)
+{
+    int rest[MAX_AMPLIFIERS];
+    memcpy(rest, phases, N * sizeof(int));
+    int64_t f = 1;
+    for (int i = 2; i < N; i++) f *= i;
+    for (int i = 0; i < N; i++)
+    {
+        int64_t k = index / f;
+        index %= f;
+        xs[i] = rest[k];
+        memmove(rest + k, rest + k + 1, (N - i - k - 1) * sizeof(int));
+        if (i < N - 1) f /= (N - 1 - i);
+    }
+}
+
+// Runs the amplifiers round-robin until they have all halted or none of
+// them can make progress (a chain whose programs wait for more input than
+// they will get). Returns the last signal out of the last amplifier, -1 if
+// there was none.
+IntWord run_amplifiers(Code *code, Buffer *pipes, State *states, const int *phase_setting, int N, bool feedback)
+{
+    int pipe_num = feedback ? N : N + 1;
+    for (int i = 0; i < pipe_num; i++) free_buffer(&pipes[i]);
+    for (int i = 0; i < N; i++) write(&pipes[i], phase_setting[i]);
+
+    // input signal
+    write(&pipes[0], 0);
+
+    for (int i = 0; i < N; i++)
+    {
+        states[i] = {};
+        states[i].input = &pipes[i];
+        states[i].output = &pipes[feedback ? (i+1)%N : i+1];
+    }
+
+    int running = N;
+    while (running > 0)
+    {
+        bool progress = false;
+        for (int i = 0; i < N; i++)
+        {
+            if (states[i].halted) continue;
+            uint32_t read_before = pipes[i].read;
+            execute_threaded(&states[i], code[i]);
+            if (states[i].halted) running--;
+            if (states[i].halted || pipes[i].read != read_before) progress = true;
+        }
+        if (!progress) break;
+    }
+
+    Buffer *result = &pipes[feedback ? 0 : N];
+    IntWord res = -1;
+    while (read(result, &res));
+    return res;
+}
+
+void sweep_worker(Sweep *sweep)
+{
+    int N = sweep->N;
+    Code code[MAX_AMPLIFIERS];
+    Buffer pipes[MAX_AMPLIFIERS + 1] = {};
+    State states[MAX_AMPLIFIERS];
+    for (int i = 0; i < N; i++) code[i] = copy_code(sweep->code);
+
+    IntWord best = -1;
+    int xs[MAX_AMPLIFIERS];
+    while (true)
+    {
+        int64_t chunk = __atomic_fetch_add(&sweep->next_chunk, 1, __ATOMIC_RELAXED);
+        int64_t first = chunk * sweep->chunk_size;
+        if (first >= sweep->total) break;
+        int64_t last = first + sweep->chunk_size;
+        if (last > sweep->total) last = sweep->total;
+
+        unrank_permutation(sweep->phases, N, first, xs);
+        for (int64_t index = first; index < last; index++)
+        {
+            for (int i = 0; i < N; i++)
+            {
+                memcpy(code[i].data, sweep->code.data, sweep->code.code_size * sizeof(IntWord));
+                reset_extra_memory(code[i]);
+            }
+            IntWord res = run_amplifiers(code, pipes, states, xs, N, sweep->feedback);
+            if (res > best) best = res;
+            std::next_permutation(xs, xs + N);
+        }
+    }
+
+    IntWord current = __atomic_load_n(&sweep->best, __ATOMIC_RELAXED);
+    while (best > current &&
+        !__atomic_compare_exchange_n(&sweep->best, &current, best, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    for (int i = 0; i < N; i++) free_code(code[i]);
+    for (int i = 0; i < N + 1; i++) free_buffer(&pipes[i]);
+}
+
+// Returns the highest thruster signal over all the orderings of phases[]
+// (distinct values), using thread_num workers (0 for one per core).
+IntWord sweep_phase_settings(Code code, const int *phases, int N, bool feedback, int thread_num = 0)
+{
+    assert(N >= 1 && N <= MAX_AMPLIFIERS);
+    Sweep sweep = {};
+    sweep.code = code;
+    memcpy(sweep.phases, phases, N * sizeof(int));
+    std::sort(sweep.phases, sweep.phases + N);
+    sweep.N = N;
+    sweep.feedback = feedback;
+    sweep.total = 1;
+    for (int i = 2; i <= N; i++) sweep.total *= i;
+    sweep.best = -1;
+
+    if (thread_num <= 0) thread_num = std::thread::hardware_concurrency();
+    if (thread_num <= 0) thread_num = 1;
+    // Several chunks per thread so an uneven split evens out.
+    sweep.chunk_size = sweep.total / (thread_num * 16);
+    if (sweep.chunk_size < 1) sweep.chunk_size = 1;
+
+    std::thread *threads = new std::thread[thread_num];
+    for (int i = 0; i < thread_num; i++) threads[i] = std::thread(sweep_worker, &sweep);
+    for (int i = 0; i < thread_num; i++) threads[i].join();
+    delete[] threads;
+    return sweep.best;
+}
+
+static bool serial = false;
+
 void part_one()
 {
     int phases[] = {0,1,2,3,4};
-    int result = 0;
-    permutations(5, phases, 5, iteration1, &result);
-    printf("thruster output %d\n", result);
+    IntWord result = 0;
+    if (serial)
+    {
+        permutations(5, phases, 5, iteration1, &result);
+    }
+    else
+    {
+        Code code = to_code(actual_code);
+        result = sweep_phase_settings(code, phases, 5, false);
+        free_code(code);
+    }
+    printf("thruster output %" PRId64 "\n", result);
 }
 
 void part_two()
 {
     int phases[] = {5,6,7,8,9};
-    int result = 0;
-    permutations(5, phases, 5, iteration2, &result);
-    printf("thruster output %d\n", result);
+    IntWord result = 0;
+    if (serial)
+    {
+        if (use_threads) start_amplifier_threads(5);
+        permutations(5, phases, 5, iteration2, &result);
+        if (use_threads) stop_amplifier_threads();
+    }
+    else
+    {
+        Code code = to_code(actual_code);
+        result = sweep_phase_settings(code, phases, 5, true);
+        free_code(code);
+    }
+    printf("thruster output %" PRId64 "\n", result);
+}
+
+// Times part two on the cooperative, threaded and coroutine loops. The
+// amplifier memory is reset between runs, not reallocated, and the
+// threaded loop keeps its threads.
+void bench()
+{
+    const int rounds = 20;
+    Code original = to_code(actual_code);
+    Code code[5];
+    for (int i = 0; i < 5; i++) code[i] = copy_code(original);
+
+    typedef IntWord (*Loop)(Code *code, int *phase_setting, int N);
+    struct { const char *name; Loop loop; } loops[] = {
+        { "cooperative", feedback_loop },
+        { "threaded", feedback_loop_threaded },
+        { "coroutines", feedback_loop_coro },
+    };
+    start_amplifier_threads(5);
+    for (auto &l : loops)
+    {
+        IntWord result = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int round = 0; round < rounds; round++)
+        {
+            int phases[] = {5,6,7,8,9};
+            do
+            {
+                for (int i = 0; i < 5; i++) memcpy(code[i].data, original.data, original.code_size * sizeof(IntWord));
+                IntWord res = l.loop(code, phases, 5);
+                if (res > result) result = res;
+            } while (std::next_permutation(phases, phases + 5));
+        }
+        double us = std::chrono::duration<double, std::micro>(
+            std::chrono::steady_clock::now() - start).count() / (rounds * 120);
+        printf("%-12s %10.2fus per phase setting, thruster output %" PRId64 "\n",
+            l.name, us, result);
+    }
+    stop_amplifier_threads();
+
+    for (int i = 0; i < 5; i++) free_code(code[i]);
+
+    // The sweep on one thread and on all of them, for part two and for a
+    // longer chain of eight amplifiers (40320 orderings).
+    int thread_num = std::thread::hardware_concurrency();
+    int feedback_phases[] = {5,6,7,8,9};
+    int chain_phases[] = {0,1,2,3,4,5,6,7};
+    struct { const char *name; const int *phases; int N; bool feedback; } sweeps[] = {
+        { "5 feedback", feedback_phases, 5, true },
+        { "8 chain", chain_phases, 8, false },
+    };
+    for (auto &sw : sweeps)
+    {
+        double one_us = 0;
+        for (int threads = 1; ; threads *= 2)
+        {
+            if (threads > thread_num) threads = thread_num;
+            auto start = std::chrono::steady_clock::now();
+            IntWord result = sweep_phase_settings(original, sw.phases, sw.N, sw.feedback, threads);
+            double us = std::chrono::duration<double, std::micro>(
+                std::chrono::steady_clock::now() - start).count();
+            if (threads == 1) one_us = us;
+            printf("sweep %-10s %2d threads %10.0fus (%5.2fx), best %" PRId64 "\n",
+                sw.name, threads, us, one_us / us, result);
+            if (threads == thread_num) break;
+        }
+    }
+    free_code(original);
 }
 
 int main(int argc, const char **argv)
 {
+    // day07 [serial|threads|coro|bench]
+    if (argc > 1 && strcmp(argv[1], "bench") == 0)
+    {
+        bench();
+        return 0;
+    }
+    use_threads = (argc > 1 && strcmp(argv[1], "threads") == 0);
+    use_coroutines = (argc > 1 && strcmp(argv[1], "coro") == 0);
+    serial = use_threads || use_coroutines || (argc > 1 && strcmp(argv[1], "serial") == 0);
     //part_one();
     part_two();
     return 0;
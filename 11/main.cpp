@@ -127,280 +127,7 @@ Your puzzle answer was AHCHZEPK.
 #include <cstring>
 #include <cassert>
 
-typedef int64_t IntWord;
-
-#define OPCODES \
-    OPCODE(Add, 1)\
-    OPCODE(Mul, 2)\
-    OPCODE(Inp, 3)\
-    OPCODE(Out, 4)\
-    OPCODE(Jnz, 5)\
-    OPCODE(Jz, 6)\
-    OPCODE(Lt, 7)\
-    OPCODE(Equ, 8)\
-    OPCODE(ModRel, 9)\
-    OPCODE(Halt, 99)
-
-#define OPCODE(op, x) OP_ ## op = x,
-enum Opcode
-{
-    OPCODES
-
-    Opcode_Max
-};
-#undef OPCODE
-
-static const char* Opcode_names[Opcode_Max] = { };
-#define OPCODE(op, x) Opcode_names[x] = #op;
-bool init_opcode_names()
-{
-    OPCODES
-    return true;
-}
-#undef OPCODE
-static bool init = init_opcode_names();
-
-#define MAX_IO_BUFFER 100
-struct Buffer
-{
-    int write;
-    int read;
-    IntWord data[MAX_IO_BUFFER];
-};
-
-void write(Buffer *buf, IntWord x)
-{
-    buf->data[buf->write] = x;
-    buf->write++;
-    if (buf->write == MAX_IO_BUFFER)
-    {
-        buf->write = 0;
-    }
-}
-
-bool read(Buffer *buf, IntWord *x)
-{
-    if (buf->read != buf->write)
-    {
-        *x = buf->data[buf->read];
-        buf->read++;
-        if (buf->read == MAX_IO_BUFFER)
-        {
-            buf->read = 0;
-        }
-        return true;
-    }
-    return false;
-}
-
-struct State
-{
-    int position;
-    int relative_base;
-    bool halted;
-
-    Buffer *input;
-    Buffer *output;
-};
-
-struct Code
-{
-    IntWord *data;
-    int code_size;
-    int memory_size; // code_size + extra memory
-
-    IntWord operator[](int pos) const
-    {
-        return data[pos];
-    }
-    IntWord& operator[](int pos)
-    {
-        return data[pos];
-    }
-};
-
-template <int N>
-Code to_code(IntWord (&c)[N], int extra_memory)
-{
-    IntWord *data = (IntWord*)malloc(sizeof(IntWord) * (N + extra_memory));
-    memcpy(data, c, sizeof(IntWord) * N);
-    memset(data + N, 0, sizeof(IntWord) * extra_memory);
-    return { .data = data, .code_size = N, .memory_size = N + extra_memory };
-};
-
-void free_code(Code &c)
-{
-    free(c.data);
-    c = { };
-}
-
-void print_code(Code code)
-{
-    if (code.code_size > 0)
-    {
-        printf("%lld", code[0]);
-        for (int i = 1; i < code.code_size; i++) printf(",%lld", code[i]);
-        printf("\n");
-    }
-}
-
-Opcode decode_instr(IntWord instr, int *m1, int *m2, int *m3)
-{
-    int op = instr % 100;
-    *m1 = (instr / 100) % 10;
-    *m2 = (instr / 1000) % 10;
-    *m3 = (instr / 10000) % 10;
-    return (Opcode)op;
-}
-
-IntWord read(State *s, Code code, int pos, int mode)
-{
-    IntWord a = code[pos];
-    switch (mode)
-    {
-        case 0: return code[a];
-        case 1: return a;
-        case 2: return code[s->relative_base + a];
-        default:
-            assert("invalid address mode" && 0);
-    }
-    return 0;
-}
-
-IntWord read_pos(State *s, Code code, int pos, int mode)
-{
-    IntWord a = code[pos];
-    switch (mode)
-    {
-        case 0: return a;
-        case 2: return s->relative_base + a;
-        default:
-            assert("invalid address mode" && 0);
-    }
-    return 0;
-}
-
-int step(State *s, Code code)
-{
-    int pos = s->position;
-    IntWord instr = code[pos];
-    int m1, m2, m3;
-    Opcode op = decode_instr(instr, &m1, &m2, &m3);
-    //printf("%d: %s[%d, %d, %d]\n", pos, Opcode_names[op], m1, m2, m3);
-    switch (op)
-    {
-    case OP_Add:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            IntWord oper2 = read(s, code, pos+2, m2);
-            IntWord res_pos = read_pos(s, code, pos+3, m3);
-            //printf(" [%lld] <- %lld + %lld\n", res_pos, oper1, oper2);
-            code[res_pos] = oper1 + oper2;
-            pos += 4;
-        } break;
-    case OP_Mul:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            IntWord oper2 = read(s, code, pos+2, m2);
-            IntWord res_pos = read_pos(s, code, pos+3, m3);
-            //printf(" [%lld] <- %lld * %lld\n", res_pos, oper1, oper2);
-            code[res_pos] = oper1 * oper2;
-            pos += 4;
-        } break;
-    case OP_Inp:
-        {
-            IntWord res;
-            if (!read(s->input, &res))
-            {
-                //printf("Waiting input...\n");
-                return 0;
-            }
-            IntWord res_pos = read_pos(s, code, pos+1, m1);
-            //printf(" [%lld] <- inp=%lld\n", res_pos, res);
-            code[res_pos] = res;
-            pos += 2;
-        } break;
-    case OP_Out:
-        {
-            IntWord out = read(s, code, pos+1, m1);
-            write(s->output, out);
-            //printf("out=%lld\n", out);
-            pos += 2;
-        } break;
-    case OP_Jnz:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            IntWord oper2 = read(s, code, pos+2, m2);
-            //printf(" %lld != 0 => pos=%lld\n", oper1, oper2);
-            if (oper1 != 0)
-            {
-                pos = oper2;
-            }
-            else
-            {
-                pos += 3;
-            }
-        } break;
-    case OP_Jz:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            IntWord oper2 = read(s, code, pos+2, m2);
-            //printf(" %lld == 0 => pos=%lld\n", oper1, oper2);
-            if (oper1 == 0)
-            {
-                pos = oper2;
-            }
-            else
-            {
-                pos += 3;
-            }
-        } break;
-    case OP_Lt:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            IntWord oper2 = read(s, code, pos+2, m2);
-            IntWord res_pos = read_pos(s, code, pos+3, m3);
-            //printf(" [%lld] <- %lld < %lld\n", res_pos, oper1, oper2);
-            code[res_pos] = (oper1 < oper2) ? 1 : 0;
-            pos += 4;
-        } break;
-    case OP_Equ:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            IntWord oper2 = read(s, code, pos+2, m2);
-            IntWord res_pos = read_pos(s, code, pos+3, m3);
-            //printf(" [%lld] <- %lld == %lld\n", res_pos, oper1, oper2);
-            code[res_pos] = (oper1 == oper2) ? 1 : 0;
-            pos += 4;
-        } break;
-    case OP_ModRel:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            //printf(" %d => ", s->relative_base);
-            s->relative_base += oper1;
-            //printf(" %d\n", s->relative_base);
-            pos += 2;
-        } break;
-    case OP_Halt:
-        {
-            printf("Halt!\n");
-            s->halted = true;
-            return -1;
-        } break;
-
-    case Opcode_Max:
-    //default:
-        printf("BUG!\n");
-        return -1;
-    }
-    s->position = pos;
-    return 1;
-}
-
-void execute(State *state, Code code)
-{
-    while (step(state, code) == 1);
-}
+#include "../intcode/intcode.h"
 
 struct Canvas
 {
@@ -611,6 +338,8 @@ void paint(Code code)
     printf("Total nodes %d, unique %d\n", nodes.len, uniq);
     printf("%d <= x <= %d\n", robot.min_x, robot.max_x);
     printf("%d <= y <= %d\n", robot.min_y, robot.max_y);
+    free_buffer(&input);
+    free_buffer(&output);
 }
 
 void paint2(Code code)
@@ -674,6 +403,8 @@ void paint2(Code code)
         }
         putchar('\n');
     }
+    free_buffer(&input);
+    free_buffer(&output);
 }
 
 IntWord actual_code[] = {
@@ -689,12 +420,12 @@ void part_one()
 
 void part_two()
 {
-    Code code = to_code(actual_code, 10000);
+    Code code = to_code(actual_code, 4096);
     paint2(code);
     free_code(code);
 }
 
-int main(int argc, const char **argv)
+int main()
 {
     //part_one();
     part_two();
@@ -65,308 +65,12 @@ Your puzzle answer was 12338.
 #include <cstdlib>
 #include <cstring>
 #include <cassert>
+#include <chrono>
 
-typedef int64_t IntWord;
-
-#define OPCODES \
-    OPCODE(Add, 1)\
-    OPCODE(Mul, 2)\
-    OPCODE(Inp, 3)\
-    OPCODE(Out, 4)\
-    OPCODE(Jnz, 5)\
-    OPCODE(Jz, 6)\
-    OPCODE(Lt, 7)\
-    OPCODE(Equ, 8)\
-    OPCODE(ModRel, 9)\
-    OPCODE(Halt, 99)
-
-#define OPCODE(op, x) OP_ ## op = x,
-enum Opcode
-{
-    OPCODES
-
-    Opcode_Max
-};
-#undef OPCODE
-
-static const char* Opcode_names[Opcode_Max] = { };
-#define OPCODE(op, x) Opcode_names[x] = #op;
-bool init_opcode_names()
-{
-    OPCODES
-    return true;
-}
-#undef OPCODE
-static bool init = init_opcode_names();
-
-#define MAX_IO_BUFFER 1000
-struct Buffer
-{
-    int write;
-    int read;
-    IntWord data[MAX_IO_BUFFER];
-};
-
-void write(Buffer *buf, IntWord x)
-{
-    buf->data[buf->write] = x;
-    buf->write++;
-    if (buf->write == MAX_IO_BUFFER)
-    {
-        buf->write = 0;
-    }
-}
-
-bool read(Buffer *buf, IntWord *x)
-{
-    if (buf->read != buf->write)
-    {
-        *x = buf->data[buf->read];
-        buf->read++;
-        if (buf->read == MAX_IO_BUFFER)
-        {
-            buf->read = 0;
-        }
-        return true;
-    }
-    return false;
-}
-
-int readable_num(Buffer buf)
-{
-    if (buf.write >= buf.read)
-    {
-        return buf.write - buf.read;
-    }
-    return buf.write + MAX_IO_BUFFER - buf.read;
-}
-
-struct State
-{
-    int position;
-    int relative_base;
-    bool halted;
-
-    Buffer *input;
-    Buffer *output;
-};
-
-struct Code
-{
-    IntWord *data;
-    int code_size;
-    int memory_size; // code_size + extra memory
-
-    IntWord operator[](int pos) const
-    {
-        return data[pos];
-    }
-    IntWord& operator[](int pos)
-    {
-        return data[pos];
-    }
-};
-
-template <int N>
-Code to_code(IntWord (&c)[N], int extra_memory)
-{
-    IntWord *data = (IntWord*)calloc((N + extra_memory), sizeof(IntWord));
-    //IntWord *data = (IntWord*)malloc(sizeof(IntWord) * (N + extra_memory));
-    memcpy(data, c, sizeof(IntWord) * N);
-    //memset(data + N, 0, sizeof(IntWord) * extra_memory);
-    return { .data = data, .code_size = N, .memory_size = N + extra_memory };
-};
-
-void free_code(Code &c)
-{
-    free(c.data);
-    c = { };
-}
-
-void print_code(Code code)
-{
-    if (code.code_size > 0)
-    {
-        printf("%lld", code[0]);
-        for (int i = 1; i < code.code_size; i++) printf(",%lld", code[i]);
-        printf("\n");
-    }
-}
-
-Opcode decode_instr(IntWord instr, int *m1, int *m2, int *m3)
-{
-    int op = instr % 100;
-    *m1 = (instr / 100) % 10;
-    *m2 = (instr / 1000) % 10;
-    *m3 = (instr / 10000) % 10;
-    return (Opcode)op;
-}
-
-IntWord read(State *s, Code code, int pos, int mode)
-{
-    IntWord a = code[pos];
-    IntWord result;
-    switch (mode)
-    {
-        case 0: result = code[a]; break;
-        case 1: result = a; break;
-        case 2: result = code[s->relative_base + a]; break;
-        default:
-            assert("invalid address mode" && 0);
-    }
-    if (result == 549)
-    {
-        printf("!!!!! POS = %d\n", s->position);
-    }
-    return result;
-}
-
-IntWord read_pos(State *s, Code code, int pos, int mode)
-{
-    IntWord a = code[pos];
-    IntWord result;
-    switch (mode)
-    {
-        case 0: result = a; break;
-        case 2: result = s->relative_base + a; break;
-        default:
-            assert("invalid address mode" && 0);
-    }
-    if (result == 549)
-    {
-        printf("!!!!! WRITE POS = %d\n", s->position);
-        fflush(stdout);
-        assert(0);
-    }
-    return result;
-}
-
-int step(State *s, Code code)
-{
-    int pos = s->position;
-    IntWord instr = code[pos];
-    int m1, m2, m3;
-    Opcode op = decode_instr(instr, &m1, &m2, &m3);
-    //if (op == 0) {
-    //    s->halted = true;
-    //    return -1;
-    //}
-    //printf("%d: (%d) %s[%d, %d, %d]\n", pos, op, Opcode_names[op], m1, m2, m3);
-    switch (op)
-    {
-    case OP_Add:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            IntWord oper2 = read(s, code, pos+2, m2);
-            IntWord res_pos = read_pos(s, code, pos+3, m3);
-            //printf(" [%lld] <- %lld + %lld\n", res_pos, oper1, oper2);
-            code[res_pos] = oper1 + oper2;
-            pos += 4;
-        } break;
-    case OP_Mul:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            IntWord oper2 = read(s, code, pos+2, m2);
-            IntWord res_pos = read_pos(s, code, pos+3, m3);
-            //printf(" [%lld] <- %lld * %lld\n", res_pos, oper1, oper2);
-            code[res_pos] = oper1 * oper2;
-            pos += 4;
-        } break;
-    case OP_Inp:
-        {
-            IntWord res;
-            if (!read(s->input, &res))
-            {
-                //printf("Waiting input...\n");
-                return 0;
-            }
-            IntWord res_pos = read_pos(s, code, pos+1, m1);
-            //printf(" [%lld] <- inp=%lld\n", res_pos, res);
-            code[res_pos] = res;
-            pos += 2;
-        } break;
-    case OP_Out:
-        {
-            IntWord out = read(s, code, pos+1, m1);
-            write(s->output, out);
-            //printf("out=%lld\n", out);
-            pos += 2;
-        } break;
-    case OP_Jnz:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            IntWord oper2 = read(s, code, pos+2, m2);
-            //printf(" %lld != 0 => pos=%lld\n", oper1, oper2);
-            if (oper1 != 0)
-            {
-                pos = oper2;
-            }
-            else
-            {
-                pos += 3;
-            }
-        } break;
-    case OP_Jz:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            IntWord oper2 = read(s, code, pos+2, m2);
-            //printf(" %lld == 0 => pos=%lld\n", oper1, oper2);
-            if (oper1 == 0)
-            {
-                pos = oper2;
-            }
-            else
-            {
-                pos += 3;
-            }
-        } break;
-    case OP_Lt:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            IntWord oper2 = read(s, code, pos+2, m2);
-            IntWord res_pos = read_pos(s, code, pos+3, m3);
-            //printf(" [%lld] <- %lld < %lld\n", res_pos, oper1, oper2);
-            code[res_pos] = (oper1 < oper2) ? 1 : 0;
-            pos += 4;
-        } break;
-    case OP_Equ:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            IntWord oper2 = read(s, code, pos+2, m2);
-            IntWord res_pos = read_pos(s, code, pos+3, m3);
-            //printf(" [%lld] <- %lld == %lld\n", res_pos, oper1, oper2);
-            code[res_pos] = (oper1 == oper2) ? 1 : 0;
-            pos += 4;
-        } break;
-    case OP_ModRel:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            //printf(" %d => ", s->relative_base);
-            s->relative_base += oper1;
-            //printf(" %d\n", s->relative_base);
-            pos += 2;
-        } break;
-    case OP_Halt:
-        {
-            printf("Halt!\n");
-            s->halted = true;
-            return -1;
-        } break;
-
-    case Opcode_Max:
-    default:
-        printf("BUG!\n");
-        pos += 1;
-        //return -1;
-    }
-    s->position = pos;
-    return 1;
-}
-
-void execute(State *state, Code code)
-{
-    while (step(state, code) == 1);
-}
+#include "../intcode/intcode.h"
+#include "../intcode/coro.h"
+#include "../intcode/trace.h"
+#include "../intcode/watch.h"
 
 int min(int a, int b)
 {
@@ -433,10 +137,7 @@ Bounds determine_bounds(Code code)
     state.output = &output;
     while (!state.halted)
     {
-        for (int i = 0; i < 50; i++)
-        {
-            if (step(&state, code) != 1) break;
-        }
+        run_until(&state, code, RUN_Output, 3);
         IntWord i0, i1, i2;
         while (read(&output, &i0))
         {
@@ -446,134 +147,10 @@ Bounds determine_bounds(Code code)
             bounds.max_y = max(bounds.max_y, i1);
         }
     }
+    free_buffer(&output);
     return bounds;
 }
 
-void read_operand(Code code, int pos, int mode)
-{
-    IntWord a = code[pos];
-    switch (mode)
-    {
-        case 0: printf("[%lld]=%lld", a, code[a]); break;
-        case 1: printf("%lld", a); break;
-        case 2: printf("[B+%lld]=?", a); break;
-        default:
-            assert("invalid address mode" && 0);
-    }
-}
-
-void write_operand(Code code, int pos, int mode)
-{
-    IntWord a = code[pos];
-    switch (mode)
-    {
-        case 0: printf("[%lld]", a); break;
-        case 2: printf("[B+%lld]", a); break;
-        default:
-            assert("invalid address mode" && 0);
-    }
-}
-
-void print_instr(Code code, IntWord *position)
-{
-    IntWord pos = *position;
-    IntWord instr = code[pos];
-    int m1, m2, m3;
-    Opcode op = decode_instr(instr, &m1, &m2, &m3);
-    printf("%lld: (%d) %s[%d, %d, %d]    ", pos, op, Opcode_names[op], m1, m2, m3);
-    switch (op)
-    {
-    case OP_Add:
-        {
-            write_operand(code, pos+2, m3);
-            printf(" <- ");
-            read_operand(code, pos+1, m1);
-            printf(" + ");
-            read_operand(code, pos+2, m2);
-            pos += 4;
-        } break;
-    case OP_Mul:
-        {
-            write_operand(code, pos+2, m3);
-            printf(" <- ");
-            read_operand(code, pos+1, m1);
-            printf(" * ");
-            read_operand(code, pos+2, m2);
-            pos += 4;
-        } break;
-    case OP_Inp:
-        {
-            write_operand(code, pos+1, m1);
-            printf("<- inp");
-            pos += 2;
-        } break;
-    case OP_Out:
-        {
-            printf("out <- ");
-            read_operand(code, pos+1, m1);
-            pos += 2;
-        } break;
-    case OP_Jnz:
-        {
-            read_operand(code, pos+1, m1);
-            printf(" != 0 => pos <- ");
-            read_operand(code, pos+2, m2);
-            pos += 3;
-        } break;
-    case OP_Jz:
-        {
-            read_operand(code, pos+1, m1);
-            printf(" == 0 => pos <- ");
-            read_operand(code, pos+2, m2);
-            pos += 3;
-        } break;
-    case OP_Lt:
-        {
-            write_operand(code, pos+3, m3);
-            printf(" <- ");
-            read_operand(code, pos+1, m1);
-            printf(" < ");
-            read_operand(code, pos+2, m2);
-            pos += 4;
-        } break;
-    case OP_Equ:
-        {
-            write_operand(code, pos+3, m3);
-            printf(" <- ");
-            read_operand(code, pos+1, m1);
-            printf(" == ");
-            read_operand(code, pos+2, m2);
-            pos += 4;
-        } break;
-    case OP_ModRel:
-        {
-            printf("B <- ");
-            read_operand(code, pos+1, m1);
-            pos += 2;
-        } break;
-    case OP_Halt:
-        {
-            pos += 1;
-        } break;
-
-    case Opcode_Max:
-    default:
-        printf("BUG!\n");
-        pos += 1;
-    }
-    *position = pos;
-}
-
-void print_code(Code code, int beg, int end)
-{
-    IntWord position = beg;
-    while (position < end)
-    {
-        print_instr(code, &position);
-        putchar('\n');
-    }
-}
-
 int joystick_inputs[] = {
 1,0,-1,1,1,1,1,1,1,1,1,1,1,1,1,0,0,0,0,0,0,0,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
@@ -682,27 +259,57 @@ void print_inputs()
     printf("\n");
 }
 
-void execute_game(Code code, Screen screen, IntWord *score)
+int read_joystick()
 {
-    Buffer input = {};
-    Buffer output = {};
-    State state = {};
-    state.input = &input;
-    state.output = &output;
-    while (!state.halted)
+    int inp=0;
+    if (auto_joystick_inputs_used < auto_joystick_input_num)
+    {
+        int i = auto_joystick_inputs_used++;
+        inp = joystick_inputs[i];
+    }
+    else
     {
-        int res;
-        for (int i = 0; i < 10; i++)
+        int c;
+        while ((c = getchar()) != '\n')
         {
-            res = step(&state, code);
-            if (res != 1) break;
+            //int c = getchar();
+            if (c == 'a') {
+                printf("A read!\n");
+                inp = -1;
+                //break;
+            }
+            else if (c == 's') {
+                printf("S read!\n");
+                inp = 0;
+                //break;
+            }
+            else if (c == 'd') {
+                printf("D read!\n");
+                inp = 1;
+                //break;
+            }
+            else
+            {
+                printf("%d was not recognized char :(\n", c);
+                inp = 0;
+                //write(&input, 0);
+            }
+            printf("%c was pressed\n", (char)c);
+            fflush(stdout);
         }
-        while (readable_num(output) >= 3)
+    }
+    return inp;
+}
+
+VmTask play_game(Vm *vm, Screen screen, IntWord *score)
+{
+    while (true)
+    {
+        IntWord i0, i1, i2;
+        if (co_await vm->output(&i0))
         {
-            IntWord i0, i1, i2;
-            read(&output, &i0);
-            read(&output, &i1);
-            read(&output, &i2);
+            co_await vm->output(&i1);
+            co_await vm->output(&i2);
             if (i0 == -1 && i1 == 0)
             {
                 *score = i2;
@@ -715,69 +322,152 @@ void execute_game(Code code, Screen screen, IntWord *score)
                 screen(x, y) = tile;
             }
         }
-
-        if (res == 0) // waiting input
+        else if (vm->state.halted)
         {
+            break;
+        }
+        else
+        {
+            // The game waits for the joystick
             print_screen(screen);
             fflush(stdout);
 
-            int inp=0;
-            if (auto_joystick_inputs_used < auto_joystick_input_num)
-            {
-                int i = auto_joystick_inputs_used++;
-                inp = joystick_inputs[i];
-            }
-            else
-            {
-                int c;
-                while ((c = getchar()) != '\n')
-                {
-                    //int c = getchar();
-                    if (c == 'a') {
-                        printf("A read!\n");
-                        inp = -1;
-                        //break;
-                    }
-                    else if (c == 's') {
-                        printf("S read!\n");
-                        inp = 0;
-                        //break;
-                    }
-                    else if (c == 'd') {
-                        printf("D read!\n");
-                        inp = 1;
-                        //break;
-                    }
-                    else
-                    {
-                        printf("%d was not recognized char :(\n", c);
-                        inp = 0;
-                        //write(&input, 0);
-                    }
-                    printf("%c was pressed\n", (char)c);
-                    fflush(stdout);
-                }
-            }
+            int inp = read_joystick();
             add_input(inp);
-            write(&input, inp);
+            co_await vm->input(inp);
         }
     }
+}
+
+// Set by running "day13 trace <file>", see trace.h and intcode/replay.
+TraceRecorder *trace = nullptr;
+
+void execute_game(Code code, Screen screen, IntWord *score)
+{
+    Scheduler scheduler = {};
+    Vm vm;
+    init_vm(&vm, &scheduler, code);
+    VmTask game = play_game(&vm, screen, score);
+    if (trace) run(&scheduler, trace);
+    else run(&scheduler);
+    free_task(game);
+    free_vm(&vm);
 
     print_inputs();
 }
 
+// The state of the game in the memory of the program: the ball is at
+// 388-389 and moves by 390-391, the paddle x is at 392 and the score at 386.
+enum GameCell
+{
+    CELL_Score = 386,
+    CELL_BallX = 388,
+    CELL_PaddleX = 392,
+};
+
+struct GameState
+{
+    IntWord ball_x;
+    IntWord paddle_x;
+    IntWord score;
+};
+
+void watch_game_cell(void *user, IntWord addr, IntWord value)
+{
+    GameState *game = (GameState*)user;
+    switch (addr)
+    {
+        case CELL_Score: game->score = value; break;
+        case CELL_BallX: game->ball_x = value; break;
+        case CELL_PaddleX: game->paddle_x = value; break;
+    }
+}
+
+// Profiling policy of the autoplayer: counts the instructions and passes
+// the writes on to the watchpoints, when there are any.
+struct Autoplay
+{
+    Watchpoints *watch;
+    int64_t instructions;
+    bool waiting; // the last instruction is an input that got no value (yet)
+
+    static void enter(Autoplay *, const Code &, const State *) { }
+    static void leave(Autoplay *a)
+    {
+        // It runs again when the game gets the joystick.
+        if (a->waiting) a->instructions--;
+        a->waiting = false;
+    }
+    static void instr(Autoplay *a, int, IntWord instr)
+    {
+        a->instructions++;
+        a->waiting = (instr % 100 == OP_Inp);
+    }
+    static void stored(Autoplay *a, IntWord addr, IntWord value)
+    {
+        if (a->watch) Watchpoints::stored(a->watch, addr, value);
+    }
+    static void input(Autoplay *a, IntWord) { a->waiting = false; }
+    static void output(Autoplay *, IntWord) { }
+    static void relative_base(Autoplay *, IntWord) { }
+    static int jump(Autoplay *, const Code &, int, int to, bool, IntWord) { return to; }
+};
+
+// Plays the whole game without a screen or stdin, moving the paddle toward
+// the ball. The positions are decoded from the outputs or, with
+// from_memory, followed by watchpoints on the memory of the game (the
+// outputs are then dropped unread).
+IntWord autoplay(Code code, bool from_memory, int64_t *instructions)
+{
+    GameState game = {};
+    game.ball_x = load(code, CELL_BallX);
+    game.paddle_x = load(code, CELL_PaddleX);
+
+    Watchpoints watch = {};
+    add_watch(&watch, CELL_Score, watch_game_cell, &game);
+    add_watch(&watch, CELL_BallX, watch_game_cell, &game);
+    add_watch(&watch, CELL_PaddleX, watch_game_cell, &game);
+    Autoplay counter = {};
+    counter.watch = from_memory ? &watch : nullptr;
+
+    Buffer input = {};
+    Buffer output = {};
+    State state = {};
+    state.input = &input;
+    state.output = &output;
+    while (!state.halted)
+    {
+        execute_threaded(&state, code, false, &counter);
+
+        IntWord t[3];
+        while (read_n(&output, t, 3) == 3)
+        {
+            if (from_memory) continue;
+            if (t[0] == -1 && t[1] == 0) game.score = t[2];
+            else if (t[2] == 4) game.ball_x = t[0];
+            else if (t[2] == 3) game.paddle_x = t[0];
+        }
+        write(&input, (game.ball_x > game.paddle_x) - (game.ball_x < game.paddle_x));
+    }
+    free_buffer(&input);
+    free_buffer(&output);
+
+    *instructions = counter.instructions;
+    return game.score;
+}
+
 IntWord actual_code[] = {
     1,380,379,385,1008,2311,194223,381,1005,381,12,99,109,2312,1101,0,0,383,1101,0,0,382,20102,1,382,1,21002,383,1,2,21101,0,37,0,1106,0,578,4,382,4,383,204,1,1001,382,1,382,1007,382,38,381,1005,381,22,1001,383,1,383,1007,383,22,381,1005,381,18,1006,385,69,99,104,-1,104,0,4,386,3,384,1007,384,0,381,1005,381,94,107,0,384,381,1005,381,108,1105,1,161,107,1,392,381,1006,381,161,1101,-1,0,384,1106,0,119,1007,392,36,381,1006,381,161,1101,0,1,384,21002,392,1,1,21101,0,20,2,21101,0,0,3,21102,138,1,0,1106,0,549,1,392,384,392,21002,392,1,1,21102,20,1,2,21102,1,3,3,21102,1,161,0,1106,0,549,1101,0,0,384,20001,388,390,1,20102,1,389,2,21102,180,1,0,1106,0,578,1206,1,213,1208,1,2,381,1006,381,205,20001,388,390,1,21002,389,1,2,21101,205,0,0,1105,1,393,1002,390,-1,390,1101,0,1,384,20101,0,388,1,20001,389,391,2,21102,228,1,0,1105,1,578,1206,1,261,1208,1,2,381,1006,381,253,21002,388,1,1,20001,389,391,2,21101,0,253,0,1106,0,393,1002,391,-1,391,1102,1,1,384,1005,384,161,20001,388,390,1,20001,389,391,2,21101,0,279,0,1106,0,578,1206,1,316,1208,1,2,381,1006,381,304,20001,388,390,1,20001,389,391,2,21102,304,1,0,1105,1,393,1002,390,-1,390,1002,391,-1,391,1101,1,0,384,1005,384,161,20101,0,388,1,21002,389,1,2,21101,0,0,3,21102,1,338,0,1106,0,549,1,388,390,388,1,389,391,389,20102,1,388,1,21001,389,0,2,21101,0,4,3,21101,365,0,0,1106,0,549,1007,389,21,381,1005,381,75,104,-1,104,0,104,0,99,0,1,0,0,0,0,0,0,255,17,17,1,1,19,109,3,22101,0,-2,1,21201,-1,0,2,21102,1,0,3,21101,414,0,0,1105,1,549,21201,-2,0,1,21202,-1,1,2,21101,429,0,0,1105,1,601,2101,0,1,435,1,386,0,386,104,-1,104,0,4,386,1001,387,-1,387,1005,387,451,99,109,-3,2106,0,0,109,8,22202,-7,-6,-3,22201,-3,-5,-3,21202,-4,64,-2,2207,-3,-2,381,1005,381,492,21202,-2,-1,-1,22201,-3,-1,-3,2207,-3,-2,381,1006,381,481,21202,-4,8,-2,2207,-3,-2,381,1005,381,518,21202,-2,-1,-1,22201,-3,-1,-3,2207,-3,-2,381,1006,381,507,2207,-3,-4,381,1005,381,540,21202,-4,-1,-1,22201,-3,-1,-3,2207,-3,-4,381,1006,381,529,22102,1,-3,-7,109,-8,2105,1,0,109,4,1202,-2,38,566,201,-3,566,566,101,639,566,566,1202,-1,1,0,204,-3,204,-2,204,-1,109,-4,2105,1,0,109,3,1202,-1,38,593,201,-2,593,593,101,639,593,593,21001,0,0,-2,109,-3,2105,1,0,109,3,22102,22,-2,1,22201,1,-1,1,21101,0,421,2,21102,594,1,3,21101,0,836,4,21101,630,0,0,1106,0,456,21201,1,1475,-2,109,-3,2105,1,0,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1,1,0,2,0,2,0,0,2,0,0,0,2,2,0,2,2,2,0,2,0,0,2,0,2,2,0,0,0,0,0,2,0,2,2,0,0,0,1,1,0,2,0,0,2,0,0,0,2,0,0,0,2,0,2,0,2,0,2,0,2,2,2,0,2,0,2,0,0,2,0,2,2,0,0,0,1,1,0,2,2,0,2,0,2,2,0,0,0,2,2,0,2,0,0,0,0,2,2,0,2,2,2,0,2,2,0,2,0,2,2,0,0,0,1,1,0,2,2,2,2,2,2,0,2,2,2,2,0,0,2,2,0,0,2,2,2,2,2,0,0,0,0,2,2,2,2,2,2,2,0,0,1,1,0,2,2,0,2,0,2,2,2,2,2,2,0,0,2,2,2,2,2,2,0,0,2,0,0,0,2,2,2,2,0,2,0,0,0,0,1,1,0,2,0,0,0,2,0,2,0,2,2,2,0,0,2,2,0,0,2,2,2,0,0,0,0,0,2,2,2,0,0,2,0,2,0,0,1,1,0,2,2,0,0,2,2,2,0,0,0,0,0,2,0,0,2,2,2,2,0,2,0,0,2,0,0,2,2,0,0,0,0,2,2,0,1,1,0,0,0,2,0,2,0,2,0,2,2,0,2,2,2,0,2,2,0,2,2,0,0,0,2,0,0,0,2,2,2,0,0,0,0,0,1,1,0,0,0,2,0,0,2,2,0,2,0,2,0,2,0,0,2,0,2,0,0,0,2,2,2,2,2,2,0,2,2,2,2,2,2,0,1,1,0,0,2,0,2,2,2,0,0,2,0,2,0,2,2,2,0,0,2,2,0,2,0,2,2,2,2,2,2,2,0,2,0,2,0,0,1,1,0,2,0,2,0,0,0,0,0,0,0,0,0,2,2,2,2,0,0,0,0,0,2,0,2,2,0,2,0,2,2,2,2,2,2,0,1,1,0,2,2,0,0,0,2,2,2,0,0,2,2,0,2,0,2,2,0,2,2,2,0,0,2,2,0,2,2,0,0,2,2,2,2,0,1,1,0,0,2,0,0,2,0,0,0,0,0,0,2,2,0,2,2,2,0,0,0,0,0,0,0,2,0,0,2,0,0,2,2,0,2,0,1,1,0,2,0,0,2,2,2,0,2,2,2,2,0,0,2,2,0,2,0,2,2,2,2,2,2,2,0,2,2,2,2,2,2,0,0,0,1,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,4,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,3,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1,1,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1,64,86,97,12,60,6,31,61,53,79,45,82,7,4,9,5,60,42,15,39,54,90,43,57,68,25,79,48,37,54,2,55,31,6,48,97,78,53,17,72,15,58,88,20,60,98,39,43,49,7,32,59,11,32,67,3,96,42,4,6,34,58,24,37,15,87,72,83,76,30,89,70,86,55,42,15,62,21,65,88,35,52,79,16,20,94,18,98,68,58,83,25,72,39,92,66,41,50,92,25,90,17,86,53,89,64,12,54,98,97,49,31,43,59,33,55,58,11,27,62,30,23,20,4,24,13,37,16,82,66,57,58,28,97,35,84,89,13,1,57,1,55,90,98,17,22,43,70,33,6,77,9,17,6,70,72,15,22,72,75,35,84,93,74,10,69,8,6,85,39,7,98,55,39,66,39,52,60,63,3,49,59,28,37,8,84,75,6,98,37,8,19,91,74,54,42,70,94,18,10,1,34,67,10,5,75,98,59,35,77,54,59,88,14,28,10,72,11,30,85,35,88,94,44,3,71,2,91,63,71,4,50,23,38,75,95,17,20,28,88,34,30,93,79,63,61,75,40,75,47,72,25,15,49,62,64,91,72,5,36,90,45,52,80,48,19,70,45,7,72,44,5,39,11,27,32,97,98,73,51,33,56,9,54,33,36,4,10,84,82,20,28,9,41,26,78,96,5,61,20,44,70,59,69,59,48,24,91,88,46,2,67,14,89,44,82,40,25,53,91,11,61,55,88,95,55,92,9,81,76,59,76,94,2,34,3,57,61,11,87,18,23,77,94,72,88,1,95,77,64,3,77,2,6,42,52,79,27,69,59,33,36,20,44,6,45,36,9,10,51,12,64,11,62,83,36,50,61,85,20,16,81,36,94,54,17,72,28,26,53,47,42,38,72,87,59,17,63,8,12,48,22,77,45,42,33,6,29,87,53,66,35,32,32,24,72,31,96,17,83,62,1,66,54,96,1,37,74,53,26,55,9,22,69,66,46,40,97,9,85,10,51,38,70,44,5,59,59,87,25,90,73,11,74,63,33,33,25,65,69,80,20,30,32,10,86,29,18,67,77,76,89,9,55,89,70,95,49,38,89,58,45,52,44,35,66,19,48,82,67,60,92,66,38,21,54,6,6,86,29,45,2,24,13,35,51,20,5,61,1,47,88,50,45,78,80,46,81,17,26,7,34,28,41,14,15,79,23,8,57,69,58,92,66,92,70,59,40,74,28,21,33,77,27,95,93,67,7,14,68,29,44,98,14,51,25,64,10,60,67,9,6,69,25,41,78,81,32,35,96,89,29,69,35,93,61,25,35,71,61,97,40,67,36,29,77,42,34,31,59,47,63,22,19,39,6,42,33,79,4,76,38,75,5,1,29,31,38,3,64,35,33,19,90,43,47,30,43,86,33,76,4,85,66,26,98,91,33,59,93,6,78,27,31,22,89,78,86,70,49,83,81,15,20,8,2,13,30,18,22,73,53,37,48,66,93,46,27,62,72,55,65,9,83,20,32,41,12,63,20,16,55,98,31,20,46,27,17,93,84,59,15,90,29,72,13,83,88,21,49,29,67,47,7,7,12,38,36,25,16,20,80,63,55,46,27,51,72,79,94,68,75,34,41,24,91,72,64,90,81,82,93,96,47,1,57,75,81,56,14,57,58,54,24,40,40,71,46,16,3,34,79,46,28,42,9,55,87,85,23,14,11,98,15,31,28,44,81,96,94,10,51,44,57,11,55,31,15,9,93,76,92,69,12,25,27,82,43,80,54,18,58,6,82,59,81,65,96,38,69,2,28,86,70,22,66,10,5,88,56,79,31,77,48,61,34,87,7,17,21,37,16,26,68,64,72,30,3,6,88,26,24,3,77,50,34,67,79,31,3,77,26,72,51,23,25,194223
 };
 
 void part_one()
 {
-    Code code = to_code(actual_code, 20000);
+    Code code = to_code(actual_code, 4096);
     Bounds bounds = determine_bounds(code);
     free_code(code);
 
     Screen screen = alloc_screen(bounds.max_x+1, bounds.max_y+1);
-    code = to_code(actual_code, 20000);
+    code = to_code(actual_code, 4096);
     IntWord score = 0;
     execute_game(code, screen, &score);
     free_code(code);
@@ -799,7 +489,7 @@ void part_two()
     int height = 22;
 
     Screen screen = alloc_screen(width+1, height+1);
-    Code code = to_code(actual_code, 20000);
+    Code code = to_code(actual_code, 4096);
 
     // Insert quarters
     code[0] = 2;
@@ -810,13 +500,43 @@ void part_two()
 
     print_screen(screen);
 
-    printf("Score: %lld", score);
+    printf("Score: %" PRId64, score);
+}
+
+// Part two without the recorded inputs, run with "day13 auto" or
+// "day13 auto watch" to take the positions from memory.
+void part_two_auto(bool from_memory)
+{
+    Code code = to_code(actual_code, 4096);
+    code[0] = 2;
+
+    auto start = std::chrono::steady_clock::now();
+    int64_t instructions = 0;
+    IntWord score = autoplay(code, from_memory, &instructions);
+    double ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+    free_code(code);
+
+    printf("Score: %" PRId64 "\n", score);
+    printf("%lld instructions in %.2f ms (%.1f M/s), positions from the %s\n",
+           (long long)instructions, ms, instructions / ms / 1000.0, from_memory ? "memory" : "outputs");
 }
 
 int main(int argc, const char **argv)
 {
+    if (argc > 1 && strcmp(argv[1], "auto") == 0)
+    {
+        part_two_auto(argc > 2 && strcmp(argv[2], "watch") == 0);
+        return 0;
+    }
+    if (argc > 2 && strcmp(argv[1], "trace") == 0)
+    {
+        trace = open_trace(argv[2]);
+        if (!trace) printf("could not create the trace %s\n", argv[2]);
+    }
     //part_one();
     part_two();
+    if (trace) close_trace(trace);
     return 0;
 }
 
@@ -168,420 +168,8 @@ Your puzzle answer was 268.
 #include <cstring>
 #include <cassert>
 
-typedef int64_t IntWord;
-
-#define OPCODES \
-    OPCODE(Add, 1)\
-    OPCODE(Mul, 2)\
-    OPCODE(Inp, 3)\
-    OPCODE(Out, 4)\
-    OPCODE(Jnz, 5)\
-    OPCODE(Jz, 6)\
-    OPCODE(Lt, 7)\
-    OPCODE(Equ, 8)\
-    OPCODE(ModRel, 9)\
-    OPCODE(Halt, 99)
-
-#define OPCODE(op, x) OP_ ## op = x,
-enum Opcode
-{
-    OPCODES
-
-    Opcode_Max
-};
-#undef OPCODE
-
-static const char* Opcode_names[Opcode_Max] = { };
-#define OPCODE(op, x) Opcode_names[x] = #op;
-bool init_opcode_names()
-{
-    OPCODES
-    return true;
-}
-#undef OPCODE
-static bool init = init_opcode_names();
-
-#define MAX_IO_BUFFER 1000
-struct Buffer
-{
-    int write;
-    int read;
-    IntWord data[MAX_IO_BUFFER];
-};
-
-void write(Buffer *buf, IntWord x)
-{
-    buf->data[buf->write] = x;
-    buf->write++;
-    if (buf->write == MAX_IO_BUFFER)
-    {
-        buf->write = 0;
-    }
-}
-
-bool read(Buffer *buf, IntWord *x)
-{
-    if (buf->read != buf->write)
-    {
-        *x = buf->data[buf->read];
-        buf->read++;
-        if (buf->read == MAX_IO_BUFFER)
-        {
-            buf->read = 0;
-        }
-        return true;
-    }
-    return false;
-}
-
-int readable_num(Buffer buf)
-{
-    if (buf.write >= buf.read)
-    {
-        return buf.write - buf.read;
-    }
-    return buf.write + MAX_IO_BUFFER - buf.read;
-}
-
-struct State
-{
-    int position;
-    int relative_base;
-    bool halted;
-
-    Buffer *input;
-    Buffer *output;
-};
-
-struct Code
-{
-    IntWord *data;
-    int code_size;
-    int memory_size; // code_size + extra memory
-
-    IntWord operator[](int pos) const
-    {
-        return data[pos];
-    }
-    IntWord& operator[](int pos)
-    {
-        return data[pos];
-    }
-};
-
-template <int N>
-Code to_code(IntWord (&c)[N], int extra_memory)
-{
-    IntWord *data = (IntWord*)calloc((N + extra_memory), sizeof(IntWord));
-    //IntWord *data = (IntWord*)malloc(sizeof(IntWord) * (N + extra_memory));
-    memcpy(data, c, sizeof(IntWord) * N);
-    //memset(data + N, 0, sizeof(IntWord) * extra_memory);
-    return { .data = data, .code_size = N, .memory_size = N + extra_memory };
-};
-
-void free_code(Code &c)
-{
-    free(c.data);
-    c = { };
-}
-
-void print_code(Code code)
-{
-    if (code.code_size > 0)
-    {
-        printf("%lld", code[0]);
-        for (int i = 1; i < code.code_size; i++) printf(",%lld", code[i]);
-        printf("\n");
-    }
-}
-
-Opcode decode_instr(IntWord instr, int *m1, int *m2, int *m3)
-{
-    int op = instr % 100;
-    *m1 = (instr / 100) % 10;
-    *m2 = (instr / 1000) % 10;
-    *m3 = (instr / 10000) % 10;
-    return (Opcode)op;
-}
-
-IntWord read(State *s, Code code, int pos, int mode)
-{
-    IntWord a = code[pos];
-    IntWord result;
-    switch (mode)
-    {
-        case 0: result = code[a]; break;
-        case 1: result = a; break;
-        case 2: result = code[s->relative_base + a]; break;
-        default:
-            assert("invalid address mode" && 0);
-    }
-    return result;
-}
-
-IntWord read_pos(State *s, Code code, int pos, int mode)
-{
-    IntWord a = code[pos];
-    IntWord result;
-    switch (mode)
-    {
-        case 0: result = a; break;
-        case 2: result = s->relative_base + a; break;
-        default:
-            assert("invalid address mode" && 0);
-    }
-    return result;
-}
-
-int step(State *s, Code code)
-{
-    int pos = s->position;
-    IntWord instr = code[pos];
-    int m1, m2, m3;
-    Opcode op = decode_instr(instr, &m1, &m2, &m3);
-    //printf("%d: (%d) %s[%d, %d, %d]\n", pos, op, Opcode_names[op], m1, m2, m3);
-    switch (op)
-    {
-    case OP_Add:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            IntWord oper2 = read(s, code, pos+2, m2);
-            IntWord res_pos = read_pos(s, code, pos+3, m3);
-            //printf(" [%lld] <- %lld + %lld\n", res_pos, oper1, oper2);
-            code[res_pos] = oper1 + oper2;
-            pos += 4;
-        } break;
-    case OP_Mul:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            IntWord oper2 = read(s, code, pos+2, m2);
-            IntWord res_pos = read_pos(s, code, pos+3, m3);
-            //printf(" [%lld] <- %lld * %lld\n", res_pos, oper1, oper2);
-            code[res_pos] = oper1 * oper2;
-            pos += 4;
-        } break;
-    case OP_Inp:
-        {
-            IntWord res;
-            if (!read(s->input, &res))
-            {
-                //printf("Waiting input...\n");
-                return 0;
-            }
-            IntWord res_pos = read_pos(s, code, pos+1, m1);
-            //printf(" [%lld] <- inp=%lld\n", res_pos, res);
-            code[res_pos] = res;
-            pos += 2;
-        } break;
-    case OP_Out:
-        {
-            IntWord out = read(s, code, pos+1, m1);
-            write(s->output, out);
-            //printf("out=%lld\n", out);
-            pos += 2;
-        } break;
-    case OP_Jnz:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            IntWord oper2 = read(s, code, pos+2, m2);
-            //printf(" %lld != 0 => pos=%lld\n", oper1, oper2);
-            if (oper1 != 0)
-            {
-                pos = oper2;
-            }
-            else
-            {
-                pos += 3;
-            }
-        } break;
-    case OP_Jz:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            IntWord oper2 = read(s, code, pos+2, m2);
-            //printf(" %lld == 0 => pos=%lld\n", oper1, oper2);
-            if (oper1 == 0)
-            {
-                pos = oper2;
-            }
-            else
-            {
-                pos += 3;
-            }
-        } break;
-    case OP_Lt:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            IntWord oper2 = read(s, code, pos+2, m2);
-            IntWord res_pos = read_pos(s, code, pos+3, m3);
-            //printf(" [%lld] <- %lld < %lld\n", res_pos, oper1, oper2);
-            code[res_pos] = (oper1 < oper2) ? 1 : 0;
-            pos += 4;
-        } break;
-    case OP_Equ:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            IntWord oper2 = read(s, code, pos+2, m2);
-            IntWord res_pos = read_pos(s, code, pos+3, m3);
-            //printf(" [%lld] <- %lld == %lld\n", res_pos, oper1, oper2);
-            code[res_pos] = (oper1 == oper2) ? 1 : 0;
-            pos += 4;
-        } break;
-    case OP_ModRel:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            //printf(" %d => ", s->relative_base);
-            s->relative_base += oper1;
-            //printf(" %d\n", s->relative_base);
-            pos += 2;
-        } break;
-    case OP_Halt:
-        {
-            printf("Halt!\n");
-            s->halted = true;
-            return -1;
-        } break;
-
-    case Opcode_Max:
-    default:
-        printf("BUG!\n");
-        pos += 1;
-        //return -1;
-    }
-    s->position = pos;
-    return 1;
-}
-
-void execute(State *state, Code code)
-{
-    while (step(state, code) == 1);
-}
-
-void read_operand(Code code, int pos, int mode)
-{
-    IntWord a = code[pos];
-    switch (mode)
-    {
-        case 0: printf("[%lld]=%lld", a, code[a]); break;
-        case 1: printf("%lld", a); break;
-        case 2: printf("[B+%lld]=?", a); break;
-        default:
-            assert("invalid address mode" && 0);
-    }
-}
-
-void write_operand(Code code, int pos, int mode)
-{
-    IntWord a = code[pos];
-    switch (mode)
-    {
-        case 0: printf("[%lld]", a); break;
-        case 2: printf("[B+%lld]", a); break;
-        default:
-            assert("invalid address mode" && 0);
-    }
-}
-
-void print_instr(Code code, IntWord *position)
-{
-    IntWord pos = *position;
-    IntWord instr = code[pos];
-    int m1, m2, m3;
-    Opcode op = decode_instr(instr, &m1, &m2, &m3);
-    printf("%lld: (%d) %s[%d, %d, %d]    ", pos, op, Opcode_names[op], m1, m2, m3);
-    switch (op)
-    {
-    case OP_Add:
-        {
-            write_operand(code, pos+2, m3);
-            printf(" <- ");
-            read_operand(code, pos+1, m1);
-            printf(" + ");
-            read_operand(code, pos+2, m2);
-            pos += 4;
-        } break;
-    case OP_Mul:
-        {
-            write_operand(code, pos+2, m3);
-            printf(" <- ");
-            read_operand(code, pos+1, m1);
-            printf(" * ");
-            read_operand(code, pos+2, m2);
-            pos += 4;
-        } break;
-    case OP_Inp:
-        {
-            write_operand(code, pos+1, m1);
-            printf("<- inp");
-            pos += 2;
-        } break;
-    case OP_Out:
-        {
-            printf("out <- ");
-            read_operand(code, pos+1, m1);
-            pos += 2;
-        } break;
-    case OP_Jnz:
-        {
-            read_operand(code, pos+1, m1);
-            printf(" != 0 => pos <- ");
-            read_operand(code, pos+2, m2);
-            pos += 3;
-        } break;
-    case OP_Jz:
-        {
-            read_operand(code, pos+1, m1);
-            printf(" == 0 => pos <- ");
-            read_operand(code, pos+2, m2);
-            pos += 3;
-        } break;
-    case OP_Lt:
-        {
-            write_operand(code, pos+3, m3);
-            printf(" <- ");
-            read_operand(code, pos+1, m1);
-            printf(" < ");
-            read_operand(code, pos+2, m2);
-            pos += 4;
-        } break;
-    case OP_Equ:
-        {
-            write_operand(code, pos+3, m3);
-            printf(" <- ");
-            read_operand(code, pos+1, m1);
-            printf(" == ");
-            read_operand(code, pos+2, m2);
-            pos += 4;
-        } break;
-    case OP_ModRel:
-        {
-            printf("B <- ");
-            read_operand(code, pos+1, m1);
-            pos += 2;
-        } break;
-    case OP_Halt:
-        {
-            pos += 1;
-        } break;
-
-    case Opcode_Max:
-    default:
-        printf("BUG!\n");
-        pos += 1;
-    }
-    *position = pos;
-}
-
-void print_code(Code code, int beg, int end)
-{
-    IntWord position = beg;
-    while (position < end)
-    {
-        print_instr(code, &position);
-        putchar('\n');
-    }
-}
-
-
+#include "../intcode/intcode.h"
+#include "../intcode/trace.h"
 
 int min(int a, int b)
 {
@@ -1033,6 +621,9 @@ int find_shortest_path_len(Grid grid, Pos from, Pos to)
     return dist;
 }
 
+// Set by running "day15 trace <file>", see trace.h and intcode/replay.
+TraceRecorder *trace = nullptr;
+
 Pos execute_droid_control(Code code, Grid *grid, Droid *droid, DroidControlState *ds)
 {
     Buffer input = {};
@@ -1046,12 +637,8 @@ Pos execute_droid_control(Code code, Grid *grid, Droid *droid, DroidControlState
     int round = 0;
     while (!state.halted)
     {
-        int res;
-        for (int i = 0; i < 10; i++)
-        {
-            res = step(&state, code);
-            if (res != 1) break;
-        }
+        RunEvent event = trace ? run_until(&state, code, RUN_Output | RUN_Input, 1, trace)
+                               : run_until(&state, code, RUN_Output | RUN_Input);
         while (readable_num(output) > 0)
         {
             IntWord status;
@@ -1098,7 +685,7 @@ Pos execute_droid_control(Code code, Grid *grid, Droid *droid, DroidControlState
             }
         }
 
-        if (res == 0) // waiting input
+        if (event == RUN_Input)
         {
             if (round % 50 == 0)
             {
@@ -1168,10 +755,12 @@ Pos execute_droid_control(Code code, Grid *grid, Droid *droid, DroidControlState
                 // ...
             }
             write(&input, droid->moving_dir);
+            round++;
         }
-        round++;
     }
 
+    free_buffer(&input);
+    free_buffer(&output);
     return oxygen_sys_pos;
 }
 
@@ -1193,7 +782,7 @@ void part_one()
 
     DroidControlState control_state = {};
 
-    Code code = to_code(actual_code, 200000);
+    Code code = to_code(actual_code, 4096);
     Pos oxygen_sys_pos = execute_droid_control(code, &grid, &droid, &control_state);
     free_code(code);
 
@@ -1251,7 +840,7 @@ void part_two()
 
     DroidControlState control_state = {};
 
-    Code code = to_code(actual_code, 200000);
+    Code code = to_code(actual_code, 4096);
     Pos oxygen_sys_pos = execute_droid_control(code, &grid, &droid, &control_state);
     free_code(code);
 
@@ -1264,8 +853,14 @@ void part_two()
 
 int main(int argc, const char **argv)
 {
+    if (argc > 2 && strcmp(argv[1], "trace") == 0)
+    {
+        trace = open_trace(argv[2]);
+        if (!trace) printf("could not create the trace %s\n", argv[2]);
+    }
     //part_one();
     part_two();
+    if (trace) close_trace(trace);
     return 0;
 }
 
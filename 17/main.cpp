@@ -199,420 +199,8 @@ Your puzzle answer was 1113411.
 #include <cstring>
 #include <cassert>
 
-typedef int64_t IntWord;
-
-#define OPCODES \
-    OPCODE(Add, 1)\
-    OPCODE(Mul, 2)\
-    OPCODE(Inp, 3)\
-    OPCODE(Out, 4)\
-    OPCODE(Jnz, 5)\
-    OPCODE(Jz, 6)\
-    OPCODE(Lt, 7)\
-    OPCODE(Equ, 8)\
-    OPCODE(ModRel, 9)\
-    OPCODE(Halt, 99)
-
-#define OPCODE(op, x) OP_ ## op = x,
-enum Opcode
-{
-    OPCODES
-
-    Opcode_Max
-};
-#undef OPCODE
-
-static const char* Opcode_names[Opcode_Max] = { };
-#define OPCODE(op, x) Opcode_names[x] = #op;
-bool init_opcode_names()
-{
-    OPCODES
-    return true;
-}
-#undef OPCODE
-static bool init = init_opcode_names();
-
-#define MAX_IO_BUFFER 1000
-struct Buffer
-{
-    int write;
-    int read;
-    IntWord data[MAX_IO_BUFFER];
-};
-
-void write(Buffer *buf, IntWord x)
-{
-    buf->data[buf->write] = x;
-    buf->write++;
-    if (buf->write == MAX_IO_BUFFER)
-    {
-        buf->write = 0;
-    }
-}
-
-bool read(Buffer *buf, IntWord *x)
-{
-    if (buf->read != buf->write)
-    {
-        *x = buf->data[buf->read];
-        buf->read++;
-        if (buf->read == MAX_IO_BUFFER)
-        {
-            buf->read = 0;
-        }
-        return true;
-    }
-    return false;
-}
-
-int readable_num(Buffer buf)
-{
-    if (buf.write >= buf.read)
-    {
-        return buf.write - buf.read;
-    }
-    return buf.write + MAX_IO_BUFFER - buf.read;
-}
-
-struct State
-{
-    int position;
-    int relative_base;
-    bool halted;
-
-    Buffer *input;
-    Buffer *output;
-};
-
-struct Code
-{
-    IntWord *data;
-    int code_size;
-    int memory_size; // code_size + extra memory
-
-    IntWord operator[](int pos) const
-    {
-        return data[pos];
-    }
-    IntWord& operator[](int pos)
-    {
-        return data[pos];
-    }
-};
-
-template <int N>
-Code to_code(IntWord (&c)[N], int extra_memory)
-{
-    IntWord *data = (IntWord*)calloc((N + extra_memory), sizeof(IntWord));
-    //IntWord *data = (IntWord*)malloc(sizeof(IntWord) * (N + extra_memory));
-    memcpy(data, c, sizeof(IntWord) * N);
-    //memset(data + N, 0, sizeof(IntWord) * extra_memory);
-    return { .data = data, .code_size = N, .memory_size = N + extra_memory };
-};
-
-void free_code(Code &c)
-{
-    free(c.data);
-    c = { };
-}
-
-void print_code(Code code)
-{
-    if (code.code_size > 0)
-    {
-        printf("%lld", code[0]);
-        for (int i = 1; i < code.code_size; i++) printf(",%lld", code[i]);
-        printf("\n");
-    }
-}
-
-Opcode decode_instr(IntWord instr, int *m1, int *m2, int *m3)
-{
-    int op = instr % 100;
-    *m1 = (instr / 100) % 10;
-    *m2 = (instr / 1000) % 10;
-    *m3 = (instr / 10000) % 10;
-    return (Opcode)op;
-}
-
-IntWord read(State *s, Code code, int pos, int mode)
-{
-    IntWord a = code[pos];
-    IntWord result;
-    switch (mode)
-    {
-        case 0: result = code[a]; break;
-        case 1: result = a; break;
-        case 2: result = code[s->relative_base + a]; break;
-        default:
-            assert("invalid address mode" && 0);
-    }
-    return result;
-}
-
-IntWord read_pos(State *s, Code code, int pos, int mode)
-{
-    IntWord a = code[pos];
-    IntWord result;
-    switch (mode)
-    {
-        case 0: result = a; break;
-        case 2: result = s->relative_base + a; break;
-        default:
-            assert("invalid address mode" && 0);
-    }
-    return result;
-}
-
-int step(State *s, Code code)
-{
-    int pos = s->position;
-    IntWord instr = code[pos];
-    int m1, m2, m3;
-    Opcode op = decode_instr(instr, &m1, &m2, &m3);
-    //printf("%d: (%d) %s[%d, %d, %d]\n", pos, op, Opcode_names[op], m1, m2, m3);
-    switch (op)
-    {
-    case OP_Add:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            IntWord oper2 = read(s, code, pos+2, m2);
-            IntWord res_pos = read_pos(s, code, pos+3, m3);
-            //printf(" [%lld] <- %lld + %lld\n", res_pos, oper1, oper2);
-            code[res_pos] = oper1 + oper2;
-            pos += 4;
-        } break;
-    case OP_Mul:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            IntWord oper2 = read(s, code, pos+2, m2);
-            IntWord res_pos = read_pos(s, code, pos+3, m3);
-            //printf(" [%lld] <- %lld * %lld\n", res_pos, oper1, oper2);
-            code[res_pos] = oper1 * oper2;
-            pos += 4;
-        } break;
-    case OP_Inp:
-        {
-            IntWord res;
-            if (!read(s->input, &res))
-            {
-                //printf("Waiting input...\n");
-                return 0;
-            }
-            IntWord res_pos = read_pos(s, code, pos+1, m1);
-            //printf(" [%lld] <- inp=%lld\n", res_pos, res);
-            code[res_pos] = res;
-            pos += 2;
-        } break;
-    case OP_Out:
-        {
-            IntWord out = read(s, code, pos+1, m1);
-            write(s->output, out);
-            //printf("out=%lld\n", out);
-            pos += 2;
-        } break;
-    case OP_Jnz:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            IntWord oper2 = read(s, code, pos+2, m2);
-            //printf(" %lld != 0 => pos=%lld\n", oper1, oper2);
-            if (oper1 != 0)
-            {
-                pos = oper2;
-            }
-            else
-            {
-                pos += 3;
-            }
-        } break;
-    case OP_Jz:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            IntWord oper2 = read(s, code, pos+2, m2);
-            //printf(" %lld == 0 => pos=%lld\n", oper1, oper2);
-            if (oper1 == 0)
-            {
-                pos = oper2;
-            }
-            else
-            {
-                pos += 3;
-            }
-        } break;
-    case OP_Lt:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            IntWord oper2 = read(s, code, pos+2, m2);
-            IntWord res_pos = read_pos(s, code, pos+3, m3);
-            //printf(" [%lld] <- %lld < %lld\n", res_pos, oper1, oper2);
-            code[res_pos] = (oper1 < oper2) ? 1 : 0;
-            pos += 4;
-        } break;
-    case OP_Equ:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            IntWord oper2 = read(s, code, pos+2, m2);
-            IntWord res_pos = read_pos(s, code, pos+3, m3);
-            //printf(" [%lld] <- %lld == %lld\n", res_pos, oper1, oper2);
-            code[res_pos] = (oper1 == oper2) ? 1 : 0;
-            pos += 4;
-        } break;
-    case OP_ModRel:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            //printf(" %d => ", s->relative_base);
-            s->relative_base += oper1;
-            //printf(" %d\n", s->relative_base);
-            pos += 2;
-        } break;
-    case OP_Halt:
-        {
-            printf("Halt!\n");
-            s->halted = true;
-            return -1;
-        } break;
-
-    case Opcode_Max:
-    default:
-        printf("BUG!\n");
-        pos += 1;
-        //return -1;
-    }
-    s->position = pos;
-    return 1;
-}
-
-void execute(State *state, Code code)
-{
-    while (step(state, code) == 1);
-}
-
-void read_operand(Code code, int pos, int mode)
-{
-    IntWord a = code[pos];
-    switch (mode)
-    {
-        case 0: printf("[%lld]=%lld", a, code[a]); break;
-        case 1: printf("%lld", a); break;
-        case 2: printf("[B+%lld]=?", a); break;
-        default:
-            assert("invalid address mode" && 0);
-    }
-}
-
-void write_operand(Code code, int pos, int mode)
-{
-    IntWord a = code[pos];
-    switch (mode)
-    {
-        case 0: printf("[%lld]", a); break;
-        case 2: printf("[B+%lld]", a); break;
-        default:
-            assert("invalid address mode" && 0);
-    }
-}
-
-void print_instr(Code code, IntWord *position)
-{
-    IntWord pos = *position;
-    IntWord instr = code[pos];
-    int m1, m2, m3;
-    Opcode op = decode_instr(instr, &m1, &m2, &m3);
-    printf("%lld: (%d) %s[%d, %d, %d]    ", pos, op, Opcode_names[op], m1, m2, m3);
-    switch (op)
-    {
-    case OP_Add:
-        {
-            write_operand(code, pos+2, m3);
-            printf(" <- ");
-            read_operand(code, pos+1, m1);
-            printf(" + ");
-            read_operand(code, pos+2, m2);
-            pos += 4;
-        } break;
-    case OP_Mul:
-        {
-            write_operand(code, pos+2, m3);
-            printf(" <- ");
-            read_operand(code, pos+1, m1);
-            printf(" * ");
-            read_operand(code, pos+2, m2);
-            pos += 4;
-        } break;
-    case OP_Inp:
-        {
-            write_operand(code, pos+1, m1);
-            printf("<- inp");
-            pos += 2;
-        } break;
-    case OP_Out:
-        {
-            printf("out <- ");
-            read_operand(code, pos+1, m1);
-            pos += 2;
-        } break;
-    case OP_Jnz:
-        {
-            read_operand(code, pos+1, m1);
-            printf(" != 0 => pos <- ");
-            read_operand(code, pos+2, m2);
-            pos += 3;
-        } break;
-    case OP_Jz:
-        {
-            read_operand(code, pos+1, m1);
-            printf(" == 0 => pos <- ");
-            read_operand(code, pos+2, m2);
-            pos += 3;
-        } break;
-    case OP_Lt:
-        {
-            write_operand(code, pos+3, m3);
-            printf(" <- ");
-            read_operand(code, pos+1, m1);
-            printf(" < ");
-            read_operand(code, pos+2, m2);
-            pos += 4;
-        } break;
-    case OP_Equ:
-        {
-            write_operand(code, pos+3, m3);
-            printf(" <- ");
-            read_operand(code, pos+1, m1);
-            printf(" == ");
-            read_operand(code, pos+2, m2);
-            pos += 4;
-        } break;
-    case OP_ModRel:
-        {
-            printf("B <- ");
-            read_operand(code, pos+1, m1);
-            pos += 2;
-        } break;
-    case OP_Halt:
-        {
-            pos += 1;
-        } break;
-
-    case Opcode_Max:
-    default:
-        printf("BUG!\n");
-        pos += 1;
-    }
-    *position = pos;
-}
-
-void print_code(Code code, int beg, int end)
-{
-    IntWord position = beg;
-    while (position < end)
-    {
-        print_instr(code, &position);
-        putchar('\n');
-    }
-}
-
-
+#include "../intcode/intcode.h"
+#include "../intcode/memo.h"
 
 int min(int a, int b)
 {
@@ -932,10 +520,10 @@ void print_stack(Stack<T> s, void (*print_elem)(T x) = print<T>)
     printf("[");
     if (s.len > 0)
     {
-        print(s.data[0]);
+        print_elem(s.data[0]);
         for (int i = 1; i < s.len; i++)
         {
-            putchar(','); print(s.data[i]);
+            putchar(','); print_elem(s.data[i]);
         }
     }
     printf("]");
@@ -958,12 +546,7 @@ void calculate_alignment_parameters(Code code)
     Pos cursor = {};
     while (!state.halted)
     {
-        int res;
-        for (int i = 0; i < 10; i++)
-        {
-            res = step(&state, code);
-            if (res != 1) break;
-        }
+        run_until(&state, code, RUN_Output);
         while (readable_num(output) > 0)
         {
             IntWord ch;
@@ -1004,6 +587,8 @@ void calculate_alignment_parameters(Code code)
 
     print_grid(grid);
     printf("Total alignment: %d\n", total_alignment);
+    free_buffer(&input);
+    free_buffer(&output);
 }
 
 IntWord actual_code[] = {
@@ -1012,7 +597,7 @@ IntWord actual_code[] = {
 
 void part_one()
 {
-    Code code = to_code(actual_code, 200000);
+    Code code = to_code(actual_code, 4096);
     calculate_alignment_parameters(code);
     free_code(code);
 }
@@ -1042,8 +627,8 @@ struct Move
     } type;
     int steps;
 
-    static Move left() { return {TurnLeft}; }
-    static Move right() { return {TurnRight}; }
+    static Move left() { return {TurnLeft, 0}; }
+    static Move right() { return {TurnRight, 0}; }
     static Move forward(int steps) { return {MoveForward, steps}; }
 
     bool is_turn() { return type <= TurnRight; }
@@ -1056,9 +641,9 @@ struct Move
         return result;
     }
 
-    static Move A() { return {FuncA}; }
-    static Move B() { return {FuncB}; }
-    static Move C() { return {FuncC}; }
+    static Move A() { return {FuncA, 0}; }
+    static Move B() { return {FuncB, 0}; }
+    static Move C() { return {FuncC, 0}; }
 };
 
 bool operator == (Move a, Move b)
@@ -1296,7 +881,7 @@ Stack<Move> reduce(Stack<Move> s)
 
 Routines find_solution()
 {
-    Code code = to_code(actual_code, 200000);
+    Code code = to_code(actual_code, 4096);
 
     Buffer input = {};
     Buffer output = {};
@@ -1313,12 +898,7 @@ Routines find_solution()
     Pos cursor = {};
     while (!state.halted)
     {
-        int res;
-        for (int i = 0; i < 10; i++)
-        {
-            res = step(&state, code);
-            if (res != 1) break;
-        }
+        run_until(&state, code, RUN_Output);
         while (readable_num(output) > 0)
         {
             IntWord ch;
@@ -1337,6 +917,8 @@ Routines find_solution()
         }
     }
     free_code(code);
+    free_buffer(&input);
+    free_buffer(&output);
 
     int scaffolding = 0;
     Robot robot = {};
@@ -1450,12 +1032,15 @@ int convert_to_string(char *buf, Stack<Move> m)
     return s - buf;
 }
 
+// Set by running "day17 memo", see memo.h.
+Memo *memo = nullptr;
+
 void traverse_scaffolding(Code code)
 {
     Routines routines = find_solution();
 
     // To wake up the vacuum robot, set to 2
-    code[0] = 2;
+    store(code, 0, 2);
 
     Buffer input = {};
     Buffer output = {};
@@ -1478,54 +1063,64 @@ void traverse_scaffolding(Code code)
     write(&input, 'n');
     write(&input, '\n');
 
-    IntWord dust;
+    IntWord dust = 0;
     while (!state.halted)
     {
-        int res;
-        for (int i = 0; i < 10; i++)
-        {
-            res = step(&state, code);
-            if (res != 1) break;
-        }
-        if (res == 0)
+        RunEvent event;
+        if (memo) event = (execute_memo(&state, code, memo) == 0) ? RUN_Input : RUN_Halt;
+        else event = run_until(&state, code, RUN_Output | RUN_Input);
+        if (event == RUN_Input)
         {
             printf("Waiting for input..\n");
             break;
         }
-        if (readable_num(output) > 0)
+        while (readable_num(output) > 0)
         {
-            if (state.halted)
+            IntWord ch;
+            read(&output, &ch);
+
+            // The amount of dust is the only output outside ASCII.
+            if (ch > 127)
             {
-                read(&output, &dust);
+                dust = ch;
             }
             else
             {
-                while (readable_num(output) > 0)
-                {
-                    IntWord ch;
-                    read(&output, &ch);
-
-                    putchar(ch);
-                    fflush(stdout);
-                }
+                putchar(ch);
+                fflush(stdout);
             }
         }
     }
 
-    printf("Dust collected %lld\n", dust);
+    printf("Dust collected %" PRId64 "\n", dust);
+    free_buffer(&input);
+    free_buffer(&output);
 }
 
 void part_two()
 {
-    Code code = to_code(actual_code, 200000);
+    Code code = to_code(actual_code, 4096);
+    // The movement routines are call heavy, let the decode cache fuse them
+    enable_decode_cache(&code);
     traverse_scaffolding(code);
     free_code(code);
 }
 
 int main(int argc, const char **argv)
 {
+    if (argc > 1 && strcmp(argv[1], "memo") == 0)
+    {
+        Code code = to_code(actual_code);
+        memo = create_memo(code);
+        free_code(code);
+    }
     //part_one();
     part_two();
+    if (memo)
+    {
+        print_memo_stats(memo);
+        free_memo(memo);
+    }
     return 0;
 }
 
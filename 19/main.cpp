@@ -115,433 +115,11 @@ Your puzzle answer was 10311666.
 #include <cstring>
 #include <cassert>
 
-typedef int64_t IntWord;
-
-#define OPCODES \
-    OPCODE(Add, 1)\
-    OPCODE(Mul, 2)\
-    OPCODE(Inp, 3)\
-    OPCODE(Out, 4)\
-    OPCODE(Jnz, 5)\
-    OPCODE(Jz, 6)\
-    OPCODE(Lt, 7)\
-    OPCODE(Equ, 8)\
-    OPCODE(ModRel, 9)\
-    OPCODE(Halt, 99)
-
-#define OPCODE(op, x) OP_ ## op = x,
-enum Opcode
-{
-    OPCODES
-
-    Opcode_Max
-};
-#undef OPCODE
-
-static const char* Opcode_names[Opcode_Max] = { };
-#define OPCODE(op, x) Opcode_names[x] = #op;
-bool init_opcode_names()
-{
-    OPCODES
-    return true;
-}
-#undef OPCODE
-static bool init = init_opcode_names();
-
-#define MAX_IO_BUFFER 10000
-//#define MAX_IO_BUFFER 1000
-struct Buffer
-{
-    int write;
-    int read;
-    IntWord data[MAX_IO_BUFFER];
-};
-
-void write(Buffer *buf, IntWord x)
-{
-    buf->data[buf->write] = x;
-    buf->write++;
-    if (buf->write == MAX_IO_BUFFER)
-    {
-        buf->write = 0;
-    }
-}
-
-bool read(Buffer *buf, IntWord *x)
-{
-    if (buf->read != buf->write)
-    {
-        *x = buf->data[buf->read];
-        buf->read++;
-        if (buf->read == MAX_IO_BUFFER)
-        {
-            buf->read = 0;
-        }
-        return true;
-    }
-    return false;
-}
-
-int readable_num(Buffer buf)
-{
-    if (buf.write >= buf.read)
-    {
-        return buf.write - buf.read;
-    }
-    return buf.write + MAX_IO_BUFFER - buf.read;
-}
-
-struct State
-{
-    int position;
-    int relative_base;
-    bool halted;
-
-    Buffer *input;
-    Buffer *output;
-};
-
-struct Code
-{
-    IntWord *data;
-    int code_size;
-    int memory_size; // code_size + extra memory
-
-    IntWord operator[](int pos) const
-    {
-        return data[pos];
-    }
-    IntWord& operator[](int pos)
-    {
-        return data[pos];
-    }
-};
-
-template <int N>
-Code to_code(IntWord (&c)[N], int extra_memory)
-{
-    IntWord *data = (IntWord*)calloc((N + extra_memory), sizeof(IntWord));
-    //IntWord *data = (IntWord*)malloc(sizeof(IntWord) * (N + extra_memory));
-    memcpy(data, c, sizeof(IntWord) * N);
-    //memset(data + N, 0, sizeof(IntWord) * extra_memory);
-    return { .data = data, .code_size = N, .memory_size = N + extra_memory };
-};
-
-void reset_extra_memory(Code &c) {
-    int extra_memory = c.memory_size - c.code_size;
-    memset(c.data + c.code_size, 0, extra_memory * sizeof(IntWord));
-}
-
-Code copy_code(Code &c) {
-    IntWord *data = (IntWord*)calloc(c.memory_size, sizeof(IntWord));
-    memcpy(data, c.data, sizeof(IntWord) * c.code_size);
-    return { .data = data, .code_size = c.code_size, .memory_size = c.memory_size };
-}
-
-void free_code(Code &c)
-{
-    free(c.data);
-    c = { };
-}
-
-void print_code(Code code)
-{
-    if (code.code_size > 0)
-    {
-        printf("%" PRId64, code[0]);
-        for (int i = 1; i < code.code_size; i++) printf(",%" PRId64, code[i]);
-        printf("\n");
-    }
-}
-
-Opcode decode_instr(IntWord instr, int *m1, int *m2, int *m3)
-{
-    int op = instr % 100;
-    *m1 = (instr / 100) % 10;
-    *m2 = (instr / 1000) % 10;
-    *m3 = (instr / 10000) % 10;
-    return (Opcode)op;
-}
-
-IntWord read(State *s, Code code, int pos, int mode)
-{
-    IntWord a = code[pos];
-    IntWord result;
-    switch (mode)
-    {
-        case 0: result = code[a]; break;
-        case 1: result = a; break;
-        case 2: result = code[s->relative_base + a]; break;
-        default:
-            assert("invalid address mode" && 0);
-    }
-    return result;
-}
-
-IntWord read_pos(State *s, Code code, int pos, int mode)
-{
-    IntWord a = code[pos];
-    IntWord result;
-    switch (mode)
-    {
-        case 0: result = a; break;
-        case 2: result = s->relative_base + a; break;
-        default:
-            assert("invalid address mode" && 0);
-    }
-    return result;
-}
-
-int step(State *s, Code code)
-{
-    int pos = s->position;
-    IntWord instr = code[pos];
-    int m1, m2, m3;
-    Opcode op = decode_instr(instr, &m1, &m2, &m3);
-    //printf("%d: (%d) %s[%d, %d, %d]\n", pos, op, Opcode_names[op], m1, m2, m3);
-    switch (op)
-    {
-    case OP_Add:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            IntWord oper2 = read(s, code, pos+2, m2);
-            IntWord res_pos = read_pos(s, code, pos+3, m3);
-            //printf(" [%lld] <- %lld + %lld\n", res_pos, oper1, oper2);
-            code[res_pos] = oper1 + oper2;
-            pos += 4;
-        } break;
-    case OP_Mul:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            IntWord oper2 = read(s, code, pos+2, m2);
-            IntWord res_pos = read_pos(s, code, pos+3, m3);
-            //printf(" [%lld] <- %lld * %lld\n", res_pos, oper1, oper2);
-            code[res_pos] = oper1 * oper2;
-            pos += 4;
-        } break;
-    case OP_Inp:
-        {
-            IntWord res;
-            if (!read(s->input, &res))
-            {
-                printf("Waiting input...\n");
-                getchar();
-                return 0;
-            }
-            IntWord res_pos = read_pos(s, code, pos+1, m1);
-            //printf(" [%lld] <- inp=%lld\n", res_pos, res);
-            code[res_pos] = res;
-            pos += 2;
-        } break;
-    case OP_Out:
-        {
-            IntWord out = read(s, code, pos+1, m1);
-            write(s->output, out);
-            //printf("out=%lld\n", out);
-            pos += 2;
-        } break;
-    case OP_Jnz:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            IntWord oper2 = read(s, code, pos+2, m2);
-            //printf(" %lld != 0 => pos=%lld\n", oper1, oper2);
-            if (oper1 != 0)
-            {
-                pos = oper2;
-            }
-            else
-            {
-                pos += 3;
-            }
-        } break;
-    case OP_Jz:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            IntWord oper2 = read(s, code, pos+2, m2);
-            //printf(" %lld == 0 => pos=%lld\n", oper1, oper2);
-            if (oper1 == 0)
-            {
-                pos = oper2;
-            }
-            else
-            {
-                pos += 3;
-            }
-        } break;
-    case OP_Lt:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            IntWord oper2 = read(s, code, pos+2, m2);
-            IntWord res_pos = read_pos(s, code, pos+3, m3);
-            //printf(" [%lld] <- %lld < %lld\n", res_pos, oper1, oper2);
-            code[res_pos] = (oper1 < oper2) ? 1 : 0;
-            pos += 4;
-        } break;
-    case OP_Equ:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            IntWord oper2 = read(s, code, pos+2, m2);
-            IntWord res_pos = read_pos(s, code, pos+3, m3);
-            //printf(" [%lld] <- %lld == %lld\n", res_pos, oper1, oper2);
-            code[res_pos] = (oper1 == oper2) ? 1 : 0;
-            pos += 4;
-        } break;
-    case OP_ModRel:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            //printf(" %d => ", s->relative_base);
-            s->relative_base += oper1;
-            //printf(" %d\n", s->relative_base);
-            pos += 2;
-        } break;
-    case OP_Halt:
-        {
-            //printf("Halt!\n");
-            s->halted = true;
-            return -1;
-        } break;
-
-    case Opcode_Max:
-    default:
-        printf("BUG!\n");
-        pos += 1;
-        //return -1;
-    }
-    s->position = pos;
-    return 1;
-}
-
-void execute(State *state, Code code)
-{
-    while (step(state, code) == 1);
-}
-
-void read_operand(Code code, int pos, int mode)
-{
-    IntWord a = code[pos];
-    switch (mode)
-    {
-        case 0: printf("[%" PRId64 "]=%" PRId64, a, code[a]); break;
-        case 1: printf("%" PRId64, a); break;
-        case 2: printf("[B+%" PRId64 "]=?", a); break;
-        default:
-            assert("invalid address mode" && 0);
-    }
-}
-
-void write_operand(Code code, int pos, int mode)
-{
-    IntWord a = code[pos];
-    switch (mode)
-    {
-        case 0: printf("[%" PRId64 "]", a); break;
-        case 2: printf("[B+%" PRId64 "]", a); break;
-        default:
-            assert("invalid address mode" && 0);
-    }
-}
-
-void print_instr(Code code, IntWord *position)
-{
-    IntWord pos = *position;
-    IntWord instr = code[pos];
-    int m1, m2, m3;
-    Opcode op = decode_instr(instr, &m1, &m2, &m3);
-    printf("%" PRId64 ": (%d) %s[%d, %d, %d]    ", pos, op, Opcode_names[op], m1, m2, m3);
-    switch (op)
-    {
-    case OP_Add:
-        {
-            write_operand(code, pos+2, m3);
-            printf(" <- ");
-            read_operand(code, pos+1, m1);
-            printf(" + ");
-            read_operand(code, pos+2, m2);
-            pos += 4;
-        } break;
-    case OP_Mul:
-        {
-            write_operand(code, pos+2, m3);
-            printf(" <- ");
-            read_operand(code, pos+1, m1);
-            printf(" * ");
-            read_operand(code, pos+2, m2);
-            pos += 4;
-        } break;
-    case OP_Inp:
-        {
-            write_operand(code, pos+1, m1);
-            printf("<- inp");
-            pos += 2;
-        } break;
-    case OP_Out:
-        {
-            printf("out <- ");
-            read_operand(code, pos+1, m1);
-            pos += 2;
-        } break;
-    case OP_Jnz:
-        {
-            read_operand(code, pos+1, m1);
-            printf(" != 0 => pos <- ");
-            read_operand(code, pos+2, m2);
-            pos += 3;
-        } break;
-    case OP_Jz:
-        {
-            read_operand(code, pos+1, m1);
-            printf(" == 0 => pos <- ");
-            read_operand(code, pos+2, m2);
-            pos += 3;
-        } break;
-    case OP_Lt:
-        {
-            write_operand(code, pos+3, m3);
-            printf(" <- ");
-            read_operand(code, pos+1, m1);
-            printf(" < ");
-            read_operand(code, pos+2, m2);
-            pos += 4;
-        } break;
-    case OP_Equ:
-        {
-            write_operand(code, pos+3, m3);
-            printf(" <- ");
-            read_operand(code, pos+1, m1);
-            printf(" == ");
-            read_operand(code, pos+2, m2);
-            pos += 4;
-        } break;
-    case OP_ModRel:
-        {
-            printf("B <- ");
-            read_operand(code, pos+1, m1);
-            pos += 2;
-        } break;
-    case OP_Halt:
-        {
-            pos += 1;
-        } break;
-
-    case Opcode_Max:
-    default:
-        printf("BUG!\n");
-        pos += 1;
-    }
-    *position = pos;
-}
-
-void print_code(Code code, int beg, int end)
-{
-    IntWord position = beg;
-    while (position < end)
-    {
-        print_instr(code, &position);
-        putchar('\n');
-    }
-}
-
-
+#include "../intcode/intcode.h"
+#include "../intcode/jit.h"
+#include "../intcode/fork.h"
+#include "../intcode/warm.h"
+#include "../intcode/batch.h"
 
 int min(int a, int b)
 {
@@ -872,51 +450,24 @@ void print_stack(Stack<T> s, void (*print_elem)(T x) = print<T>)
 
 void find_points_affected(Code original_code)
 {
-    Buffer input = {};
-    Buffer output = {};
-    State state = {};
-    state.input = &input;
-    state.output = &output;
-
-    // Write coordinates to input for the int code to consume
+    // Coordinates for the int code to consume, one probe per point. The
+    // probes run in lockstep batches of 8.
+    IntWord inputs[50*50*2];
     for (int y = 0; y < 50; y++) {
         for (int x = 0; x < 50; x++) {
-            write(&input, x);
-            write(&input, y);
+            inputs[(y*50 + x)*2] = x;
+            inputs[(y*50 + x)*2 + 1] = y;
         }
     }
+    IntWord outputs[50*50];
+    run_batch<8>(original_code, 4096, inputs, 2, 50*50, outputs);
 
-    Code code = copy_code(original_code);
-
-    int output_n = 0;
     int points_affected = 0;
-    while (!state.halted)
+    for (int output_n = 0; output_n < 50*50; output_n++)
     {
-        int res;
-        for (int i = 0; i < 20; i++)
-        {
-            res = step(&state, code);
-            if (res != 1) break;
-        }
-        while (readable_num(output) > 0)
-        {
-            IntWord out;
-            read(&output, &out);
-
-            printf("Got output %" PRId64 " (%d)\n", out, output_n);
-
-            output_n++;
-            if (out == 1) points_affected++;
-        }
-        if (state.halted) {
-            if (output_n < 50*50) {
-                state = {};
-                state.input = &input;
-                state.output = &output;
-                free_code(code);
-                code = copy_code(original_code);
-            }
-        }
+        IntWord out = outputs[output_n];
+        printf("Got output %" PRId64 " (%d)\n", out, output_n);
+        if (out == 1) points_affected++;
     }
 
     printf("Part 1: %d\n", points_affected);
@@ -966,13 +517,16 @@ IntWord actual_code[] = {
 
 void part_one()
 {
-    Code code = to_code(actual_code, 200000);
+    Code code = to_code(actual_code, 4096);
     find_points_affected(code);
     free_code(code);
 }
 
-bool scan_point(int x, int y)
+static int probe_num = 0;
+
+bool scan_point(int x, int y, bool verbose = true)
 {
+    probe_num++;
     Buffer input = {};
     Buffer output = {};
     State state = {};
@@ -983,27 +537,34 @@ bool scan_point(int x, int y)
     write(&input, x);
     write(&input, y);
 
-    Code code = to_code(actual_code, 200000);
+    // Every probe runs a fresh fork of the same program, and the compiled
+    // blocks are kept for the next ones.
+    static CodeSnapshot snapshot;
+    static Jit *jit = nullptr;
+    if (!jit)
+    {
+        Code code = to_code(actual_code, 4096);
+        snapshot = snapshot_code(code);
+        jit = create_jit(code);
+        free_code(code);
+    }
+    Code code = fork_code(snapshot);
+    warm_start(&state, code);
+    jit_attach(jit, code);
 
     bool result = false;
-    while (!state.halted)
+    execute_jit(&state, code, jit);
+    while (readable_num(output) > 0)
     {
-        int res;
-        for (int i = 0; i < 20; i++)
-        {
-            res = step(&state, code);
-            if (res != 1) break;
-        }
-        while (readable_num(output) > 0)
-        {
-            IntWord out;
-            read(&output, &out);
-            printf("out %d,%d = %" PRId64 "\n", x, y, out);
-            result = out == 1;
-        }
+        IntWord out;
+        read(&output, &out);
+        if (verbose) printf("out %d,%d = %" PRId64 "\n", x, y, out);
+        result = out == 1;
     }
-    free_code(code);
+    free_fork(code);
 
+    free_buffer(&input);
+    free_buffer(&output);
     return result;
 }
 
@@ -1066,15 +627,308 @@ void scan() {
     printf("Part 2: %d", result);
 }
 
-void part_two()
+// Probe results by (x, y), open addressing.
+struct ProbeCache
+{
+    uint64_t *keys; // (x << 32 | y) + 1, 0 for an empty slot
+    bool *values;
+    int capacity;   // power of two
+    int num;
+};
+
+inline uint64_t probe_key(int x, int y)
+{
+    return (((uint64_t)(uint32_t)x << 32) | (uint32_t)y) + 1;
+}
+
+inline int probe_slot(const ProbeCache *cache, uint64_t key)
+{
+    uint64_t h = key * 0x9E3779B97F4A7C15ull;
+    int i = (int)(h >> 32) & (cache->capacity - 1);
+    while (cache->keys[i] != 0 && cache->keys[i] != key) i = (i + 1) & (cache->capacity - 1);
+    return i;
+}
+
+void grow_probe_cache(ProbeCache *cache)
+{
+    ProbeCache grown = {};
+    grown.capacity = (cache->capacity == 0) ? 1024 : cache->capacity * 2;
+    grown.keys = (uint64_t*)calloc(grown.capacity, sizeof(uint64_t));
+    grown.values = (bool*)calloc(grown.capacity, sizeof(bool));
+    for (int i = 0; i < cache->capacity; i++)
+    {
+        if (cache->keys[i] == 0) continue;
+        int j = probe_slot(&grown, cache->keys[i]);
+        grown.keys[j] = cache->keys[i];
+        grown.values[j] = cache->values[i];
+        grown.num++;
+    }
+    free(cache->keys);
+    free(cache->values);
+    *cache = grown;
+}
+
+void free_probe_cache(ProbeCache *cache)
 {
-    scan();
+    free(cache->keys);
+    free(cache->values);
+    *cache = { };
+}
+
+bool in_beam(ProbeCache *cache, int x, int y)
+{
+    if (x < 0 || y < 0) return false;
+    if (2 * (cache->num + 1) > cache->capacity) grow_probe_cache(cache);
+    uint64_t key = probe_key(x, y);
+    int i = probe_slot(cache, key);
+    if (cache->keys[i] == 0)
+    {
+        cache->keys[i] = key;
+        cache->values[i] = scan_point(x, y, false);
+        cache->num++;
+    }
+    return cache->values[i];
+}
+
+// First x of the beam on row y, searching right from x = from. Both edges
+// of the beam only move right as the rows go down, so the edge of the row
+// above is a safe start. Returns -1 for a row with no beam (rows close to
+// the emitter can have none).
+int walk_left_edge(ProbeCache *cache, int y, int from)
+{
+    int limit = from + 2 * y + 10;
+    for (int x = from; x <= limit; x++)
+    {
+        if (in_beam(cache, x, y)) return x;
+    }
+    return -1;
+}
+
+// Rows closer to the emitter than this can have gaps in the beam, so they
+// are walked one at a time.
+const int BEAM_NEAR_ROWS = 20;
+
+struct BeamTracker
+{
+    ProbeCache cache;
+    int size;
+    int reference_y;    // farthest row with a known left edge
+    int reference_x;
+};
+
+// First x of the beam on row y, for a row past the near ones. Guesses the
+// edge from the slope of the reference row, then searches outwards from the
+// guess for a cell in the beam and walks left from there to the edge.
+int left_edge(BeamTracker *t, int y)
+{
+    int guess = (int)((int64_t)y * t->reference_x / t->reference_y);
+    int x = -1;
+    for (int d = 0; d <= y && x < 0; d++)
+    {
+        if (in_beam(&t->cache, guess + d, y)) x = guess + d;
+        else if (d > 0 && in_beam(&t->cache, guess - d, y)) x = guess - d;
+    }
+    if (x < 0) return -1;
+    while (in_beam(&t->cache, x - 1, y)) x--;
+    if (y > t->reference_y)
+    {
+        t->reference_y = y;
+        t->reference_x = x;
+    }
+    return x;
+}
+
+// Last x of the beam on row y, given its first. Gallops right from the
+// left edge and binary searches back.
+int right_edge(BeamTracker *t, int y, int left)
+{
+    int step = 1;
+    while (in_beam(&t->cache, left + step, y)) step *= 2;
+    int inside = left + step / 2;
+    int outside = left + step;
+    while (outside - inside > 1)
+    {
+        int mid = inside + (outside - inside) / 2;
+        if (in_beam(&t->cache, mid, y)) inside = mid;
+        else outside = mid;
+    }
+    return inside;
+}
+
+// Whether a size x size square fits with its bottom-left corner on the left
+// edge of row y: every row above starts at or left of that corner and every
+// row below ends at or right of it, so the square fits exactly when its
+// top-right corner is in the beam.
+bool square_fits(BeamTracker *t, int y, int left)
+{
+    int top = y - t->size + 1;
+    return left >= 0 && top >= 0 && in_beam(&t->cache, left + t->size - 1, top);
+}
+
+// Top-left corner of the first size x size square that fits in the beam,
+// the one with the smallest y.
+//
+// Walks the rows near the emitter one at a time. Past them the beam widens
+// steadily, so it gallops down the rows to one where the square fits and
+// binary searches back. The edges are rounded to whole cells, which can
+// flip the test back and forth for a few rows around where it first turns
+// true. Each edge stays within a cell of a straight line, so no row more
+// than 4 / (beam growth per row) above the one found can fit, and those
+// rows are walked after the binary search.
+bool find_square(int size, int *result_x, int *result_y, bool verbose = true)
+{
+    BeamTracker t = {};
+    t.size = size;
+    int start_probes = probe_num;
+    bool found = false;
+    int lo = -1;
+    int hi = -1;
+    int left = 0;
+    for (int y = 0; y < BEAM_NEAR_ROWS && !found; y++)
+    {
+        int l = walk_left_edge(&t.cache, y, left);
+        if (l < 0) continue;
+        left = l;
+        t.reference_y = y;
+        t.reference_x = l;
+        if (square_fits(&t, y, left))
+        {
+            hi = y;
+            found = true;
+        }
+    }
+
+    if (!found && t.reference_y > 0)
+    {
+        lo = BEAM_NEAR_ROWS - 1;
+        hi = (size > BEAM_NEAR_ROWS) ? size : BEAM_NEAR_ROWS;
+        while (hi < 100'000 && !square_fits(&t, hi, left_edge(&t, hi)))
+        {
+            lo = hi;
+            hi *= 2;
+        }
+        found = hi < 100'000;
+        while (found && hi - lo > 1)
+        {
+            int mid = lo + (hi - lo) / 2;
+            if (square_fits(&t, mid, left_edge(&t, mid))) hi = mid;
+            else lo = mid;
+        }
+        if (found)
+        {
+            left = left_edge(&t, hi);
+            int width = right_edge(&t, hi, left) - left + 1;
+            int spread = 4 * hi / width + 2;
+            int first = (hi - spread > BEAM_NEAR_ROWS) ? hi - spread : BEAM_NEAR_ROWS;
+            for (int y = first; y < hi; y++)
+            {
+                int l = left_edge(&t, y);
+                if (square_fits(&t, y, l))
+                {
+                    hi = y;
+                    left = l;
+                    break;
+                }
+            }
+        }
+    }
+
+    if (found)
+    {
+        *result_x = left;
+        *result_y = hi - size + 1;
+    }
+    if (verbose)
+    {
+        printf("%d VM runs for %d distinct probes\n", probe_num - start_probes, t.cache.num);
+        printf("warm starts: %" PRId64 " hits, %" PRId64 " misses\n", warm_stats().hits, warm_stats().misses);
+    }
+    free_probe_cache(&t.cache);
+    return found;
+}
+
+// Checks find_square() against every square in a grid of the beam, for the
+// sizes up to max_size. Run with "day19 test".
+bool test_find_square(int max_size)
+{
+    const int rows = 400;
+    const int cols = 400;
+    // Prefix sums of the beam cells, sum[y][x] counts the cells above and
+    // to the left of (x, y).
+    int *sum = (int*)calloc((rows + 1) * (cols + 1), sizeof(int));
+    for (int y = 0; y < rows; y++)
+    {
+        for (int x = 0; x < cols; x++)
+        {
+            int cell = scan_point(x, y, false) ? 1 : 0;
+            sum[(y + 1) * (cols + 1) + x + 1] = cell + sum[y * (cols + 1) + x + 1]
+                + sum[(y + 1) * (cols + 1) + x] - sum[y * (cols + 1) + x];
+        }
+    }
+
+    bool ok = true;
+    for (int size = 1; size <= max_size; size++)
+    {
+        int expected_x = -1;
+        int expected_y = -1;
+        for (int y = 0; y + size <= rows && expected_y < 0; y++)
+        {
+            for (int x = 0; x + size <= cols; x++)
+            {
+                int cells = sum[(y + size) * (cols + 1) + x + size] - sum[y * (cols + 1) + x + size]
+                    - sum[(y + size) * (cols + 1) + x] + sum[y * (cols + 1) + x];
+                if (cells == size * size)
+                {
+                    expected_x = x;
+                    expected_y = y;
+                    break;
+                }
+            }
+        }
+        if (expected_y < 0)
+        {
+            printf("size %d: no square in the %dx%d grid\n", size, cols, rows);
+            continue;
+        }
+        int x = -1;
+        int y = -1;
+        find_square(size, &x, &y, false);
+        bool same = x == expected_x && y == expected_y;
+        printf("size %2d: %s x=%d,y=%d (brute force x=%d,y=%d)\n",
+               size, same ? "ok  " : "FAIL", x, y, expected_x, expected_y);
+        ok = ok && same;
+    }
+    free(sum);
+    return ok;
+}
+
+void part_two(int size)
+{
+    int x, y;
+    if (!find_square(size, &x, &y))
+    {
+        printf("No beam found\n");
+        return;
+    }
+    printf("%dx%d square at x=%d,y=%d\n", size, size, x, y);
+    printf("Part 2: %d\n", x * 10'000 + y);
 }
 
 int main(int argc, const char **argv)
 {
+    // day19 [scan | test | square size]
+    if (argc > 1 && strcmp(argv[1], "scan") == 0)
+    {
+        scan();
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "test") == 0)
+    {
+        return test_find_square(20) ? 0 : 1;
+    }
+    int size = (argc > 1) ? atoi(argv[1]) : 100;
     //part_one();
-    part_two();
+    part_two(size);
     return 0;
 }
 
@@ -151,433 +151,10 @@ Your puzzle answer was 1141826552.
 #include <cstring>
 #include <cassert>
 
-typedef int64_t IntWord;
-
-#define OPCODES \
-    OPCODE(Add, 1)\
-    OPCODE(Mul, 2)\
-    OPCODE(Inp, 3)\
-    OPCODE(Out, 4)\
-    OPCODE(Jnz, 5)\
-    OPCODE(Jz, 6)\
-    OPCODE(Lt, 7)\
-    OPCODE(Equ, 8)\
-    OPCODE(ModRel, 9)\
-    OPCODE(Halt, 99)
-
-#define OPCODE(op, x) OP_ ## op = x,
-enum Opcode
-{
-    OPCODES
-
-    Opcode_Max
-};
-#undef OPCODE
-
-static const char* Opcode_names[Opcode_Max] = { };
-#define OPCODE(op, x) Opcode_names[x] = #op;
-bool init_opcode_names()
-{
-    OPCODES
-    return true;
-}
-#undef OPCODE
-static bool init = init_opcode_names();
-
-#define MAX_IO_BUFFER 10000
-//#define MAX_IO_BUFFER 1000
-struct Buffer
-{
-    int write;
-    int read;
-    IntWord data[MAX_IO_BUFFER];
-};
-
-void write(Buffer *buf, IntWord x)
-{
-    buf->data[buf->write] = x;
-    buf->write++;
-    if (buf->write == MAX_IO_BUFFER)
-    {
-        buf->write = 0;
-    }
-}
-
-bool read(Buffer *buf, IntWord *x)
-{
-    if (buf->read != buf->write)
-    {
-        *x = buf->data[buf->read];
-        buf->read++;
-        if (buf->read == MAX_IO_BUFFER)
-        {
-            buf->read = 0;
-        }
-        return true;
-    }
-    return false;
-}
-
-int readable_num(Buffer buf)
-{
-    if (buf.write >= buf.read)
-    {
-        return buf.write - buf.read;
-    }
-    return buf.write + MAX_IO_BUFFER - buf.read;
-}
-
-struct State
-{
-    int position;
-    int relative_base;
-    bool halted;
-
-    Buffer *input;
-    Buffer *output;
-};
-
-struct Code
-{
-    IntWord *data;
-    int code_size;
-    int memory_size; // code_size + extra memory
-
-    IntWord operator[](int pos) const
-    {
-        return data[pos];
-    }
-    IntWord& operator[](int pos)
-    {
-        return data[pos];
-    }
-};
-
-template <int N>
-Code to_code(IntWord (&c)[N], int extra_memory)
-{
-    IntWord *data = (IntWord*)calloc((N + extra_memory), sizeof(IntWord));
-    //IntWord *data = (IntWord*)malloc(sizeof(IntWord) * (N + extra_memory));
-    memcpy(data, c, sizeof(IntWord) * N);
-    //memset(data + N, 0, sizeof(IntWord) * extra_memory);
-    return { .data = data, .code_size = N, .memory_size = N + extra_memory };
-};
-
-void reset_extra_memory(Code &c) {
-    int extra_memory = c.memory_size - c.code_size;
-    memset(c.data + c.code_size, 0, extra_memory * sizeof(IntWord));
-}
-
-Code copy_code(Code &c) {
-    IntWord *data = (IntWord*)calloc(c.memory_size, sizeof(IntWord));
-    memcpy(data, c.data, sizeof(IntWord) * c.code_size);
-    return { .data = data, .code_size = c.code_size, .memory_size = c.memory_size };
-}
-
-void free_code(Code &c)
-{
-    free(c.data);
-    c = { };
-}
-
-void print_code(Code code)
-{
-    if (code.code_size > 0)
-    {
-        printf("%" PRId64, code[0]);
-        for (int i = 1; i < code.code_size; i++) printf(",%" PRId64, code[i]);
-        printf("\n");
-    }
-}
-
-Opcode decode_instr(IntWord instr, int *m1, int *m2, int *m3)
-{
-    int op = instr % 100;
-    *m1 = (instr / 100) % 10;
-    *m2 = (instr / 1000) % 10;
-    *m3 = (instr / 10000) % 10;
-    return (Opcode)op;
-}
-
-IntWord read(State *s, Code code, int pos, int mode)
-{
-    IntWord a = code[pos];
-    IntWord result;
-    switch (mode)
-    {
-        case 0: result = code[a]; break;
-        case 1: result = a; break;
-        case 2: result = code[s->relative_base + a]; break;
-        default:
-            assert("invalid address mode" && 0);
-    }
-    return result;
-}
-
-IntWord read_pos(State *s, Code code, int pos, int mode)
-{
-    IntWord a = code[pos];
-    IntWord result;
-    switch (mode)
-    {
-        case 0: result = a; break;
-        case 2: result = s->relative_base + a; break;
-        default:
-            assert("invalid address mode" && 0);
-    }
-    return result;
-}
-
-int step(State *s, Code code)
-{
-    int pos = s->position;
-    IntWord instr = code[pos];
-    int m1, m2, m3;
-    Opcode op = decode_instr(instr, &m1, &m2, &m3);
-    //printf("%d: (%d) %s[%d, %d, %d]\n", pos, op, Opcode_names[op], m1, m2, m3);
-    switch (op)
-    {
-    case OP_Add:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            IntWord oper2 = read(s, code, pos+2, m2);
-            IntWord res_pos = read_pos(s, code, pos+3, m3);
-            //printf(" [%lld] <- %lld + %lld\n", res_pos, oper1, oper2);
-            code[res_pos] = oper1 + oper2;
-            pos += 4;
-        } break;
-    case OP_Mul:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            IntWord oper2 = read(s, code, pos+2, m2);
-            IntWord res_pos = read_pos(s, code, pos+3, m3);
-            //printf(" [%lld] <- %lld * %lld\n", res_pos, oper1, oper2);
-            code[res_pos] = oper1 * oper2;
-            pos += 4;
-        } break;
-    case OP_Inp:
-        {
-            IntWord res;
-            if (!read(s->input, &res))
-            {
-                printf("Waiting input...\n");
-                getchar();
-                return 0;
-            }
-            IntWord res_pos = read_pos(s, code, pos+1, m1);
-            //printf(" [%lld] <- inp=%lld\n", res_pos, res);
-            code[res_pos] = res;
-            pos += 2;
-        } break;
-    case OP_Out:
-        {
-            IntWord out = read(s, code, pos+1, m1);
-            write(s->output, out);
-            //printf("out=%lld\n", out);
-            pos += 2;
-        } break;
-    case OP_Jnz:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            IntWord oper2 = read(s, code, pos+2, m2);
-            //printf(" %lld != 0 => pos=%lld\n", oper1, oper2);
-            if (oper1 != 0)
-            {
-                pos = oper2;
-            }
-            else
-            {
-                pos += 3;
-            }
-        } break;
-    case OP_Jz:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            IntWord oper2 = read(s, code, pos+2, m2);
-            //printf(" %lld == 0 => pos=%lld\n", oper1, oper2);
-            if (oper1 == 0)
-            {
-                pos = oper2;
-            }
-            else
-            {
-                pos += 3;
-            }
-        } break;
-    case OP_Lt:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            IntWord oper2 = read(s, code, pos+2, m2);
-            IntWord res_pos = read_pos(s, code, pos+3, m3);
-            //printf(" [%lld] <- %lld < %lld\n", res_pos, oper1, oper2);
-            code[res_pos] = (oper1 < oper2) ? 1 : 0;
-            pos += 4;
-        } break;
-    case OP_Equ:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            IntWord oper2 = read(s, code, pos+2, m2);
-            IntWord res_pos = read_pos(s, code, pos+3, m3);
-            //printf(" [%lld] <- %lld == %lld\n", res_pos, oper1, oper2);
-            code[res_pos] = (oper1 == oper2) ? 1 : 0;
-            pos += 4;
-        } break;
-    case OP_ModRel:
-        {
-            IntWord oper1 = read(s, code, pos+1, m1);
-            //printf(" %d => ", s->relative_base);
-            s->relative_base += oper1;
-            //printf(" %d\n", s->relative_base);
-            pos += 2;
-        } break;
-    case OP_Halt:
-        {
-            //printf("Halt!\n");
-            s->halted = true;
-            return -1;
-        } break;
-
-    case Opcode_Max:
-    default:
-        printf("BUG!\n");
-        pos += 1;
-        //return -1;
-    }
-    s->position = pos;
-    return 1;
-}
-
-void execute(State *state, Code code)
-{
-    while (step(state, code) == 1);
-}
-
-void read_operand(Code code, int pos, int mode)
-{
-    IntWord a = code[pos];
-    switch (mode)
-    {
-        case 0: printf("[%" PRId64 "]=%" PRId64, a, code[a]); break;
-        case 1: printf("%" PRId64, a); break;
-        case 2: printf("[B+%" PRId64 "]=?", a); break;
-        default:
-            assert("invalid address mode" && 0);
-    }
-}
-
-void write_operand(Code code, int pos, int mode)
-{
-    IntWord a = code[pos];
-    switch (mode)
-    {
-        case 0: printf("[%" PRId64 "]", a); break;
-        case 2: printf("[B+%" PRId64 "]", a); break;
-        default:
-            assert("invalid address mode" && 0);
-    }
-}
-
-void print_instr(Code code, IntWord *position)
-{
-    IntWord pos = *position;
-    IntWord instr = code[pos];
-    int m1, m2, m3;
-    Opcode op = decode_instr(instr, &m1, &m2, &m3);
-    printf("%" PRId64 ": (%d) %s[%d, %d, %d]    ", pos, op, Opcode_names[op], m1, m2, m3);
-    switch (op)
-    {
-    case OP_Add:
-        {
-            write_operand(code, pos+2, m3);
-            printf(" <- ");
-            read_operand(code, pos+1, m1);
-            printf(" + ");
-            read_operand(code, pos+2, m2);
-            pos += 4;
-        } break;
-    case OP_Mul:
-        {
-            write_operand(code, pos+2, m3);
-            printf(" <- ");
-            read_operand(code, pos+1, m1);
-            printf(" * ");
-            read_operand(code, pos+2, m2);
-            pos += 4;
-        } break;
-    case OP_Inp:
-        {
-            write_operand(code, pos+1, m1);
-            printf("<- inp");
-            pos += 2;
-        } break;
-    case OP_Out:
-        {
-            printf("out <- ");
-            read_operand(code, pos+1, m1);
-            pos += 2;
-        } break;
-    case OP_Jnz:
-        {
-            read_operand(code, pos+1, m1);
-            printf(" != 0 => pos <- ");
-            read_operand(code, pos+2, m2);
-            pos += 3;
-        } break;
-    case OP_Jz:
-        {
-            read_operand(code, pos+1, m1);
-            printf(" == 0 => pos <- ");
-            read_operand(code, pos+2, m2);
-            pos += 3;
-        } break;
-    case OP_Lt:
-        {
-            write_operand(code, pos+3, m3);
-            printf(" <- ");
-            read_operand(code, pos+1, m1);
-            printf(" < ");
-            read_operand(code, pos+2, m2);
-            pos += 4;
-        } break;
-    case OP_Equ:
-        {
-            write_operand(code, pos+3, m3);
-            printf(" <- ");
-            read_operand(code, pos+1, m1);
-            printf(" == ");
-            read_operand(code, pos+2, m2);
-            pos += 4;
-        } break;
-    case OP_ModRel:
-        {
-            printf("B <- ");
-            read_operand(code, pos+1, m1);
-            pos += 2;
-        } break;
-    case OP_Halt:
-        {
-            pos += 1;
-        } break;
-
-    case Opcode_Max:
-    default:
-        printf("BUG!\n");
-        pos += 1;
-    }
-    *position = pos;
-}
-
-void print_code(Code code, int beg, int end)
-{
-    IntWord position = beg;
-    while (position < end)
-    {
-        print_instr(code, &position);
-        putchar('\n');
-    }
-}
-
-
+#include "../intcode/intcode.h"
+#include "../intcode/jit.h"
+#include "../intcode/warm.h"
+#include "../intcode/memo.h"
 
 int min(int a, int b)
 {
@@ -906,6 +483,9 @@ void print_stack(Stack<T> s, void (*print_elem)(T x) = print<T>)
     printf("]");
 }
 
+// Set by running "day21 memo", see memo.h.
+Memo *memo = nullptr;
+
 int survey_hull_damage(Code code, const char *script)
 {
     Buffer input = {};
@@ -919,15 +499,14 @@ int survey_hull_damage(Code code, const char *script)
         write(&input, script[i]);
     }
 
+    warm_start(&state, code);
+    Jit *jit = memo ? nullptr : create_jit(code);
+
     int total_damage = 0;
     while (!state.halted)
     {
-        int res;
-        for (int i = 0; i < 20; i++)
-        {
-            res = step(&state, code);
-            if (res != 1) break;
-        }
+        if (memo) execute_memo(&state, code, memo);
+        else execute_jit(&state, code, jit);
         while (readable_num(output) > 0)
         {
             IntWord out;
@@ -940,7 +519,10 @@ int survey_hull_damage(Code code, const char *script)
             }
         }
     }
+    free_jit(jit);
 
+    free_buffer(&input);
+    free_buffer(&output);
     return total_damage;
 }
 
@@ -1136,7 +718,7 @@ IntWord actual_code[] = {
 
 void part_one()
 {
-    Code code = to_code(actual_code, 200000);
+    Code code = to_code(actual_code, 4096);
 
     const char *script = ""
         "NOT C T\n"
@@ -1157,7 +739,7 @@ void part_one()
 
 void part_two()
 {
-    Code code = to_code(actual_code, 200000);
+    Code code = to_code(actual_code, 4096);
 
     // If at least one hole in A, B, C,
     // AND landing tile D is ground,
@@ -1193,8 +775,19 @@ void part_two()
 
 int main(int argc, const char **argv)
 {
+    if (argc > 1 && strcmp(argv[1], "memo") == 0)
+    {
+        Code code = to_code(actual_code, 4096);
+        memo = create_memo(code);
+        free_code(code);
+    }
     part_one();
     part_two();
+    if (memo)
+    {
+        print_memo_stats(memo);
+        free_memo(memo);
+    }
     return 0;
 }
 
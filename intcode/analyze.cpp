@@ -0,0 +1,158 @@
+// Static analysis of the Intcode program embedded in a day's main.cpp, see
+// cfg.h.
+//
+//     analyze ../13/main.cpp [blocks]
+//
+// Prints the instructions and basic blocks found, the indirect jumps, the
+// cells the program writes and which instructions it modifies, and with
+// "blocks" every basic block and where it continues.
+
+#include "intcode.h"
+#include "cfg.h"
+#include "program.h"
+
+// Prints the positions where (flags[pos] & flag) != 0 as ranges.
+void print_ranges(const Cfg *cfg, int flag)
+{
+    int count = 0;
+    for (int pos = 0; pos < cfg->n; pos++)
+    {
+        if (!(cfg->flags[pos] & flag)) continue;
+        int end = pos;
+        while (end + 1 < cfg->n && (cfg->flags[end + 1] & flag)) end++;
+        if (count++ > 0) printf(",");
+        if (end == pos) printf(" %d", pos);
+        else printf(" %d-%d", pos, end);
+        pos = end;
+    }
+    printf("\n");
+}
+
+int count_flag(const Cfg *cfg, int flag)
+{
+    int count = 0;
+    for (int pos = 0; pos < cfg->n; pos++) count += (cfg->flags[pos] & flag) != 0;
+    return count;
+}
+
+// Prints the instructions with a cell written by a position mode
+// destination, and the instructions writing them.
+void print_modified(const Cfg *cfg, const IntWord *image)
+{
+    int modified = 0;
+    for (int pos = 0; pos < cfg->n; pos++)
+    {
+        if (cfg->owner[pos] != pos || cfg_never_written(cfg, pos)) continue;
+        modified++;
+        printf("    %d: (%" PRId64 ") %s, written by", pos, image[pos], Opcode_names[image[pos] % 100]);
+        for (int w = 0; w < cfg->n; w++)
+        {
+            if (cfg->owner[w] != w) continue;
+            int m1, m2, m3;
+            Opcode op = decode_instr(image[w], &m1, &m2, &m3);
+            IntWord dest = -1;
+            if (op == OP_Inp && m1 == 0) dest = image[w + 1];
+            if ((op == OP_Add || op == OP_Mul || op == OP_Lt || op == OP_Equ) && m3 == 0) dest = image[w + 3];
+            if (dest >= 0 && dest < cfg->n && cfg->owner[dest] == pos) printf(" %d", w);
+        }
+        printf("\n");
+    }
+    if (modified == 0) printf("    none\n");
+}
+
+// Prints the runs of adjacent instructions none of which is written.
+void print_stable(const Cfg *cfg)
+{
+    int stable = 0;
+    int ranges = 0;
+    int start = -1;
+    int end = -1; // one past the current run
+    for (int pos = 0; pos < cfg->n; pos++)
+    {
+        if (cfg->owner[pos] != pos) continue;
+        int next = pos;
+        while (next < cfg->n && cfg->owner[next] == pos) next++;
+        bool ok = cfg_never_written(cfg, pos);
+        if (start >= 0 && (!ok || pos != end))
+        {
+            printf("%s %d-%d", (ranges++ > 0) ? "," : "", start, end - 1);
+            start = -1;
+        }
+        if (!ok) continue;
+        if (start < 0) start = pos;
+        end = next;
+        stable++;
+    }
+    if (start >= 0) printf("%s %d-%d", (ranges++ > 0) ? "," : "", start, end - 1);
+    printf("\n    %d of %d instructions in %d ranges\n", stable, cfg->instr_num, ranges);
+}
+
+void print_blocks(const Cfg *cfg)
+{
+    for (int i = 0; i < cfg->block_num; i++)
+    {
+        const CfgBlock &b = cfg->blocks[i];
+        printf("    %5d-%-5d %3d instr  ->", b.start, b.end - 1, b.instr_num);
+        if (b.next[0] >= 0) printf(" %d", b.next[0]);
+        if (b.next[1] >= 0) printf(" %d", b.next[1]);
+        if (b.indirect) printf(" (indirect)");
+        if (b.halts) printf(" halt");
+        printf("\n");
+    }
+}
+
+int main(int argc, const char **argv)
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <main.cpp> [blocks]\n", argv[0]);
+        return 1;
+    }
+    const char *source = argv[1];
+    bool blocks = argc > 2 && strcmp(argv[2], "blocks") == 0;
+
+    int n;
+    IntWord *image = load_program(source, &n);
+    if (!image)
+    {
+        fprintf(stderr, "%s: no actual_code[] in %s\n", argv[0], source);
+        return 1;
+    }
+    Cfg *cfg = analyze_program(image, n);
+
+    int code_cells = 0;
+    for (int pos = 0; pos < n; pos++) code_cells += cfg->owner[pos] >= 0;
+    printf("%s: %d cells\n", source, n);
+    printf("%d instructions in %d cells, %d basic blocks\n", cfg->instr_num, code_cells, cfg->block_num);
+    printf("%d immediate jump targets, %d return targets\n",
+           count_flag(cfg, CFG_JumpTarget), count_flag(cfg, CFG_ReturnTarget));
+
+    printf("%d indirect jumps:", cfg->indirect_num);
+    for (int i = 0; i < cfg->indirect_num; i++)
+    {
+        int pos = cfg->indirect[i];
+        int m1, m2, m3;
+        decode_instr(image[pos], &m1, &m2, &m3);
+        if (m2 == 2) printf(" %d [B%+" PRId64 "]", pos, image[pos + 2]);
+        else printf(" %d [%" PRId64 "]", pos, image[pos + 2]);
+    }
+    printf("\n");
+    printf("%d instructions write relative to the relative base (not followed)\n", cfg->relative_writes);
+
+    printf("cells written:");
+    print_ranges(cfg, CFG_Written);
+    printf("modified instructions:\n");
+    print_modified(cfg, image);
+    printf("instructions never written:");
+    print_stable(cfg);
+
+    if (blocks)
+    {
+        printf("blocks:\n");
+        print_blocks(cfg);
+    }
+
+    free_cfg(cfg);
+    free(image);
+    return 0;
+}
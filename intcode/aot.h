@@ -0,0 +1,55 @@
+#ifndef INTCODE_AOT_H
+#define INTCODE_AOT_H
+
+// Runtime support for the C++ files generated by translate.cpp.
+//
+// A translated program has a label per instruction of the original image,
+// with the operands folded into the code. The program may still overwrite
+// its own instructions, so every translated instruction first checks a
+// per-instruction stale flag. Instructions that no longer match the image
+// they were translated from are run by the interpreter instead.
+
+#include "intcode.h"
+
+struct AotProgram
+{
+    int code_size;
+    const IntWord *image; // the program the code was translated from
+    const int *owner;     // start of the translated instruction containing each cell, or -1
+};
+
+// Updates the stale flag of the instruction containing addr after a store.
+inline void aot_written(const AotProgram *p, const IntWord *m, uint8_t *stale, IntWord addr)
+{
+    if ((uint64_t)addr >= (uint64_t)p->code_size) return;
+    int start = p->owner[addr];
+    if (start < 0) return;
+    int len = instr_length((Opcode)(p->image[start] % 100));
+    bool differs = false;
+    for (int i = start; i < start + len; i++)
+    {
+        if (m[i] != p->image[i]) differs = true;
+    }
+    stale[start] = differs;
+}
+
+inline void aot_init_stale(const AotProgram *p, const IntWord *m, uint8_t *stale)
+{
+    memset(stale, 0, p->code_size);
+    for (int i = 0; i < p->code_size; i++)
+    {
+        if (p->owner[i] >= 0 && m[i] != p->image[i]) stale[p->owner[i]] = 1;
+    }
+}
+
+// Interprets the instruction at the current position.
+inline int aot_step(const AotProgram *p, State *s, Code code, uint8_t *stale)
+{
+    IntWord addr;
+    bool writes = instr_write_addr(s, code, &addr);
+    int res = step(s, code);
+    if (res == 1 && writes) aot_written(p, code.data, stale, addr);
+    return res;
+}
+
+#endif // INTCODE_AOT_H
@@ -0,0 +1,397 @@
+// Compares the Intcode execution engines on the programs bundled with the
+// days. Every workload is run with every engine on fresh copies of the
+// program, the outputs are checked against the switch interpreter.
+//
+//     make bench
+//
+// The "aot" engine runs the translated_<day>.h files generated by translate.
+
+#include <chrono>
+
+#include "intcode.h"
+#include "batch.h"
+#include "fork.h"
+#include "jit.h"
+#include "narrow.h"
+#include "program.h"
+
+#include "translated_05.h"
+#include "translated_09.h"
+#include "translated_13.h"
+#include "translated_17.h"
+#include "translated_19.h"
+#include "translated_21.h"
+
+// Runs until the program halts (-1) or waits for input (0). engine_data is
+// created once per workload by Engine::create, so engines can keep state
+// (e.g. compiled code) across the runs of a workload.
+typedef int (*Runner)(State *s, Code code, void *engine_data);
+
+struct Workload;
+
+int run_switch(State *s, Code code, void *)
+{
+    execute(s, code);
+    return s->halted ? -1 : 0;
+}
+
+int run_decoded(State *s, Code code, void *)
+{
+    return execute_decoded(s, code);
+}
+
+int run_specialized(State *s, Code code, void *)
+{
+    execute_specialized(s, code);
+    return s->halted ? -1 : 0;
+}
+
+int run_threaded(State *s, Code code, void *)
+{
+    return execute_threaded(s, code);
+}
+
+// A 32-bit copy of the program per run, promoted to the 64-bit code when
+// it overflows. The engine data is the narrow image, or null when the
+// program does not fit.
+void *create_narrow_engine(Workload *w);
+void free_narrow_engine(void *image)
+{
+    if (!image) return;
+    free_narrow((NarrowCode*)image);
+    free(image);
+}
+// Narrow VMs promoted so far, for the bench to print
+int64_t narrow_promotions = 0;
+int run_narrow(State *s, Code code, void *image)
+{
+    if (!image) return execute_threaded(s, code);
+    NarrowCode narrow = copy_narrow(*(NarrowCode*)image);
+    int result = execute_narrow(s, &narrow, code);
+    if (narrow.promoted) narrow_promotions++;
+    free_narrow(&narrow);
+    return result;
+}
+
+void *create_jit_engine(Workload *w);
+void free_jit_engine(void *jit) { free_jit((Jit*)jit); }
+int run_jit(State *s, Code code, void *jit)
+{
+    // Every run gets a fresh copy
+    jit_attach((Jit*)jit, code);
+    return execute_jit(s, code, (Jit*)jit);
+}
+
+typedef int (*TranslatedFn)(State *s, Code code);
+
+void *translated_engine(Workload *w);
+int run_translated(State *s, Code code, void *fn)
+{
+    return ((TranslatedFn)fn)(s, code);
+}
+
+struct Engine
+{
+    const char *name;
+    Runner run;
+    bool decode_cache;
+    void *(*create)(Workload *w);
+    void (*destroy)(void *engine_data);
+};
+
+Engine engines[] = {
+    { "switch", run_switch, false, nullptr, nullptr },
+    { "decoded", run_decoded, true, nullptr, nullptr },
+    { "specialized", run_specialized, false, nullptr, nullptr },
+    { "threaded", run_threaded, false, nullptr, nullptr },
+    { "narrow", run_narrow, false, create_narrow_engine, free_narrow_engine },
+    { "jit", run_jit, false, create_jit_engine, free_jit_engine },
+    { "aot", run_translated, false, translated_engine, nullptr },
+};
+const int engine_num = sizeof(engines)/sizeof(engines[0]);
+
+void feed_value(Buffer *input, IntWord x) { write(input, x); }
+
+void feed_ascii(Buffer *input, const char *s)
+{
+    while (*s) write(input, *s++);
+}
+
+void feed_05(Buffer *input, int) { feed_value(input, 5); }
+void feed_09(Buffer *input, int) { feed_value(input, 2); }
+void feed_none(Buffer *, int) { }
+void feed_19(Buffer *input, int run)
+{
+    feed_value(input, run % 50);
+    feed_value(input, run / 50);
+}
+void feed_21(Buffer *input, int)
+{
+    feed_ascii(input,
+        "NOT C T\n"
+        "AND D T\n"
+        "NOT T T\n"
+        "NOT T J\n"
+        "AND A T\n"
+        "NOT T T\n"
+        "OR T J\n"
+        "WALK\n");
+}
+
+struct Workload
+{
+    const char *name;
+    const char *source;
+    int runs; // fresh VMs per measurement
+    void (*feed)(Buffer *input, int run);
+    TranslatedFn translated;
+    // Filled in by the bench
+    Code code = {};
+    Code decoded = {}; // code with a filled decode cache, copied by the decoded engines
+    int64_t fused[Fused_Max] = {}; // fused pairs executed by the decoded engine in one run
+    int64_t promotions = 0;        // narrow VMs promoted to 64 bits in one run
+    double copy_us = 0, fork_us = 0; // cost of a fresh VM
+};
+
+Workload workloads[] = {
+    { "05 diagnostics", "../05/main.cpp", 200, feed_05, run_05 },
+    { "09 BOOST", "../09/main.cpp", 10, feed_09, run_09 },
+    { "13 arcade", "../13/main.cpp", 10, feed_none, run_13 },
+    { "17 scaffold", "../17/main.cpp", 10, feed_none, run_17 },
+    { "19 beam 50x50", "../19/main.cpp", 2500, feed_19, run_19 },
+    { "21 walk", "../21/main.cpp", 2, feed_21, run_21 },
+};
+const int workload_num = sizeof(workloads)/sizeof(workloads[0]);
+
+void *create_jit_engine(Workload *w) { return create_jit(w->code); }
+void *create_narrow_engine(Workload *w)
+{
+    NarrowCode *image = (NarrowCode*)malloc(sizeof(NarrowCode));
+    if (make_narrow(w->code, image)) return image;
+    free(image);
+    return nullptr;
+}
+void *translated_engine(Workload *w) { return (void*)w->translated; }
+
+// Microseconds to get a fresh VM, write to its first cell and free it,
+// with copy_code() or with a fork of a snapshot. The days give their VMs
+// 200000 extra cells.
+const int fresh_vm_extra_memory = 200000;
+double fresh_vm_us(Code code, bool fork)
+{
+    CodeSnapshot snapshot = {};
+    if (fork) snapshot = snapshot_code(code);
+    const int n = 2000;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < n; i++)
+    {
+        Code vm = fork ? fork_code(snapshot) : copy_code(code);
+        vm[0] = i;
+        if (fork) free_fork(vm);
+        else free_code(vm);
+    }
+    double us = std::chrono::duration<double, std::micro>(
+        std::chrono::steady_clock::now() - start).count() / n;
+    if (fork) free_snapshot(snapshot);
+    return us;
+}
+
+// Beam probes of the 19 workload: inputs has an (x, y) pair per run and
+// results gets the output of each run.
+typedef void (*BeamRunner)(Code code, const IntWord *inputs, int run_num, IntWord *results);
+
+void beam_threaded(Code code, const IntWord *inputs, int run_num, IntWord *results)
+{
+    for (int run = 0; run < run_num; run++)
+    {
+        Code vm = copy_code(code);
+        Buffer input = {};
+        Buffer output = {};
+        State state = {};
+        state.input = &input;
+        state.output = &output;
+        write_n(&input, inputs + run * 2, 2);
+        execute_threaded(&state, vm);
+        results[run] = -1;
+        read(&output, &results[run]);
+        free_code(vm);
+        free_buffer(&input);
+        free_buffer(&output);
+    }
+}
+
+template <int Lanes>
+void beam_batch(Code code, const IntWord *inputs, int run_num, IntWord *results)
+{
+    run_batch<Lanes>(code, 100, inputs, 2, run_num, results);
+}
+
+void bench_batch()
+{
+    const int run_num = 2500;
+    Code code;
+    if (!load_code("../19/main.cpp", 100, &code)) return;
+    IntWord *inputs = (IntWord*)malloc(run_num * 2 * sizeof(IntWord));
+    for (int run = 0; run < run_num; run++)
+    {
+        inputs[run * 2] = run % 50;
+        inputs[run * 2 + 1] = run / 50;
+    }
+    IntWord *expected = (IntWord*)malloc(run_num * sizeof(IntWord));
+    IntWord *results = (IntWord*)malloc(run_num * sizeof(IntWord));
+
+    struct { const char *name; BeamRunner run; } runners[] = {
+        { "threaded", beam_threaded },
+        { "batch 4 lanes", beam_batch<4> },
+        { "batch 8 lanes", beam_batch<8> },
+        { "batch 16 lanes", beam_batch<16> },
+    };
+    printf("\nlockstep batch, 19 beam 50x50\n");
+    double base_ms = 0;
+    for (int r = 0; r < 4; r++)
+    {
+        runners[r].run(code, inputs, run_num, (r == 0) ? expected : results);
+        int iterations = 0;
+        double elapsed_ms = 0;
+        auto start = std::chrono::steady_clock::now();
+        while (elapsed_ms < 200.0)
+        {
+            runners[r].run(code, inputs, run_num, results);
+            iterations++;
+            elapsed_ms = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - start).count();
+        }
+        double ms = elapsed_ms / iterations;
+        if (r == 0) base_ms = ms;
+        if (memcmp(results, expected, run_num * sizeof(IntWord)) == 0)
+            printf("%-16s%14.3fms (%.2fx)\n", runners[r].name, ms, base_ms / ms);
+        else
+            printf("%-16s  WRONG OUTPUT\n", runners[r].name);
+    }
+    free(inputs);
+    free(expected);
+    free(results);
+    free_code(code);
+}
+
+// Runs the workload once, returns a checksum of all the outputs. Fused
+// pairs are counted to fused_counts when given.
+uint64_t run_workload(Workload *w, Engine *e, void *engine_data, int64_t *fused_counts = nullptr)
+{
+    uint64_t checksum = 0;
+    for (int run = 0; run < w->runs; run++)
+    {
+        Code code = copy_code(e->decode_cache ? w->decoded : w->code);
+
+        Buffer input = {};
+        Buffer output = {};
+        State state = {};
+        state.input = &input;
+        state.output = &output;
+        state.fused_counts = fused_counts;
+        w->feed(&input, run);
+
+        e->run(&state, code, engine_data);
+
+        IntWord out;
+        while (read(&output, &out)) checksum = checksum * 31 + (uint64_t)out;
+        free_code(code);
+        free_buffer(&input);
+        free_buffer(&output);
+    }
+    return checksum;
+}
+
+int main()
+{
+    const double min_time_ms = 200.0;
+
+    printf("%-16s", "workload");
+    for (int e = 0; e < engine_num; e++) printf("%20s", engines[e].name);
+    printf("\n");
+
+    for (int i = 0; i < workload_num; i++)
+    {
+        Workload *w = &workloads[i];
+        if (!load_code(w->source, 10000, &w->code))
+        {
+            printf("%-16s could not load %s\n", w->name, w->source);
+            continue;
+        }
+        w->decoded = copy_code(w->code);
+        enable_decode_cache(&w->decoded);
+
+        printf("%-16s", w->name);
+        uint64_t expected = 0;
+        double base_ms = 0;
+        for (int e = 0; e < engine_num; e++)
+        {
+            void *engine_data = engines[e].create ? engines[e].create(w) : nullptr;
+            narrow_promotions = 0;
+            int64_t fused[Fused_Max] = {};
+            uint64_t checksum = run_workload(w, &engines[e], engine_data, fused); // warm up
+            if (engines[e].decode_cache) memcpy(w->fused, fused, sizeof(w->fused));
+            if (engines[e].run == run_narrow) w->promotions = narrow_promotions;
+
+            int iterations = 0;
+            auto start = std::chrono::steady_clock::now();
+            double elapsed_ms = 0;
+            while (elapsed_ms < min_time_ms)
+            {
+                run_workload(w, &engines[e], engine_data);
+                iterations++;
+                elapsed_ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start).count();
+            }
+            double ms = elapsed_ms / iterations;
+            if (engines[e].destroy) engines[e].destroy(engine_data);
+
+            if (e == 0)
+            {
+                expected = checksum;
+                base_ms = ms;
+            }
+            char cell[32];
+            if (checksum != expected)
+                snprintf(cell, sizeof(cell), "WRONG OUTPUT");
+            else
+                snprintf(cell, sizeof(cell), "%.3fms (%.2fx)", ms, base_ms / ms);
+            printf("%20s", cell);
+            fflush(stdout);
+        }
+        printf("\n");
+        free_code(w->code);
+        free_code(w->decoded);
+
+        Code day_code;
+        load_code(w->source, fresh_vm_extra_memory, &day_code);
+        w->copy_us = fresh_vm_us(day_code, false);
+        w->fork_us = fresh_vm_us(day_code, true);
+        free_code(day_code);
+    }
+
+    printf("\nfused pairs per run (decoded)\n%-16s", "workload");
+    for (int f = 1; f < Fused_Max; f++) printf("%16s", Fused_names[f]);
+    printf("\n");
+    for (int i = 0; i < workload_num; i++)
+    {
+        printf("%-16s", workloads[i].name);
+        for (int f = 1; f < Fused_Max; f++) printf("%16" PRId64, workloads[i].fused[f]);
+        printf("\n");
+    }
+
+    printf("\nnarrow VMs promoted to 64 bits\n");
+    for (int i = 0; i < workload_num; i++)
+    {
+        printf("%-16s%8" PRId64 " of %d\n", workloads[i].name, workloads[i].promotions, workloads[i].runs);
+    }
+
+    printf("\nfresh VM (%d extra cells)\n%-16s%16s%16s\n", fresh_vm_extra_memory, "workload", "copy_code", "fork_code");
+    for (int i = 0; i < workload_num; i++)
+    {
+        printf("%-16s%14.2fus%14.2fus\n", workloads[i].name, workloads[i].copy_us, workloads[i].fork_us);
+    }
+
+    bench_batch();
+    return 0;
+}
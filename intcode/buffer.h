@@ -0,0 +1,267 @@
+#ifndef INTCODE_BUFFER_H
+#define INTCODE_BUFFER_H
+
+// Input/output channel of the Intcode VM.
+//
+// A ring of power of two capacity with free running read and write counters.
+// A zero initialized Buffer is ready to use: it starts in the small inline
+// array and grows on the heap when a write finds it full, so nothing written
+// is ever lost. Call free_buffer() once it has grown.
+//
+//     Buffer output = {};
+//     ...
+//     free_buffer(&output);
+//
+// Buffers shared between two threads (one writer, one reader) are set up
+// with init_buffer(). Those are lock-free and do not grow: a write to a full
+// shared buffer either blocks until the reader makes room (BUFFER_Blocking)
+// or fails and sets overflowed. With BUFFER_Blocking the reader can also
+// sleep in wait_readable() until something is written or the buffer is
+// closed. Sleeping is done with futexes on the counters.
+
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+typedef int64_t IntWord;
+
+#define BUFFER_INLINE 16
+
+enum BufferFlags
+{
+    BUFFER_Shared = 1,   // written and read from different threads, fixed capacity
+    BUFFER_Blocking = 2, // full writes and wait_readable() sleep
+};
+
+struct Buffer
+{
+    uint32_t write;    // next cell to write, & (capacity - 1) for the index
+    uint32_t read;     // next cell to read
+    uint32_t capacity; // 0 until the buffer has grown or been initialized
+    int flags;
+
+    uint32_t closed;
+    uint32_t reader_waiting;
+    uint32_t writer_waiting;
+    bool overflowed;
+
+    IntWord *data;
+    IntWord small[BUFFER_INLINE];
+};
+
+inline IntWord *buffer_cells(Buffer *buf)
+{
+    return buf->data ? buf->data : buf->small;
+}
+
+inline uint32_t buffer_capacity(const Buffer &buf)
+{
+    return buf.data ? buf.capacity : BUFFER_INLINE;
+}
+
+inline uint32_t round_up_pow2(uint32_t n)
+{
+    uint32_t result = 1;
+    while (result < n) result <<= 1;
+    return result;
+}
+
+// Sets up buf for the given flags with room for at least capacity words.
+inline void init_buffer(Buffer *buf, int capacity, int flags)
+{
+    *buf = { };
+    buf->flags = flags;
+    if ((uint32_t)capacity > BUFFER_INLINE)
+    {
+        buf->capacity = round_up_pow2(capacity);
+        buf->data = (IntWord*)malloc(buf->capacity * sizeof(IntWord));
+    }
+}
+
+inline void free_buffer(Buffer *buf)
+{
+    free(buf->data);
+    *buf = { };
+}
+
+inline int readable_num(const Buffer &buf)
+{
+    return __atomic_load_n(&buf.write, __ATOMIC_ACQUIRE) - __atomic_load_n(&buf.read, __ATOMIC_ACQUIRE);
+}
+
+inline void futex_wait(uint32_t *addr, uint32_t value)
+{
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, value, nullptr, nullptr, 0);
+}
+
+inline void futex_wake(uint32_t *addr)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+}
+
+// Wakes the other side if it is sleeping on counter. The fence pairs with
+// the one in buffer_sleep(), one of the two sides always sees the other.
+inline void buffer_wake(Buffer *buf, uint32_t *waiting, uint32_t *counter)
+{
+    if (!(buf->flags & BUFFER_Blocking)) return;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiting, __ATOMIC_RELAXED))
+    {
+        __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+        futex_wake(counter);
+    }
+}
+
+// Sleeps until counter no longer has the value seen.
+inline void buffer_sleep(Buffer *buf, uint32_t *waiting, uint32_t *counter, uint32_t seen)
+{
+    __atomic_store_n(waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(counter, __ATOMIC_RELAXED) == seen && !__atomic_load_n(&buf->closed, __ATOMIC_RELAXED))
+    {
+        futex_wait(counter, seen);
+    }
+}
+
+// Doubles the capacity of a buffer that is not shared, keeping the contents.
+inline void grow_buffer(Buffer *buf)
+{
+    uint32_t capacity = buffer_capacity(*buf);
+    uint32_t n = buf->write - buf->read;
+    IntWord *cells = buffer_cells(buf);
+    IntWord *data = (IntWord*)malloc(2 * capacity * sizeof(IntWord));
+    for (uint32_t i = 0; i < n; i++)
+    {
+        data[i] = cells[(buf->read + i) & (capacity - 1)];
+    }
+    free(buf->data);
+    buf->data = data;
+    buf->capacity = 2 * capacity;
+    buf->read = 0;
+    buf->write = n;
+}
+
+// Makes room for at least one word. Returns the number of free cells, 0 if
+// the buffer is full and cannot wait.
+inline uint32_t buffer_room(Buffer *buf)
+{
+    for (;;)
+    {
+        uint32_t capacity = buffer_capacity(*buf);
+        uint32_t read = __atomic_load_n(&buf->read, __ATOMIC_ACQUIRE);
+        uint32_t used = buf->write - read;
+        if (used < capacity) return capacity - used;
+
+        if (!(buf->flags & BUFFER_Shared))
+        {
+            grow_buffer(buf);
+        }
+        else if (__atomic_load_n(&buf->closed, __ATOMIC_ACQUIRE))
+        {
+            return 0;
+        }
+        else if (buf->flags & BUFFER_Blocking)
+        {
+            buffer_sleep(buf, &buf->writer_waiting, &buf->read, read);
+        }
+        else
+        {
+            if (!buf->overflowed) printf("BUG! buffer overflow (capacity %u)\n", capacity);
+            buf->overflowed = true;
+            return 0;
+        }
+    }
+}
+
+inline bool write(Buffer *buf, IntWord x)
+{
+    uint32_t capacity = buffer_capacity(*buf);
+    if (buf->write - __atomic_load_n(&buf->read, __ATOMIC_ACQUIRE) >= capacity)
+    {
+        if (buffer_room(buf) == 0) return false;
+        capacity = buffer_capacity(*buf);
+    }
+    buffer_cells(buf)[buf->write & (capacity - 1)] = x;
+    __atomic_store_n(&buf->write, buf->write + 1, __ATOMIC_RELEASE);
+    buffer_wake(buf, &buf->reader_waiting, &buf->write);
+    return true;
+}
+
+inline bool read(Buffer *buf, IntWord *x)
+{
+    uint32_t write = __atomic_load_n(&buf->write, __ATOMIC_ACQUIRE);
+    if (buf->read == write) return false;
+    *x = buffer_cells(buf)[buf->read & (buffer_capacity(*buf) - 1)];
+    __atomic_store_n(&buf->read, buf->read + 1, __ATOMIC_RELEASE);
+    buffer_wake(buf, &buf->writer_waiting, &buf->read);
+    return true;
+}
+
+// Writes n words, returns the number written. Less than n only when a
+// shared buffer without BUFFER_Blocking overflows or the buffer is closed.
+inline int write_n(Buffer *buf, const IntWord *x, int n)
+{
+    int written = 0;
+    while (written < n)
+    {
+        uint32_t room = buffer_room(buf);
+        if (room == 0) break;
+        uint32_t capacity = buffer_capacity(*buf);
+        IntWord *cells = buffer_cells(buf);
+        uint32_t count = ((uint32_t)(n - written) < room) ? n - written : room;
+        uint32_t start = buf->write & (capacity - 1);
+        uint32_t first = (count < capacity - start) ? count : capacity - start;
+        memcpy(cells + start, x + written, first * sizeof(IntWord));
+        memcpy(cells, x + written + first, (count - first) * sizeof(IntWord));
+        __atomic_store_n(&buf->write, buf->write + count, __ATOMIC_RELEASE);
+        buffer_wake(buf, &buf->reader_waiting, &buf->write);
+        written += count;
+    }
+    return written;
+}
+
+// Reads up to n words, returns the number read.
+inline int read_n(Buffer *buf, IntWord *x, int n)
+{
+    uint32_t available = __atomic_load_n(&buf->write, __ATOMIC_ACQUIRE) - buf->read;
+    uint32_t count = ((uint32_t)n < available) ? n : available;
+    if (count == 0) return 0;
+    uint32_t capacity = buffer_capacity(*buf);
+    IntWord *cells = buffer_cells(buf);
+    uint32_t start = buf->read & (capacity - 1);
+    uint32_t first = (count < capacity - start) ? count : capacity - start;
+    memcpy(x, cells + start, first * sizeof(IntWord));
+    memcpy(x + first, cells, (count - first) * sizeof(IntWord));
+    __atomic_store_n(&buf->read, buf->read + count, __ATOMIC_RELEASE);
+    buffer_wake(buf, &buf->writer_waiting, &buf->read);
+    return count;
+}
+
+// Blocks until there is something to read. Returns false when the buffer is
+// closed and empty. Needs BUFFER_Blocking, or nothing wakes the reader up.
+inline bool wait_readable(Buffer *buf)
+{
+    for (;;)
+    {
+        uint32_t write = __atomic_load_n(&buf->write, __ATOMIC_ACQUIRE);
+        if (write != buf->read) return true;
+        if (__atomic_load_n(&buf->closed, __ATOMIC_ACQUIRE)) return false;
+        buffer_sleep(buf, &buf->reader_waiting, &buf->write, write);
+    }
+}
+
+// Tells the reader nothing more will be written, and a blocked writer that
+// nothing more will be read.
+inline void close_buffer(Buffer *buf)
+{
+    __atomic_store_n(&buf->closed, 1, __ATOMIC_RELEASE);
+    futex_wake(&buf->write);
+    futex_wake(&buf->read);
+}
+
+#endif // INTCODE_BUFFER_H
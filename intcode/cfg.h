@@ -0,0 +1,280 @@
+#ifndef INTCODE_CFG_H
+#define INTCODE_CFG_H
+
+// Static control flow analysis of a program image, without running it:
+//
+//     Cfg *cfg = analyze_program(image, n);
+//     ... cfg->owner[pos], cfg->blocks, cfg->flags[addr] & CFG_Written ...
+//     free_cfg(cfg);
+//
+// The instructions are found from position 0 by following fall-through,
+// immediate jump targets and the constants computed by Add/Mul from two
+// immediates, which are the return addresses pushed before calls. Jumps
+// with a position or relative mode target (returns, mostly) are indirect
+// and may go to any of those.
+//
+// Cells written with a position mode destination are marked as written.
+// Writes relative to the relative base are not followed; they are counted
+// and assumed to go to the stack past the image. An instruction none of
+// whose cells is written is never modified by the program, so decoding or
+// compiling it ahead is safe as long as that assumption holds (the caches
+// still check every write).
+
+#include "intcode.h"
+
+enum CfgFlags
+{
+    CFG_Leader = 0x01,       // starts a basic block
+    CFG_JumpTarget = 0x02,   // of an immediate jump
+    CFG_ReturnTarget = 0x04, // a constant computed by Add/Mul, a possible indirect jump target
+    CFG_Written = 0x08,      // written by a position mode destination
+    CFG_Read = 0x10,         // read by a position mode operand
+};
+
+struct CfgBlock
+{
+    int start;
+    int end; // one past the last cell of the last instruction
+    int instr_num;
+    int next[2]; // positions control may continue at, -1 if none
+    bool indirect; // ends with an indirect jump
+    bool halts;
+};
+
+struct Cfg
+{
+    int n;
+    int *owner;     // start of the instruction containing each cell, -1 if none
+    uint8_t *flags; // CfgFlags of each cell
+    int instr_num;
+
+    CfgBlock *blocks; // in the order of their positions
+    int block_num;
+
+    int *indirect; // positions of the indirect jumps
+    int indirect_num;
+    int relative_writes; // instructions writing relative to the relative base
+};
+
+// Returns whether instr can be run, with modes an instruction can have.
+inline bool cfg_valid_instr(IntWord instr)
+{
+    if (instr < 0 || instr > 22299) return false;
+    int m1, m2, m3;
+    Opcode op = decode_instr(instr, &m1, &m2, &m3);
+    switch (op)
+    {
+        case OP_Add: case OP_Mul: case OP_Lt: case OP_Equ:
+            return m1 <= 2 && m2 <= 2 && (m3 == 0 || m3 == 2);
+        case OP_Inp:
+            return m1 == 0 || m1 == 2;
+        case OP_Out: case OP_ModRel:
+            return m1 <= 2;
+        case OP_Jnz: case OP_Jz:
+            return m1 <= 2 && m2 <= 2;
+        case OP_Halt:
+            return true;
+        default:
+            return false;
+    }
+}
+
+inline void cfg_add_target(const Cfg *cfg, int *work, int *work_num, IntWord pos)
+{
+    if (pos < 0 || pos >= cfg->n || cfg->owner[pos] >= 0) return;
+    work[(*work_num)++] = (int)pos;
+}
+
+// Fills owner with the instructions reachable from position 0. An
+// instruction overlapping one found earlier is left out, the interpreter
+// runs it if it is ever reached.
+inline void cfg_find_instructions(Cfg *cfg, const IntWord *image)
+{
+    int n = cfg->n;
+    int *work = (int*)malloc(n * 4 * sizeof(int));
+    int work_num = 0;
+    cfg_add_target(cfg, work, &work_num, 0);
+    while (work_num > 0)
+    {
+        int pos = work[--work_num];
+        if (cfg->owner[pos] >= 0) continue;
+
+        IntWord instr = image[pos];
+        if (!cfg_valid_instr(instr)) continue;
+        int m1, m2, m3;
+        Opcode op = decode_instr(instr, &m1, &m2, &m3);
+        int len = instr_length(op);
+        if (pos + len > n) continue;
+        bool overlaps = false;
+        for (int i = pos; i < pos + len; i++)
+        {
+            if (cfg->owner[i] >= 0) overlaps = true;
+        }
+        if (overlaps) continue;
+
+        for (int i = pos; i < pos + len; i++) cfg->owner[i] = pos;
+        cfg->instr_num++;
+
+        IntWord a1 = (len > 1) ? image[pos+1] : 0;
+        IntWord a2 = (len > 2) ? image[pos+2] : 0;
+        switch (op)
+        {
+        case OP_Halt:
+            break;
+        case OP_Jnz:
+        case OP_Jz:
+            if (m2 == 1) cfg_add_target(cfg, work, &work_num, a2);
+            if (m1 != 1 || (op == OP_Jnz) == (a1 == 0)) cfg_add_target(cfg, work, &work_num, pos + len);
+            break;
+        case OP_Add:
+        case OP_Mul:
+            if (m1 == 1 && m2 == 1) cfg_add_target(cfg, work, &work_num, (op == OP_Add) ? a1 + a2 : a1 * a2);
+            cfg_add_target(cfg, work, &work_num, pos + len);
+            break;
+        default:
+            cfg_add_target(cfg, work, &work_num, pos + len);
+            break;
+        }
+    }
+    free(work);
+}
+
+inline void cfg_mark(Cfg *cfg, IntWord addr, int flag)
+{
+    if (addr >= 0 && addr < cfg->n) cfg->flags[addr] |= flag;
+}
+
+// Marks the targets, the cells read and written and the block leaders of
+// the instructions found.
+inline void cfg_mark_instructions(Cfg *cfg, const IntWord *image)
+{
+    int n = cfg->n;
+    cfg->indirect = (int*)malloc((cfg->instr_num + 1) * sizeof(int));
+    cfg_mark(cfg, 0, CFG_Leader);
+    for (int pos = 0; pos < n; pos++)
+    {
+        if (cfg->owner[pos] != pos) continue;
+        int m1, m2, m3;
+        Opcode op = decode_instr(image[pos], &m1, &m2, &m3);
+        int len = instr_length(op);
+        IntWord a1 = (len > 1) ? image[pos+1] : 0;
+        IntWord a2 = (len > 2) ? image[pos+2] : 0;
+        IntWord a3 = (len > 3) ? image[pos+3] : 0;
+
+        if (len > 1 && m1 == 0 && op != OP_Inp) cfg_mark(cfg, a1, CFG_Read);
+        if (len > 2 && m2 == 0) cfg_mark(cfg, a2, CFG_Read);
+        switch (op)
+        {
+        case OP_Add:
+        case OP_Mul:
+        case OP_Lt:
+        case OP_Equ:
+            if (m3 == 0) cfg_mark(cfg, a3, CFG_Written);
+            else cfg->relative_writes++;
+            if ((op == OP_Add || op == OP_Mul) && m1 == 1 && m2 == 1)
+            {
+                cfg_mark(cfg, (op == OP_Add) ? a1 + a2 : a1 * a2, CFG_ReturnTarget | CFG_Leader);
+            }
+            break;
+        case OP_Inp:
+            if (m1 == 0) cfg_mark(cfg, a1, CFG_Written);
+            else cfg->relative_writes++;
+            break;
+        case OP_Jnz:
+        case OP_Jz:
+            if (m1 == 1 && (op == OP_Jnz) == (a1 == 0)) break; // never taken
+            if (m2 == 1) cfg_mark(cfg, a2, CFG_JumpTarget | CFG_Leader);
+            else cfg->indirect[cfg->indirect_num++] = pos;
+            cfg_mark(cfg, pos + len, CFG_Leader);
+            break;
+        case OP_Halt:
+            cfg_mark(cfg, pos + len, CFG_Leader);
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+// Splits the instructions into basic blocks: a block starts at a leader or
+// after a gap and ends before the next leader or after a jump or halt.
+inline void cfg_find_blocks(Cfg *cfg, const IntWord *image)
+{
+    int n = cfg->n;
+    cfg->blocks = (CfgBlock*)malloc((cfg->instr_num + 1) * sizeof(CfgBlock));
+    CfgBlock *b = nullptr;
+    for (int pos = 0; pos < n; pos++)
+    {
+        if (cfg->owner[pos] != pos) continue;
+        if (!b || b->end != pos || (cfg->flags[pos] & CFG_Leader))
+        {
+            cfg->flags[pos] |= CFG_Leader;
+            b = &cfg->blocks[cfg->block_num++];
+            *b = { };
+            b->start = pos;
+            b->next[0] = b->next[1] = -1;
+        }
+
+        int m1, m2, m3;
+        Opcode op = decode_instr(image[pos], &m1, &m2, &m3);
+        int len = instr_length(op);
+        b->end = pos + len;
+        b->instr_num++;
+        b->next[0] = pos + len;
+        b->next[1] = -1;
+
+        IntWord a1 = (len > 1) ? image[pos+1] : 0;
+        IntWord a2 = (len > 2) ? image[pos+2] : 0;
+        if (op == OP_Jnz || op == OP_Jz)
+        {
+            bool always = (m1 == 1) && ((op == OP_Jnz) == (a1 != 0));
+            bool never = (m1 == 1) && !always;
+            if (always) b->next[0] = -1;
+            if (never) continue;
+            if (m2 == 1) b->next[1] = (int)a2;
+            else b->indirect = true;
+            b = nullptr;
+        }
+        else if (op == OP_Halt)
+        {
+            b->next[0] = -1;
+            b->halts = true;
+            b = nullptr;
+        }
+    }
+}
+
+inline Cfg *analyze_program(const IntWord *image, int n)
+{
+    Cfg *cfg = (Cfg*)calloc(1, sizeof(Cfg));
+    cfg->n = n;
+    cfg->owner = (int*)malloc(n * sizeof(int));
+    cfg->flags = (uint8_t*)calloc(n, 1);
+    for (int i = 0; i < n; i++) cfg->owner[i] = -1;
+    cfg_find_instructions(cfg, image);
+    cfg_mark_instructions(cfg, image);
+    cfg_find_blocks(cfg, image);
+    return cfg;
+}
+
+inline void free_cfg(Cfg *cfg)
+{
+    free(cfg->owner);
+    free(cfg->flags);
+    free(cfg->blocks);
+    free(cfg->indirect);
+    free(cfg);
+}
+
+// Returns whether no cell of the instruction starting at pos is written by
+// a position mode destination.
+inline bool cfg_never_written(const Cfg *cfg, int pos)
+{
+    for (int i = pos; i < cfg->n && cfg->owner[i] == pos; i++)
+    {
+        if (cfg->flags[i] & CFG_Written) return false;
+    }
+    return true;
+}
+
+#endif // INTCODE_CFG_H
@@ -0,0 +1,186 @@
+#ifndef INTCODE_CORO_H
+#define INTCODE_CORO_H
+
+// Coroutine front end for running many VMs on one thread. Needs -std=c++20.
+//
+// A Vm is a program with its own input and output buffers. The VMs are run
+// by a Scheduler, each one until it blocks on input or halts. The code
+// driving them is written as coroutines (VmTask) that wait on a VM:
+//
+//     VmTask print_all(Vm *vm)
+//     {
+//         IntWord x;
+//         while (co_await vm->output(&x)) printf("%" PRId64 "\n", x);
+//     }
+//
+//     Scheduler scheduler = {};
+//     Vm vm;
+//     init_vm(&vm, &scheduler, code);
+//     VmTask task = print_all(&vm);
+//     run(&scheduler);
+//
+// A task is only suspended when the VM has nothing for it, and switching
+// between VMs and tasks does not allocate. connect() feeds the output of a
+// VM straight into the input of another, so a chain of VMs only needs a task
+// at its ends.
+
+#include <coroutine>
+
+#include "intcode.h"
+
+struct Scheduler;
+struct OutputAwaiter;
+struct InputAwaiter;
+
+struct Vm
+{
+    State state;
+    Code code;
+    Buffer in;
+    Buffer out;
+
+    Scheduler *scheduler;
+    Vm *feeds;                      // gets the outputs of this VM, see connect()
+    bool fed;                       // input comes from another VM
+    std::coroutine_handle<> waiter; // task waiting for this VM
+
+    bool queued;
+    Vm *next_runnable;
+
+    OutputAwaiter output(IntWord *x);
+    InputAwaiter input(IntWord x);
+};
+
+// Run queue of the VMs that have something to do.
+struct Scheduler
+{
+    Vm *first;
+    Vm *last;
+};
+
+inline void make_runnable(Vm *vm)
+{
+    if (vm->queued || vm->state.halted) return;
+    Scheduler *s = vm->scheduler;
+    vm->queued = true;
+    vm->next_runnable = nullptr;
+    if (s->last) s->last->next_runnable = vm;
+    else s->first = vm;
+    s->last = vm;
+}
+
+// Sets up vm to run code (not copied) and queues it.
+inline void init_vm(Vm *vm, Scheduler *scheduler, Code code)
+{
+    *vm = { };
+    vm->code = code;
+    vm->scheduler = scheduler;
+    vm->state.input = &vm->in;
+    vm->state.output = &vm->out;
+    make_runnable(vm);
+}
+
+inline void free_vm(Vm *vm)
+{
+    free_buffer(&vm->in);
+    free_buffer(&vm->out);
+}
+
+// Outputs of from go to the input of to.
+inline void connect(Vm *from, Vm *to)
+{
+    from->feeds = to;
+    from->state.output = &to->in;
+    to->fed = true;
+}
+
+// Runs the queued VMs until none of them can make progress. A profiling
+// policy (see execute_threaded()) gets the instructions of all of them.
+template <typename Profile = NoProfile>
+inline void run(Scheduler *s, Profile *prof = nullptr)
+{
+    while (s->first)
+    {
+        Vm *vm = s->first;
+        s->first = vm->next_runnable;
+        if (!s->first) s->last = nullptr;
+        vm->queued = false;
+
+        execute_threaded(&vm->state, vm->code, false, prof);
+
+        if (vm->feeds && readable_num(vm->feeds->in) > 0) make_runnable(vm->feeds);
+        // A VM fed by another one just waits for it, there is nothing for
+        // the task to do until it has output or halts.
+        bool stopped = vm->state.halted || !vm->fed;
+        if (vm->waiter && (readable_num(vm->out) > 0 || stopped))
+        {
+            std::coroutine_handle<> waiter = vm->waiter;
+            vm->waiter = nullptr;
+            waiter.resume();
+        }
+    }
+}
+
+// co_await vm->output(&x): the next output of the VM. False when the VM has
+// halted or waits for input from the task.
+struct OutputAwaiter
+{
+    Vm *vm;
+    IntWord *x;
+
+    bool await_ready() { return readable_num(vm->out) > 0 || vm->state.halted; }
+    void await_suspend(std::coroutine_handle<> h)
+    {
+        vm->waiter = h;
+        make_runnable(vm);
+    }
+    bool await_resume() { return read(&vm->out, x); }
+};
+
+// co_await vm->input(x): gives x to the VM. Never suspends, the VM runs
+// the next time the task waits.
+struct InputAwaiter
+{
+    Vm *vm;
+    IntWord x;
+
+    bool await_ready() { return true; }
+    void await_suspend(std::coroutine_handle<>) { }
+    void await_resume()
+    {
+        write(&vm->in, x);
+        make_runnable(vm);
+    }
+};
+
+inline OutputAwaiter Vm::output(IntWord *x) { return { this, x }; }
+inline InputAwaiter Vm::input(IntWord x) { return { this, x }; }
+
+// Coroutine driving VMs. Starts running when it is created, free it with
+// free_task() once the scheduler is done.
+struct VmTask
+{
+    struct promise_type
+    {
+        VmTask get_return_object() { return { std::coroutine_handle<promise_type>::from_promise(*this) }; }
+        std::suspend_never initial_suspend() { return { }; }
+        std::suspend_always final_suspend() noexcept { return { }; }
+        void return_void() { }
+        void unhandled_exception() { abort(); }
+    };
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+inline bool task_done(const VmTask &task)
+{
+    return task.handle.done();
+}
+
+inline void free_task(VmTask &task)
+{
+    if (task.handle) task.handle.destroy();
+    task = { };
+}
+
+#endif // INTCODE_CORO_H
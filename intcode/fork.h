@@ -0,0 +1,148 @@
+#ifndef INTCODE_FORK_H
+#define INTCODE_FORK_H
+
+// Copy-on-write forks of a program's memory.
+//
+// A snapshot keeps the memory of a Code in a memfd. Forks map it privately,
+// so all of them share the pages of the snapshot and the kernel copies a
+// page (4 KB, 512 cells) the first time a fork writes to it. Creating a
+// fork is an mmap instead of allocating and copying the whole memory.
+//
+//     CodeSnapshot snapshot = snapshot_code(code);
+//     Code fork = fork_code(snapshot);
+//     ...
+//     free_fork(fork);
+//     free_snapshot(snapshot);
+//
+// Forks get a copy of the decode cache of the snapshot's code, when it has
+// one. Memory past memory_size (see PagedMemory) is small and copied for
+// each fork.
+//
+// The snapshot also keeps a plain copy of the memory. When the memfd cannot
+// be made or mapped, forks are made by copying that instead, like
+// copy_code(). free_fork() frees both kinds.
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "intcode.h"
+
+#define FORK_PAGE_SIZE 4096
+
+struct CodeSnapshot
+{
+    int fd;        // -1 when forks are plain copies
+    IntWord *data; // memory_size cells
+    int code_size;
+    int memory_size;
+    PagedMemory *pages;
+    DecodedInstr *decoded; // code_size entries, or null
+};
+
+inline size_t fork_mapping_size(int memory_size)
+{
+    size_t bytes = memory_size * sizeof(IntWord);
+    return (bytes + FORK_PAGE_SIZE - 1) & ~(size_t)(FORK_PAGE_SIZE - 1);
+}
+
+// Writes the memory of code to a memfd of the mapping size. Returns -1 on
+// failure.
+inline int write_snapshot_fd(Code code)
+{
+    int fd = memfd_create("intcode", MFD_CLOEXEC);
+    if (fd < 0) return -1;
+    if (ftruncate(fd, fork_mapping_size(code.memory_size)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    // The file reads as zeros, so only the pages with something in them
+    // are written. Usually that is just the program image.
+    const int page_cells = FORK_PAGE_SIZE / sizeof(IntWord);
+    for (int page = 0; page < code.memory_size; page += page_cells)
+    {
+        int n = (page + page_cells <= code.memory_size) ? page_cells : code.memory_size - page;
+        bool zero = true;
+        for (int i = page; i < page + n; i++)
+        {
+            if (code.data[i] != 0) zero = false;
+        }
+        if (zero) continue;
+        ssize_t written = pwrite(fd, code.data + page, n * sizeof(IntWord), page * sizeof(IntWord));
+        if (written != (ssize_t)(n * sizeof(IntWord)))
+        {
+            close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+inline CodeSnapshot snapshot_code(Code code)
+{
+    CodeSnapshot snapshot = {};
+    snapshot.code_size = code.code_size;
+    snapshot.memory_size = code.memory_size;
+    snapshot.fd = write_snapshot_fd(code);
+    snapshot.data = (IntWord*)malloc(code.memory_size * sizeof(IntWord));
+    memcpy(snapshot.data, code.data, code.memory_size * sizeof(IntWord));
+    snapshot.pages = copy_paged_memory(code.pages);
+    if (code.decoded)
+    {
+        snapshot.decoded = (DecodedInstr*)malloc(code.code_size * sizeof(DecodedInstr));
+        memcpy(snapshot.decoded, code.decoded, code.code_size * sizeof(DecodedInstr));
+    }
+    return snapshot;
+}
+
+inline Code fork_code(const CodeSnapshot &snapshot)
+{
+    Code code = {};
+    code.code_size = snapshot.code_size;
+    code.memory_size = snapshot.memory_size;
+    code.pages = copy_paged_memory(snapshot.pages);
+
+    void *data = MAP_FAILED;
+    if (snapshot.fd >= 0)
+    {
+        data = mmap(nullptr, fork_mapping_size(snapshot.memory_size), PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE, snapshot.fd, 0);
+    }
+    if (data != MAP_FAILED)
+    {
+        code.data = (IntWord*)data;
+        code.forked = true;
+    }
+    else
+    {
+        code.data = (IntWord*)malloc(snapshot.memory_size * sizeof(IntWord));
+        memcpy(code.data, snapshot.data, snapshot.memory_size * sizeof(IntWord));
+    }
+    if (snapshot.decoded)
+    {
+        code.decoded = (DecodedInstr*)malloc(snapshot.code_size * sizeof(DecodedInstr));
+        memcpy(code.decoded, snapshot.decoded, snapshot.code_size * sizeof(DecodedInstr));
+    }
+    return code;
+}
+
+inline void free_fork(Code &code)
+{
+    if (code.forked) munmap(code.data, fork_mapping_size(code.memory_size));
+    else free(code.data);
+    free(code.decoded);
+    free_paged_memory(code.pages);
+    code = { };
+}
+
+inline void free_snapshot(CodeSnapshot &snapshot)
+{
+    if (snapshot.fd >= 0) close(snapshot.fd);
+    free(snapshot.data);
+    free(snapshot.decoded);
+    free_paged_memory(snapshot.pages);
+    snapshot = { };
+}
+
+#endif // INTCODE_FORK_H
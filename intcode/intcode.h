@@ -0,0 +1,1293 @@
+#ifndef INTCODE_H
+#define INTCODE_H
+
+// Intcode engine shared by all the Intcode days (05, 07, 09, 11, 13, 15, 17,
+// 19 and 21). Header only, include it with
+//
+//     #include "../intcode/intcode.h"
+//
+
+#include <cstdio>
+#include <cstdint>
+#include <cinttypes>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+
+typedef int64_t IntWord;
+
+#include "buffer.h"
+
+#define OPCODES \
+    OPCODE(Add, 1)\
+    OPCODE(Mul, 2)\
+    OPCODE(Inp, 3)\
+    OPCODE(Out, 4)\
+    OPCODE(Jnz, 5)\
+    OPCODE(Jz, 6)\
+    OPCODE(Lt, 7)\
+    OPCODE(Equ, 8)\
+    OPCODE(ModRel, 9)\
+    OPCODE(Halt, 99)
+
+#define OPCODE(op, x) OP_ ## op = x,
+enum Opcode
+{
+    OPCODES
+
+    Opcode_Max
+};
+#undef OPCODE
+
+static const char* Opcode_names[Opcode_Max] = { };
+#define OPCODE(op, x) Opcode_names[x] = #op;
+inline bool init_opcode_names()
+{
+    OPCODES
+    return true;
+}
+#undef OPCODE
+static bool init = init_opcode_names();
+
+struct State
+{
+    int position;
+    int relative_base;
+    bool halted;
+
+    Buffer *input;
+    Buffer *output;
+
+    // When set, step_fused() counts the fused pairs it runs here, by Fused.
+    // Each VM has its own, so VMs on different threads do not share them.
+    int64_t *fused_counts;
+};
+
+// Instruction pairs the decode cache runs as one instruction, see fuse_at().
+enum Fused
+{
+    FUSED_None,
+    FUSED_CmpJump, // 1008 a,b,x  1005 x,target
+    FUSED_Call,    // 21101 ret,0,0  1106 0,target
+    FUSED_Return,  // 109 n  2106 0,0
+    Fused_Max
+};
+static const char *Fused_names[Fused_Max] = { "none", "compare+jump", "call", "return" };
+
+struct Code;
+
+// Executes the instruction at pos with its raw operand cells in args[0..2],
+// same result as step(). See instr_handler().
+typedef int (*InstrHandler)(State *s, Code code, int pos, const IntWord *args);
+
+// Pre-decoded form of the instruction starting at some address. See
+// enable_decode_cache().
+struct DecodedInstr
+{
+    uint8_t op;         // 0 when the address has not been decoded
+    uint8_t m1, m2, m3;
+    uint8_t fused;      // Fused, the jump below follows the instruction
+    uint8_t jump_op;
+    uint8_t jump_mode;
+    IntWord a1, a2, a3; // raw operand cells, in this order (passed as args to handler)
+    IntWord jump_target;
+    InstrHandler handler;
+};
+
+// Memory past the end of Code::data. A two-level page table of zero
+// initialized pages, allocated on the first write to them. Reads of cells
+// that were never written return 0 without allocating.
+#define PAGE_BITS 9 // 512 cells, 4 KB
+#define PAGE_CELLS (1 << PAGE_BITS)
+#define PAGE_TABLE_BITS 9
+#define PAGE_TABLE_SIZE (1 << PAGE_TABLE_BITS)
+// Addresses past this (or negative) are bugs in the program.
+#define MAX_ADDRESS ((IntWord)1 << 40)
+
+struct PagedMemory
+{
+    IntWord ***tables;   // tables[t][p] is the page of address (t << 18) | (p << 9)
+    int64_t table_num;
+    int64_t pages_allocated;
+};
+
+inline PagedMemory *make_paged_memory()
+{
+    return (PagedMemory*)calloc(1, sizeof(PagedMemory));
+}
+
+inline void free_paged_memory(PagedMemory *m)
+{
+    if (!m) return;
+    for (int64_t t = 0; t < m->table_num; t++)
+    {
+        if (!m->tables[t]) continue;
+        for (int p = 0; p < PAGE_TABLE_SIZE; p++) free(m->tables[t][p]);
+        free(m->tables[t]);
+    }
+    free(m->tables);
+    free(m);
+}
+
+inline PagedMemory *copy_paged_memory(const PagedMemory *m)
+{
+    PagedMemory *result = make_paged_memory();
+    if (!m || m->table_num == 0) return result;
+    result->table_num = m->table_num;
+    result->tables = (IntWord***)calloc(m->table_num, sizeof(IntWord**));
+    for (int64_t t = 0; t < m->table_num; t++)
+    {
+        if (!m->tables[t]) continue;
+        result->tables[t] = (IntWord**)calloc(PAGE_TABLE_SIZE, sizeof(IntWord*));
+        for (int p = 0; p < PAGE_TABLE_SIZE; p++)
+        {
+            if (!m->tables[t][p]) continue;
+            result->tables[t][p] = (IntWord*)malloc(PAGE_CELLS * sizeof(IntWord));
+            memcpy(result->tables[t][p], m->tables[t][p], PAGE_CELLS * sizeof(IntWord));
+            result->pages_allocated++;
+        }
+    }
+    return result;
+}
+
+inline IntWord paged_load(const PagedMemory *m, IntWord addr)
+{
+    if (addr < 0 || addr >= MAX_ADDRESS) return 0;
+    int64_t t = addr >> (PAGE_BITS + PAGE_TABLE_BITS);
+    int p = (addr >> PAGE_BITS) & (PAGE_TABLE_SIZE - 1);
+    if (t >= m->table_num || !m->tables[t] || !m->tables[t][p]) return 0;
+    return m->tables[t][p][addr & (PAGE_CELLS - 1)];
+}
+
+inline IntWord& paged_ref(PagedMemory *m, IntWord addr)
+{
+    if (addr < 0 || addr >= MAX_ADDRESS)
+    {
+        printf("BUG! address %" PRId64 " out of range\n", addr);
+        static IntWord ignored;
+        ignored = 0;
+        return ignored;
+    }
+    int64_t t = addr >> (PAGE_BITS + PAGE_TABLE_BITS);
+    int p = (addr >> PAGE_BITS) & (PAGE_TABLE_SIZE - 1);
+    if (t >= m->table_num)
+    {
+        int64_t table_num = t + 1;
+        m->tables = (IntWord***)realloc(m->tables, table_num * sizeof(IntWord**));
+        memset(m->tables + m->table_num, 0, (table_num - m->table_num) * sizeof(IntWord**));
+        m->table_num = table_num;
+    }
+    if (!m->tables[t])
+    {
+        m->tables[t] = (IntWord**)calloc(PAGE_TABLE_SIZE, sizeof(IntWord*));
+    }
+    if (!m->tables[t][p])
+    {
+        m->tables[t][p] = (IntWord*)calloc(PAGE_CELLS, sizeof(IntWord));
+        m->pages_allocated++;
+    }
+    return m->tables[t][p][addr & (PAGE_CELLS - 1)];
+}
+
+struct Code
+{
+    IntWord *data;
+    int code_size;
+    int memory_size; // code_size + extra memory
+
+    DecodedInstr *decoded; // code_size entries, or null when not cached
+    bool forked;           // data is a copy-on-write mapping, see fork.h
+    PagedMemory *pages;    // cells from memory_size on
+
+    // Cells below memory_size are read and written directly, anything else
+    // goes to the pages. The non-const version allocates the page, the VM
+    // reads memory with load().
+    IntWord operator[](IntWord pos) const
+    {
+        if ((uint64_t)pos < (uint64_t)memory_size) return data[pos];
+        return paged_load(pages, pos);
+    }
+    IntWord& operator[](IntWord pos)
+    {
+        if ((uint64_t)pos < (uint64_t)memory_size) return data[pos];
+        return paged_ref(pages, pos);
+    }
+};
+
+inline IntWord load(const Code &code, IntWord addr)
+{
+    return code[addr];
+}
+
+inline Code make_code(const IntWord *c, int n, int extra_memory)
+{
+    IntWord *data = (IntWord*)calloc((n + extra_memory), sizeof(IntWord));
+    memcpy(data, c, sizeof(IntWord) * n);
+    return { .data = data, .code_size = n, .memory_size = n + extra_memory,
+             .decoded = nullptr, .forked = false, .pages = make_paged_memory() };
+}
+
+template <int N>
+Code to_code(IntWord (&c)[N], int extra_memory = 0)
+{
+    return make_code(c, N, extra_memory);
+};
+
+inline void reset_extra_memory(Code &c)
+{
+    int extra_memory = c.memory_size - c.code_size;
+    memset(c.data + c.code_size, 0, extra_memory * sizeof(IntWord));
+    free_paged_memory(c.pages);
+    c.pages = make_paged_memory();
+}
+
+inline Code copy_code(Code &c)
+{
+    IntWord *data = (IntWord*)calloc(c.memory_size, sizeof(IntWord));
+    memcpy(data, c.data, sizeof(IntWord) * c.code_size);
+    Code result = { .data = data, .code_size = c.code_size, .memory_size = c.memory_size,
+                    .decoded = nullptr, .forked = false, .pages = make_paged_memory() };
+    if (c.decoded)
+    {
+        // The copy starts with the same code, so the decoded instructions
+        // are valid for it as well.
+        result.decoded = (DecodedInstr*)malloc(sizeof(DecodedInstr) * c.code_size);
+        memcpy(result.decoded, c.decoded, sizeof(DecodedInstr) * c.code_size);
+    }
+    return result;
+}
+
+inline void free_code(Code &c)
+{
+    assert(!c.forked && "forks are freed with free_fork()");
+    free(c.data);
+    free(c.decoded);
+    free_paged_memory(c.pages);
+    c = { };
+}
+
+inline void invalidate_decoded(Code code, IntWord addr)
+{
+    // An instruction is at most 4 cells long, so only the instructions
+    // starting at addr-3..addr can contain addr. A fused pair adds a
+    // 3-cell jump, so pairs starting at addr-6..addr-4 can contain it too.
+    IntWord first = (addr >= 6) ? addr - 6 : 0;
+    for (IntWord i = first; i <= addr; i++)
+    {
+        if (i >= addr - 3 || code.decoded[i].fused) code.decoded[i].op = 0;
+    }
+}
+
+// All writes of the VM go through store(). Writes made directly with
+// code[pos] do not invalidate the decode cache, so a code that has one
+// (enable_decode_cache() fills it right away) must be written with store().
+inline void store(Code code, IntWord addr, IntWord value)
+{
+    code[addr] = value;
+    if (code.decoded && addr < code.code_size)
+    {
+        invalidate_decoded(code, addr);
+    }
+}
+
+inline void print_code(Code code)
+{
+    if (code.code_size > 0)
+    {
+        printf("%" PRId64, load(code, 0));
+        for (int i = 1; i < code.code_size; i++) printf(",%" PRId64, load(code, i));
+        printf("\n");
+    }
+}
+
+inline Opcode decode_instr(IntWord instr, int *m1, int *m2, int *m3)
+{
+    int op = instr % 100;
+    *m1 = (instr / 100) % 10;
+    *m2 = (instr / 1000) % 10;
+    *m3 = (instr / 10000) % 10;
+    return (Opcode)op;
+}
+
+inline IntWord read(State *s, Code code, int pos, int mode)
+{
+    IntWord a = load(code, pos);
+    IntWord result = 0;
+    switch (mode)
+    {
+        case 0: result = load(code, a); break;
+        case 1: result = a; break;
+        case 2: result = load(code, s->relative_base + a); break;
+        default:
+            assert("invalid address mode" && 0);
+    }
+    return result;
+}
+
+inline IntWord read_pos(State *s, Code code, int pos, int mode)
+{
+    IntWord a = load(code, pos);
+    IntWord result = 0;
+    switch (mode)
+    {
+        case 0: result = a; break;
+        case 2: result = s->relative_base + a; break;
+        default:
+            assert("invalid address mode" && 0);
+    }
+    return result;
+}
+
+// Executes a single instruction.
+// Returns 1 when the instruction was executed, 0 when the program is waiting
+// for input (the position is left at the input instruction) and -1 when the
+// program has halted.
+inline int step(State *s, Code code)
+{
+    int pos = s->position;
+    IntWord instr = load(code, pos);
+    int m1, m2, m3;
+    Opcode op = decode_instr(instr, &m1, &m2, &m3);
+    //printf("%d: (%d) %s[%d, %d, %d]\n", pos, op, Opcode_names[op], m1, m2, m3);
+    switch (op)
+    {
+    case OP_Add:
+        {
+            IntWord oper1 = read(s, code, pos+1, m1);
+            IntWord oper2 = read(s, code, pos+2, m2);
+            IntWord res_pos = read_pos(s, code, pos+3, m3);
+            //printf(" [%" PRId64 "] <- %" PRId64 " + %" PRId64 "\n", res_pos, oper1, oper2);
+            store(code, res_pos, oper1 + oper2);
+            pos += 4;
+        } break;
+    case OP_Mul:
+        {
+            IntWord oper1 = read(s, code, pos+1, m1);
+            IntWord oper2 = read(s, code, pos+2, m2);
+            IntWord res_pos = read_pos(s, code, pos+3, m3);
+            //printf(" [%" PRId64 "] <- %" PRId64 " * %" PRId64 "\n", res_pos, oper1, oper2);
+            store(code, res_pos, oper1 * oper2);
+            pos += 4;
+        } break;
+    case OP_Inp:
+        {
+            IntWord res;
+            if (!read(s->input, &res))
+            {
+                //printf("Waiting input...\n");
+                return 0;
+            }
+            IntWord res_pos = read_pos(s, code, pos+1, m1);
+            //printf(" [%" PRId64 "] <- inp=%" PRId64 "\n", res_pos, res);
+            store(code, res_pos, res);
+            pos += 2;
+        } break;
+    case OP_Out:
+        {
+            IntWord out = read(s, code, pos+1, m1);
+            write(s->output, out);
+            //printf("out=%" PRId64 "\n", out);
+            pos += 2;
+        } break;
+    case OP_Jnz:
+        {
+            IntWord oper1 = read(s, code, pos+1, m1);
+            IntWord oper2 = read(s, code, pos+2, m2);
+            //printf(" %" PRId64 " != 0 => pos=%" PRId64 "\n", oper1, oper2);
+            if (oper1 != 0)
+            {
+                pos = oper2;
+            }
+            else
+            {
+                pos += 3;
+            }
+        } break;
+    case OP_Jz:
+        {
+            IntWord oper1 = read(s, code, pos+1, m1);
+            IntWord oper2 = read(s, code, pos+2, m2);
+            //printf(" %" PRId64 " == 0 => pos=%" PRId64 "\n", oper1, oper2);
+            if (oper1 == 0)
+            {
+                pos = oper2;
+            }
+            else
+            {
+                pos += 3;
+            }
+        } break;
+    case OP_Lt:
+        {
+            IntWord oper1 = read(s, code, pos+1, m1);
+            IntWord oper2 = read(s, code, pos+2, m2);
+            IntWord res_pos = read_pos(s, code, pos+3, m3);
+            //printf(" [%" PRId64 "] <- %" PRId64 " < %" PRId64 "\n", res_pos, oper1, oper2);
+            store(code, res_pos, (oper1 < oper2) ? 1 : 0);
+            pos += 4;
+        } break;
+    case OP_Equ:
+        {
+            IntWord oper1 = read(s, code, pos+1, m1);
+            IntWord oper2 = read(s, code, pos+2, m2);
+            IntWord res_pos = read_pos(s, code, pos+3, m3);
+            //printf(" [%" PRId64 "] <- %" PRId64 " == %" PRId64 "\n", res_pos, oper1, oper2);
+            store(code, res_pos, (oper1 == oper2) ? 1 : 0);
+            pos += 4;
+        } break;
+    case OP_ModRel:
+        {
+            IntWord oper1 = read(s, code, pos+1, m1);
+            //printf(" %d => ", s->relative_base);
+            s->relative_base += oper1;
+            //printf(" %d\n", s->relative_base);
+            pos += 2;
+        } break;
+    case OP_Halt:
+        {
+            //printf("Halt!\n");
+            s->halted = true;
+            return -1;
+        } break;
+
+    case Opcode_Max:
+    default:
+        printf("BUG! invalid instruction %" PRId64 " at %d\n", instr, pos);
+        s->halted = true;
+        return -1;
+    }
+    s->position = pos;
+    return 1;
+}
+
+// Address the instruction at the current position writes to, if any.
+inline bool instr_write_addr(State *s, Code code, IntWord *addr)
+{
+    int pos = s->position;
+    int m1, m2, m3;
+    Opcode op = decode_instr(load(code, pos), &m1, &m2, &m3);
+    switch (op)
+    {
+        case OP_Add: case OP_Mul: case OP_Lt: case OP_Equ:
+            *addr = read_pos(s, code, pos+3, m3);
+            return true;
+        case OP_Inp:
+            *addr = read_pos(s, code, pos+1, m1);
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Runs until the program halts or blocks waiting for input.
+inline void execute(State *state, Code code)
+{
+    while (step(state, code) == 1);
+}
+
+
+// Specialized handlers
+//
+// One handler per opcode and combination of operand modes, instantiated
+// from a template so the handlers have no mode switches. Instr_handlers is
+// indexed by the instruction value. The operand cells are passed in args so
+// the same handlers work on the program memory (step_specialized()) and on
+// decoded instructions (step_decoded()).
+
+template <int Mode>
+inline IntWord spec_read(State *s, Code code, IntWord a)
+{
+    switch (Mode)
+    {
+        case 0: return load(code, a);
+        case 1: return a;
+        default: return load(code, s->relative_base + a);
+    }
+}
+
+template <int Mode>
+inline IntWord spec_write_pos(State *s, IntWord a)
+{
+    return (Mode == 2) ? s->relative_base + a : a;
+}
+
+template <int Op, int M1, int M2, int M3>
+int spec_handler(State *s, Code code, int pos, const IntWord *args)
+{
+    switch (Op)
+    {
+    case OP_Add:
+        store(code, spec_write_pos<M3>(s, args[2]),
+            spec_read<M1>(s, code, args[0]) + spec_read<M2>(s, code, args[1]));
+        pos += 4;
+        break;
+    case OP_Mul:
+        store(code, spec_write_pos<M3>(s, args[2]),
+            spec_read<M1>(s, code, args[0]) * spec_read<M2>(s, code, args[1]));
+        pos += 4;
+        break;
+    case OP_Inp:
+        {
+            IntWord res;
+            if (!read(s->input, &res)) return 0;
+            store(code, spec_write_pos<M1>(s, args[0]), res);
+            pos += 2;
+        } break;
+    case OP_Out:
+        write(s->output, spec_read<M1>(s, code, args[0]));
+        pos += 2;
+        break;
+    case OP_Jnz:
+        pos = (spec_read<M1>(s, code, args[0]) != 0) ? spec_read<M2>(s, code, args[1]) : pos + 3;
+        break;
+    case OP_Jz:
+        pos = (spec_read<M1>(s, code, args[0]) == 0) ? spec_read<M2>(s, code, args[1]) : pos + 3;
+        break;
+    case OP_Lt:
+        store(code, spec_write_pos<M3>(s, args[2]),
+            (spec_read<M1>(s, code, args[0]) < spec_read<M2>(s, code, args[1])) ? 1 : 0);
+        pos += 4;
+        break;
+    case OP_Equ:
+        store(code, spec_write_pos<M3>(s, args[2]),
+            (spec_read<M1>(s, code, args[0]) == spec_read<M2>(s, code, args[1])) ? 1 : 0);
+        pos += 4;
+        break;
+    case OP_ModRel:
+        s->relative_base += spec_read<M1>(s, code, args[0]);
+        pos += 2;
+        break;
+    case OP_Halt:
+        s->halted = true;
+        return -1;
+    }
+    s->position = pos;
+    return 1;
+}
+
+inline int spec_invalid(State *s, Code code, int pos, const IntWord *)
+{
+    printf("BUG! invalid instruction %" PRId64 " at %d\n", load(code, pos), pos);
+    s->halted = true;
+    return -1;
+}
+
+template <int Op, int M1, int M2>
+InstrHandler pick_handler(int m3)
+{
+    switch (m3)
+    {
+        case 0: return &spec_handler<Op, M1, M2, 0>;
+        case 1: return &spec_handler<Op, M1, M2, 1>;
+        case 2: return &spec_handler<Op, M1, M2, 2>;
+        default: return &spec_invalid;
+    }
+}
+
+template <int Op, int M1>
+InstrHandler pick_handler(int m2, int m3)
+{
+    switch (m2)
+    {
+        case 0: return pick_handler<Op, M1, 0>(m3);
+        case 1: return pick_handler<Op, M1, 1>(m3);
+        case 2: return pick_handler<Op, M1, 2>(m3);
+        default: return &spec_invalid;
+    }
+}
+
+template <int Op>
+InstrHandler pick_handler(int m1, int m2, int m3)
+{
+    switch (m1)
+    {
+        case 0: return pick_handler<Op, 0>(m2, m3);
+        case 1: return pick_handler<Op, 1>(m2, m3);
+        case 2: return pick_handler<Op, 2>(m2, m3);
+        default: return &spec_invalid;
+    }
+}
+
+// Handler for an instruction value.
+inline InstrHandler make_instr_handler(IntWord instr)
+{
+    if (instr < 0 || instr > 22299) return &spec_invalid;
+    int m1, m2, m3;
+    Opcode op = decode_instr(instr, &m1, &m2, &m3);
+    // Modes of the operands an instruction does not have are ignored, like
+    // step() does, and writes cannot use immediate mode.
+    switch (op)
+    {
+    case OP_Add: case OP_Mul: case OP_Lt: case OP_Equ:
+        if (m3 == 1) return &spec_invalid;
+        break;
+    case OP_Jnz: case OP_Jz:
+        m3 = 0;
+        break;
+    case OP_Inp:
+        if (m1 == 1) return &spec_invalid;
+        m2 = m3 = 0;
+        break;
+    case OP_Out: case OP_ModRel:
+        m2 = m3 = 0;
+        break;
+    case OP_Halt:
+        m1 = m2 = m3 = 0;
+        break;
+    default:
+        return &spec_invalid;
+    }
+    switch (op)
+    {
+        case OP_Add: return pick_handler<OP_Add>(m1, m2, m3);
+        case OP_Mul: return pick_handler<OP_Mul>(m1, m2, m3);
+        case OP_Inp: return pick_handler<OP_Inp>(m1, m2, m3);
+        case OP_Out: return pick_handler<OP_Out>(m1, m2, m3);
+        case OP_Jnz: return pick_handler<OP_Jnz>(m1, m2, m3);
+        case OP_Jz: return pick_handler<OP_Jz>(m1, m2, m3);
+        case OP_Lt: return pick_handler<OP_Lt>(m1, m2, m3);
+        case OP_Equ: return pick_handler<OP_Equ>(m1, m2, m3);
+        case OP_ModRel: return pick_handler<OP_ModRel>(m1, m2, m3);
+        case OP_Halt: return pick_handler<OP_Halt>(m1, m2, m3);
+        default: return &spec_invalid;
+    }
+}
+
+#define MAX_INSTR_VALUE 22299
+static InstrHandler Instr_handlers[MAX_INSTR_VALUE + 1];
+inline bool init_instr_handlers()
+{
+    for (int i = 0; i <= MAX_INSTR_VALUE; i++) Instr_handlers[i] = make_instr_handler(i);
+    return true;
+}
+static bool instr_handlers_init = init_instr_handlers();
+
+inline InstrHandler instr_handler(IntWord instr)
+{
+    return ((uint64_t)instr <= MAX_INSTR_VALUE) ? Instr_handlers[instr] : &spec_invalid;
+}
+
+// Same as step(), dispatching to the specialized handler of the instruction.
+inline int step_specialized(State *s, Code code)
+{
+    int pos = s->position;
+    if ((uint64_t)pos + 4 <= (uint64_t)code.memory_size)
+    {
+        return instr_handler(code.data[pos])(s, code, pos, code.data + pos + 1);
+    }
+    // Operands past the flat memory
+    IntWord args[3] = { load(code, pos+1), load(code, pos+2), load(code, pos+3) };
+    return instr_handler(load(code, pos))(s, code, pos, args);
+}
+
+inline void execute_specialized(State *state, Code code)
+{
+    while (step_specialized(state, code) == 1);
+}
+
+
+// Pre-decoded execution
+
+inline int instr_length(Opcode op)
+{
+    switch (op)
+    {
+        case OP_Add: case OP_Mul: case OP_Lt: case OP_Equ: return 4;
+        case OP_Jnz: case OP_Jz: return 3;
+        case OP_Inp: case OP_Out: case OP_ModRel: return 2;
+        default: return 1;
+    }
+}
+
+inline DecodedInstr decode_at(Code code, int pos)
+{
+    int m1, m2, m3;
+    Opcode op = decode_instr(load(code, pos), &m1, &m2, &m3);
+    DecodedInstr d = {};
+    d.op = (op > 0 && op < Opcode_Max) ? op : Opcode_Max;
+    d.m1 = m1;
+    d.m2 = m2;
+    d.m3 = m3;
+    int len = instr_length(op);
+    if (len > 1) d.a1 = load(code, pos+1);
+    if (len > 2) d.a2 = load(code, pos+2);
+    if (len > 3) d.a3 = load(code, pos+3);
+    d.handler = instr_handler(load(code, pos));
+    return d;
+}
+
+// Looks for a jump following the decoded instruction at pos that can run
+// together with it. Only done for instructions that get cached.
+inline void fuse_at(Code code, int pos, DecodedInstr *d)
+{
+    int next = pos + instr_length((Opcode)d->op);
+    if (next + 3 > code.code_size) return;
+    DecodedInstr j = decode_at(code, next);
+    if (j.op != OP_Jnz && j.op != OP_Jz) return;
+    bool always = j.m1 == 1 && ((j.op == OP_Jnz) == (j.a1 != 0));
+
+    Fused fused = FUSED_None;
+    switch (d->op)
+    {
+        case OP_Lt: case OP_Equ:
+            // Compare, then jump on the result.
+            if (d->m3 == 0 && j.m1 == 0 && j.a1 == d->a3) fused = FUSED_CmpJump;
+            break;
+        case OP_Add: case OP_Mul:
+            // Store a constant (the return address), then jump.
+            if (d->m1 == 1 && d->m2 == 1 && always) fused = FUSED_Call;
+            break;
+        case OP_ModRel:
+            // Pop the frame, then jump (to the return address).
+            if (always) fused = FUSED_Return;
+            break;
+    }
+    if (fused == FUSED_None) return;
+    d->fused = fused;
+    d->jump_op = j.op;
+    d->jump_mode = j.m2;
+    d->jump_target = j.a2;
+}
+
+inline IntWord read_decoded(State *s, Code code, IntWord a, int mode)
+{
+    switch (mode)
+    {
+        case 0: return load(code, a);
+        case 1: return a;
+        case 2: return load(code, s->relative_base + a);
+        default:
+            assert("invalid address mode" && 0);
+    }
+    return 0;
+}
+
+inline IntWord read_pos_decoded(State *s, IntWord a, int mode)
+{
+    return (mode == 2) ? s->relative_base + a : a;
+}
+
+// Runs a fused pair (see fuse_at()).
+inline int step_fused(State *s, Code code, int pos, const DecodedInstr &d)
+{
+    int next = pos + instr_length((Opcode)d.op);
+    switch (d.fused)
+    {
+    case FUSED_CmpJump:
+        {
+            IntWord oper1 = read_decoded(s, code, d.a1, d.m1);
+            IntWord oper2 = read_decoded(s, code, d.a2, d.m2);
+            IntWord res = ((d.op == OP_Lt) ? (oper1 < oper2) : (oper1 == oper2)) ? 1 : 0;
+            store(code, d.a3, res);
+            if (d.a3 >= pos && d.a3 < next + 3)
+            {
+                // Overwrote the pair, the jump has to be decoded again.
+                s->position = next;
+                return 1;
+            }
+            pos = ((d.jump_op == OP_Jnz) == (res != 0))
+                ? read_decoded(s, code, d.jump_target, d.jump_mode)
+                : next + 3;
+        } break;
+    case FUSED_Call:
+        {
+            IntWord res = (d.op == OP_Add) ? d.a1 + d.a2 : d.a1 * d.a2;
+            IntWord res_pos = read_pos_decoded(s, d.a3, d.m3);
+            store(code, res_pos, res);
+            if (res_pos >= pos && res_pos < next + 3)
+            {
+                s->position = next;
+                return 1;
+            }
+            pos = read_decoded(s, code, d.jump_target, d.jump_mode);
+        } break;
+    case FUSED_Return:
+        {
+            s->relative_base += read_decoded(s, code, d.a1, d.m1);
+            pos = read_decoded(s, code, d.jump_target, d.jump_mode);
+        } break;
+    }
+    if (s->fused_counts) s->fused_counts[d.fused]++;
+    s->position = pos;
+    return 1;
+}
+
+inline void print_fused_counts(const int64_t *counts)
+{
+    for (int i = 1; i < Fused_Max; i++)
+    {
+        printf("%s: %" PRId64 "\n", Fused_names[i], counts[i]);
+    }
+}
+
+// The decoded instruction at pos, from the decode cache when the code has
+// one (see enable_decode_cache()). Cached instructions followed by a jump
+// may be fused with it.
+inline DecodedInstr decoded_instr(Code code, int pos)
+{
+    if (!code.decoded || (uint64_t)pos >= (uint64_t)code.code_size) return decode_at(code, pos);
+    if (code.decoded[pos].op != 0) return code.decoded[pos];
+
+    DecodedInstr d = decode_at(code, pos);
+    // Instructions reaching past the image could be changed by writes that
+    // do not invalidate, so those are not cached.
+    if (pos + instr_length((Opcode)d.op) <= code.code_size)
+    {
+        fuse_at(code, pos, &d);
+        code.decoded[pos] = d;
+    }
+    return d;
+}
+
+// Gives the code a decode cache for step_decoded() and fills it with every
+// address of the program image (code_size cells). Writes through store()
+// invalidate the instructions overlapping the written cell, so
+// self-modifying programs keep working. Copies made with copy_code() and
+// fork_code() start with the filled cache, so programs run many times are
+// decoded once, before the first copy.
+inline void enable_decode_cache(Code *code)
+{
+    if (code->decoded) return;
+    code->decoded = (DecodedInstr*)calloc(code->code_size, sizeof(DecodedInstr));
+    for (int pos = 0; pos < code->code_size; pos++) decoded_instr(*code, pos);
+}
+
+inline int run_decoded_instr(State *s, Code code, int pos, const DecodedInstr &d)
+{
+    if (d.fused) return step_fused(s, code, pos, d);
+    return d.handler(s, code, pos, &d.a1);
+}
+
+// Same as step(), but runs the specialized handler of the decoded
+// instruction, so a call can execute both instructions of a fused pair.
+inline int step_decoded(State *s, Code code)
+{
+    int pos = s->position;
+    return run_decoded_instr(s, code, pos, decoded_instr(code, pos));
+}
+
+// Runs step_decoded() until the program waits for input or halts or, with
+// stop_on_output, has written an output. Returns like execute_threaded().
+inline int execute_decoded(State *s, Code code, bool stop_on_output = false)
+{
+    while (true)
+    {
+        int pos = s->position;
+        DecodedInstr d = decoded_instr(code, pos);
+        int res = run_decoded_instr(s, code, pos, d);
+        if (res != 1) return res;
+        if (stop_on_output && d.op == OP_Out) return 1;
+    }
+}
+
+
+// Threaded execution
+
+// Cells of execute_threaded(). Code holds any program. A memory that only
+// holds some (the 32-bit one of narrow.h) fails a load or store it cannot
+// do, before anything has changed, and the run continues from that
+// instruction on the Code returned by promote_cells().
+inline bool cells_load(const Code &code, IntWord addr, IntWord *x)
+{
+    *x = load(code, addr);
+    return true;
+}
+
+inline bool cells_store(const Code &code, IntWord addr, IntWord x)
+{
+    store(code, addr, x);
+    return true;
+}
+
+// Code never fails, so this is never called for it.
+inline Code promote_cells(const Code &code)
+{
+    return code;
+}
+
+template <typename Memory>
+inline bool threaded_read(const Memory &code, int pos, int mode, IntWord rb, IntWord *x)
+{
+    IntWord a;
+    if (!cells_load(code, pos, &a)) return false;
+    switch (mode)
+    {
+        case 0: return cells_load(code, a, x);
+        case 1: *x = a; return true;
+        default: return cells_load(code, rb + a, x);
+    }
+}
+
+template <typename Memory>
+inline bool threaded_read_pos(const Memory &code, int pos, int mode, IntWord rb, IntWord *addr)
+{
+    IntWord a;
+    if (!cells_load(code, pos, &a)) return false;
+    *addr = (mode == 2) ? rb + a : a;
+    return true;
+}
+
+// Profiling policy of execute_threaded(). The hooks of this one are empty
+// and compile away, see profile.h for the one that counts and trace.h for
+// the one that records. instr() is called before an instruction runs (an
+// input that has to wait gets it again when the run resumes), the others
+// as it runs. jump() returns the position the run continues at, which is
+// `to` unless the policy redirects the jump (memo.h does). The other
+// policies take Code, this one any memory.
+struct NoProfile
+{
+    template <typename Memory>
+    static void enter(NoProfile *, const Memory &, const State *) { }
+    static void leave(NoProfile *) { }
+    static void instr(NoProfile *, int, IntWord) { }
+    static void stored(NoProfile *, IntWord, IntWord) { }
+    static void input(NoProfile *, IntWord) { }
+    static void output(NoProfile *, IntWord) { }
+    static void relative_base(NoProfile *, IntWord) { }
+    template <typename Memory>
+    static int jump(NoProfile *, const Memory &, int, int to, bool, IntWord) { return to; }
+};
+
+// Alternative to execute() using GCC labels-as-values for direct threaded
+// dispatch. The position and the relative base stay in locals for the whole
+// run and are only written back to the state when the program waits for
+// input, halts or, with stop_on_output, after it has written an output.
+// Returns 0 when waiting for input, -1 on halt and 1 after an output.
+//
+// The memory is a Code, or any type with cells_load(), cells_store() and
+// promote_cells() (see narrow.h). With Code the checks of the cell access
+// are constant and compile away.
+template <typename Profile = NoProfile, typename Memory = Code>
+inline int execute_threaded(State *s, Memory code, bool stop_on_output = false, Profile *prof = nullptr)
+{
+    // Indexed by instr % 100. Filled in statically, so threads running their
+    // first programs at the same time do not race to build it.
+#define TEN(x) x, x, x, x, x, x, x, x, x, x
+    static void *const dispatch[] = {
+        &&op_invalid, &&op_add, &&op_mul, &&op_inp, &&op_out,
+        &&op_jnz, &&op_jz, &&op_lt, &&op_equ, &&op_modrel,
+        TEN(&&op_invalid), TEN(&&op_invalid), TEN(&&op_invalid), TEN(&&op_invalid),
+        TEN(&&op_invalid), TEN(&&op_invalid), TEN(&&op_invalid), TEN(&&op_invalid),
+        &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+        &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid, &&op_halt,
+    };
+#undef TEN
+    static_assert(sizeof(dispatch) / sizeof(dispatch[0]) == 100, "an entry for every instr % 100");
+
+    int pos = s->position;
+    IntWord rb = s->relative_base;
+    IntWord instr, x, y, addr;
+    int result;
+
+    // Every access is checked before the instruction changes anything, so
+    // a promoted run can start the instruction again.
+#define NEXT() \
+    do { \
+        if (!cells_load(code, pos, &instr)) goto promote; \
+        if ((uint64_t)instr > 22299) goto op_invalid; \
+        Profile::instr(prof, pos, instr); \
+        goto *dispatch[instr % 100]; \
+    } while (0)
+#define M1 ((instr / 100) % 10)
+#define M2 ((instr / 1000) % 10)
+#define M3 ((instr / 10000) % 10)
+#define READ(k, mode, out) \
+    if (!threaded_read(code, pos + k, mode, rb, &out)) goto promote
+#define DEST(k, mode) \
+    if (!threaded_read_pos(code, pos + k, mode, rb, &addr)) goto promote
+#define STORE(value_expr) \
+    do { \
+        IntWord value_ = (value_expr); \
+        if (!cells_store(code, addr, value_)) goto promote; \
+        Profile::stored(prof, addr, value_); \
+    } while (0)
+
+    Profile::enter(prof, code, s);
+    NEXT();
+
+op_add:
+    READ(1, M1, x);
+    READ(2, M2, y);
+    DEST(3, M3);
+    STORE(x + y);
+    pos += 4;
+    NEXT();
+op_mul:
+    READ(1, M1, x);
+    READ(2, M2, y);
+    DEST(3, M3);
+    STORE(x * y);
+    pos += 4;
+    NEXT();
+op_inp:
+    DEST(1, M1);
+    if (!read(s->input, &x))
+    {
+        result = 0;
+        goto done;
+    }
+    Profile::input(prof, x);
+    if (!cells_store(code, addr, x)) goto promote_input;
+    Profile::stored(prof, addr, x);
+    pos += 2;
+    NEXT();
+op_out:
+    READ(1, M1, x);
+    Profile::output(prof, x);
+    write(s->output, x);
+    pos += 2;
+    if (stop_on_output)
+    {
+        result = 1;
+        goto done;
+    }
+    NEXT();
+op_jnz:
+    READ(1, M1, x);
+    {
+        int from = pos;
+        bool taken = x != 0;
+        if (taken)
+        {
+            READ(2, M2, y);
+            pos = y;
+        }
+        else pos += 3;
+        pos = Profile::jump(prof, code, from, pos, taken, rb);
+    }
+    NEXT();
+op_jz:
+    READ(1, M1, x);
+    {
+        int from = pos;
+        bool taken = x == 0;
+        if (taken)
+        {
+            READ(2, M2, y);
+            pos = y;
+        }
+        else pos += 3;
+        pos = Profile::jump(prof, code, from, pos, taken, rb);
+    }
+    NEXT();
+op_lt:
+    READ(1, M1, x);
+    READ(2, M2, y);
+    DEST(3, M3);
+    STORE((x < y) ? 1 : 0);
+    pos += 4;
+    NEXT();
+op_equ:
+    READ(1, M1, x);
+    READ(2, M2, y);
+    DEST(3, M3);
+    STORE((x == y) ? 1 : 0);
+    pos += 4;
+    NEXT();
+op_modrel:
+    READ(1, M1, x);
+    rb += x;
+    Profile::relative_base(prof, rb);
+    pos += 2;
+    NEXT();
+op_halt:
+    s->halted = true;
+    result = -1;
+    goto done;
+op_invalid:
+    printf("BUG! invalid instruction %" PRId64 " at %d\n", instr, pos);
+    s->halted = true;
+    result = -1;
+    goto done;
+
+#undef NEXT
+#undef M1
+#undef M2
+#undef M3
+#undef READ
+#undef DEST
+#undef STORE
+
+promote_input:
+    {
+        // The input is taken already, it is written to the promoted code.
+        Profile::leave(prof);
+        Code promoted = promote_cells(code);
+        store(promoted, addr, x);
+        Profile::stored(prof, addr, x);
+        s->position = pos + 2;
+        s->relative_base = rb;
+        return execute_threaded(s, promoted, stop_on_output, prof);
+    }
+promote:
+    Profile::leave(prof);
+    s->position = pos;
+    s->relative_base = rb;
+    return execute_threaded(s, promote_cells(code), stop_on_output, prof);
+
+done:
+    Profile::leave(prof);
+    s->position = pos;
+    s->relative_base = rb;
+    return result;
+}
+
+
+// Running until an event
+
+enum RunEvent
+{
+    RUN_Output = 1, // output_count outputs are buffered
+    RUN_Input = 2,  // waiting for input
+    RUN_Halt = 4,
+};
+
+// Runs the program until one of the events happens and returns it. Waiting
+// for input and halting always end the run, `events` selects whether
+// outputs do. Uses the decode cache when the code has one and there is no
+// profiling policy, the threaded loop otherwise.
+template <typename Profile = NoProfile>
+inline RunEvent run_until(State *s, Code code, int events, int output_count = 1, Profile *prof = nullptr)
+{
+    bool on_output = (events & RUN_Output) != 0;
+    if (on_output && readable_num(*s->output) >= output_count) return RUN_Output;
+    bool decoded = code.decoded && !prof;
+    while (true)
+    {
+        int res = decoded ? execute_decoded(s, code, on_output) : execute_threaded(s, code, on_output, prof);
+        if (res == 0) return RUN_Input;
+        if (res == -1) return RUN_Halt;
+        if (readable_num(*s->output) >= output_count) return RUN_Output;
+    }
+}
+
+
+// Disassembler
+
+inline void read_operand(Code code, int pos, int mode)
+{
+    IntWord a = load(code, pos);
+    switch (mode)
+    {
+        case 0: printf("[%" PRId64 "]=%" PRId64, a, load(code, a)); break;
+        case 1: printf("%" PRId64, a); break;
+        case 2: printf("[B+%" PRId64 "]=?", a); break;
+        default:
+            assert("invalid address mode" && 0);
+    }
+}
+
+inline void write_operand(Code code, int pos, int mode)
+{
+    IntWord a = load(code, pos);
+    switch (mode)
+    {
+        case 0: printf("[%" PRId64 "]", a); break;
+        case 2: printf("[B+%" PRId64 "]", a); break;
+        default:
+            assert("invalid address mode" && 0);
+    }
+}
+
+inline void print_instr(Code code, IntWord *position)
+{
+    IntWord pos = *position;
+    IntWord instr = load(code, pos);
+    int m1, m2, m3;
+    Opcode op = decode_instr(instr, &m1, &m2, &m3);
+    const char *name = (op > 0 && op < Opcode_Max && Opcode_names[op]) ? Opcode_names[op] : "?";
+    printf("%" PRId64 ": (%d) %s[%d, %d, %d]    ", pos, op, name, m1, m2, m3);
+    switch (op)
+    {
+    case OP_Add:
+        {
+            write_operand(code, pos+3, m3);
+            printf(" <- ");
+            read_operand(code, pos+1, m1);
+            printf(" + ");
+            read_operand(code, pos+2, m2);
+            pos += 4;
+        } break;
+    case OP_Mul:
+        {
+            write_operand(code, pos+3, m3);
+            printf(" <- ");
+            read_operand(code, pos+1, m1);
+            printf(" * ");
+            read_operand(code, pos+2, m2);
+            pos += 4;
+        } break;
+    case OP_Inp:
+        {
+            write_operand(code, pos+1, m1);
+            printf("<- inp");
+            pos += 2;
+        } break;
+    case OP_Out:
+        {
+            printf("out <- ");
+            read_operand(code, pos+1, m1);
+            pos += 2;
+        } break;
+    case OP_Jnz:
+        {
+            read_operand(code, pos+1, m1);
+            printf(" != 0 => pos <- ");
+            read_operand(code, pos+2, m2);
+            pos += 3;
+        } break;
+    case OP_Jz:
+        {
+            read_operand(code, pos+1, m1);
+            printf(" == 0 => pos <- ");
+            read_operand(code, pos+2, m2);
+            pos += 3;
+        } break;
+    case OP_Lt:
+        {
+            write_operand(code, pos+3, m3);
+            printf(" <- ");
+            read_operand(code, pos+1, m1);
+            printf(" < ");
+            read_operand(code, pos+2, m2);
+            pos += 4;
+        } break;
+    case OP_Equ:
+        {
+            write_operand(code, pos+3, m3);
+            printf(" <- ");
+            read_operand(code, pos+1, m1);
+            printf(" == ");
+            read_operand(code, pos+2, m2);
+            pos += 4;
+        } break;
+    case OP_ModRel:
+        {
+            printf("B <- ");
+            read_operand(code, pos+1, m1);
+            pos += 2;
+        } break;
+    case OP_Halt:
+        {
+            pos += 1;
+        } break;
+
+    case Opcode_Max:
+    default:
+        printf("BUG!");
+        pos += 1;
+    }
+    *position = pos;
+}
+
+inline void print_code(Code code, int beg, int end)
+{
+    IntWord position = beg;
+    while (position < end)
+    {
+        print_instr(code, &position);
+        putchar('\n');
+    }
+}
+
+#endif // INTCODE_H
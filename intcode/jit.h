@@ -0,0 +1,543 @@
+#ifndef INTCODE_JIT_H
+#define INTCODE_JIT_H
+
+// Intcode to x86-64 JIT.
+//
+// Basic blocks of the program image are translated to native code in an
+// mmap'd executable buffer the first time they are reached. A block ends at
+// a jump, before an input, output or halt instruction (those are left to the
+// interpreter) or before anything that cannot be compiled. Every store made
+// by compiled code checks a per-cell map of the cells that belong to
+// compiled blocks; a store into one of those leaves the block, the blocks
+// containing the cell are dropped and the new code gets compiled again.
+//
+//     Jit *jit = create_jit(code);
+//     execute_jit(&state, code, jit);
+//     ...
+//     free_jit(jit);
+//
+// A Jit can be reused for fresh copies of the same program. Call
+// jit_attach() before running another copy: a new copy can get the address
+// of a freed one, so execute_jit() cannot tell them apart.
+
+#include <sys/mman.h>
+#include <cstddef>
+
+#include "intcode.h"
+
+#if !defined(__x86_64__)
+#error "The Intcode JIT only supports x86-64"
+#endif
+
+#define JIT_BUFFER_SIZE (4 << 20)
+#define JIT_MAX_BLOCK_INSTRS 64
+// Instructions whose cells have been overwritten this many times are left to
+// the interpreter instead of being compiled again.
+#define JIT_SMC_LIMIT 4
+// Enough for JIT_MAX_BLOCK_INSTRS instructions and their exit stubs.
+#define JIT_MAX_BLOCK_BYTES (JIT_MAX_BLOCK_INSTRS * 160 + 64)
+
+enum JitExit
+{
+    JIT_EXIT_NEXT,   // block finished, continue at the returned position
+    JIT_EXIT_SMC,    // stored into compiled code at fault_addr
+    JIT_EXIT_BOUNDS, // instruction at the returned position accesses memory out of bounds
+};
+
+// Passed to the compiled blocks in rdi.
+struct JitContext
+{
+    IntWord *data;
+    IntWord relative_base;
+    uint8_t *covered;
+    int64_t exit;
+    int64_t fault_addr;
+};
+
+typedef int64_t (*JitBlockFn)(JitContext *ctx);
+
+struct JitBlock
+{
+    int start;
+    int end; // exclusive
+};
+
+struct Jit
+{
+    uint8_t *buffer;
+    size_t used;
+
+    int code_size;
+    int memory_size;
+
+    JitBlockFn *entries;  // per address of the image, null when not compiled
+    int *covered_count;   // number of blocks containing each cell
+    uint8_t *covered;     // covered_count != 0, checked by the compiled code
+    IntWord *compiled_from; // cell values the blocks were compiled from
+    uint8_t *smc_count;   // times each cell invalidated a block, up to JIT_SMC_LIMIT
+
+    JitBlock *blocks;
+    int block_num;
+    int block_cap;
+
+    JitContext ctx;
+
+    int64_t blocks_compiled;
+    int64_t blocks_invalidated;
+};
+
+inline Jit *create_jit(Code code)
+{
+    assert(code.memory_size < (1 << 28) && "JIT addresses memory with 32-bit displacements");
+    Jit *jit = (Jit*)calloc(1, sizeof(Jit));
+    void *buffer = mmap(nullptr, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer == MAP_FAILED)
+    {
+        free(jit);
+        return nullptr;
+    }
+    jit->buffer = (uint8_t*)buffer;
+    jit->code_size = code.code_size;
+    jit->memory_size = code.memory_size;
+    jit->entries = (JitBlockFn*)calloc(code.code_size, sizeof(JitBlockFn));
+    jit->covered_count = (int*)calloc(code.code_size, sizeof(int));
+    // The compiled code checks the map for any address it stores to.
+    jit->covered = (uint8_t*)calloc(code.memory_size, sizeof(uint8_t));
+    jit->compiled_from = (IntWord*)calloc(code.code_size, sizeof(IntWord));
+    jit->smc_count = (uint8_t*)calloc(code.code_size, sizeof(uint8_t));
+    return jit;
+}
+
+inline void free_jit(Jit *jit)
+{
+    if (!jit) return;
+    munmap(jit->buffer, JIT_BUFFER_SIZE);
+    free(jit->entries);
+    free(jit->covered_count);
+    free(jit->covered);
+    free(jit->compiled_from);
+    free(jit->smc_count);
+    free(jit->blocks);
+    free(jit);
+}
+
+inline void jit_flush(Jit *jit)
+{
+    memset(jit->entries, 0, jit->code_size * sizeof(JitBlockFn));
+    memset(jit->covered_count, 0, jit->code_size * sizeof(int));
+    memset(jit->covered, 0, jit->code_size * sizeof(uint8_t));
+    jit->block_num = 0;
+    jit->used = 0;
+}
+
+inline void jit_drop_block(Jit *jit, int index)
+{
+    JitBlock b = jit->blocks[index];
+    jit->entries[b.start] = nullptr;
+    for (int i = b.start; i < b.end; i++)
+    {
+        if (--jit->covered_count[i] == 0) jit->covered[i] = 0;
+    }
+    jit->blocks[index] = jit->blocks[--jit->block_num];
+    jit->blocks_invalidated++;
+}
+
+// Drops the compiled blocks containing addr.
+inline void jit_invalidate(Jit *jit, IntWord addr)
+{
+    if (addr < 0 || addr >= jit->code_size || !jit->covered[addr]) return;
+    if (jit->smc_count[addr] < JIT_SMC_LIMIT) jit->smc_count[addr]++;
+    for (int i = 0; i < jit->block_num; )
+    {
+        JitBlock b = jit->blocks[i];
+        if (b.start <= addr && addr < b.end)
+        {
+            jit_drop_block(jit, i);
+        }
+        else
+        {
+            i++;
+        }
+    }
+}
+
+// Drops the blocks that were compiled from different code than what `code`
+// now contains, so the Jit can be used for another copy of the program.
+inline void jit_attach(Jit *jit, Code code)
+{
+    assert(code.code_size == jit->code_size && code.memory_size == jit->memory_size);
+    for (int i = 0; i < jit->block_num; )
+    {
+        JitBlock b = jit->blocks[i];
+        if (memcmp(code.data + b.start, jit->compiled_from + b.start,
+                   (b.end - b.start) * sizeof(IntWord)) != 0)
+        {
+            jit_drop_block(jit, i);
+        }
+        else
+        {
+            i++;
+        }
+    }
+}
+
+
+// x86-64 code emission
+
+enum JitReg
+{
+    RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+    R8 = 8, R9 = 9, R10 = 10, R11 = 11,
+};
+
+// Registers used by the compiled blocks:
+//   rdi  JitContext*
+//   rsi  memory base (ctx->data)
+//   rdx  relative base
+//   rcx  covered map (ctx->covered)
+//   rax  first operand / result / next position
+//   r8   second operand
+//   r9   effective address
+
+struct JitEmitter
+{
+    uint8_t *start;
+    uint8_t *p;
+};
+
+inline void emit8(JitEmitter *e, uint8_t x) { *e->p++ = x; }
+inline void emit32(JitEmitter *e, int32_t x) { memcpy(e->p, &x, 4); e->p += 4; }
+inline void emit64(JitEmitter *e, int64_t x) { memcpy(e->p, &x, 8); e->p += 8; }
+
+// <rex> opcode modrm [sib] disp32 for a [base + (index << scale) + disp]
+// operand, index -1 for none.
+inline void emit_mem_op(JitEmitter *e, bool w, uint8_t op0, int op1, int reg, int base, int index, int scale, int32_t disp)
+{
+    uint8_t rex = 0x40 | (w ? 8 : 0) | ((reg >> 3) << 2) | ((index >= 0 ? index >> 3 : 0) << 1) | (base >> 3);
+    if (rex != 0x40) emit8(e, rex);
+    emit8(e, op0);
+    if (op1 >= 0) emit8(e, (uint8_t)op1);
+    if (index >= 0 || (base & 7) == RSP)
+    {
+        emit8(e, 0x80 | ((reg & 7) << 3) | 4);
+        int idx = (index >= 0) ? (index & 7) : 4;
+        emit8(e, (scale << 6) | (idx << 3) | (base & 7));
+    }
+    else
+    {
+        emit8(e, 0x80 | ((reg & 7) << 3) | (base & 7));
+    }
+    emit32(e, disp);
+}
+
+// <rex.w> opcode modrm for a register-register operation.
+inline void emit_reg_op(JitEmitter *e, uint8_t op0, int op1, int reg, int rm)
+{
+    emit8(e, 0x48 | ((reg >> 3) << 2) | (rm >> 3));
+    emit8(e, op0);
+    if (op1 >= 0) emit8(e, (uint8_t)op1);
+    emit8(e, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+inline void emit_mov_imm(JitEmitter *e, int reg, int64_t x)
+{
+    if (x == (int32_t)x)
+    {
+        // mov r64, imm32 (sign extended)
+        emit8(e, 0x48 | (reg >> 3));
+        emit8(e, 0xC7);
+        emit8(e, 0xC0 | (reg & 7));
+        emit32(e, (int32_t)x);
+    }
+    else
+    {
+        emit8(e, 0x48 | (reg >> 3));
+        emit8(e, 0xB8 | (reg & 7));
+        emit64(e, x);
+    }
+}
+
+inline void emit_load_ctx(JitEmitter *e, int reg, int offset) { emit_mem_op(e, true, 0x8B, -1, reg, RDI, -1, 0, offset); }
+inline void emit_store_ctx(JitEmitter *e, int offset, int reg) { emit_mem_op(e, true, 0x89, -1, reg, RDI, -1, 0, offset); }
+
+// Exit stubs are emitted after the block body, jumps to them are patched once
+// their addresses are known.
+struct JitStub
+{
+    uint8_t *patch; // rel32 of the jump to the stub
+    JitExit exit;
+    int position;   // position returned to the dispatcher
+};
+
+struct JitBlockBuilder
+{
+    JitEmitter e;
+    JitStub stubs[JIT_MAX_BLOCK_INSTRS * 4];
+    int stub_num;
+};
+
+inline void emit_jcc_stub(JitBlockBuilder *b, uint8_t cc, JitExit exit, int position)
+{
+    emit8(&b->e, 0x0F);
+    emit8(&b->e, cc);
+    JitStub *stub = &b->stubs[b->stub_num++];
+    stub->patch = b->e.p;
+    stub->exit = exit;
+    stub->position = position;
+    emit32(&b->e, 0);
+}
+
+// Loads operand (a, mode) into reg. Returns false when it cannot be compiled.
+inline bool emit_operand(JitBlockBuilder *b, Jit *jit, int reg, IntWord a, int mode, int pos)
+{
+    JitEmitter *e = &b->e;
+    switch (mode)
+    {
+    case 0:
+        if (a < 0 || a >= jit->memory_size) return false;
+        emit_mem_op(e, true, 0x8B, -1, reg, RSI, -1, 0, (int32_t)(a * 8));
+        return true;
+    case 1:
+        emit_mov_imm(e, reg, a);
+        return true;
+    case 2:
+        if (a != (int32_t)a) return false;
+        // lea r9, [rdx + a]; cmp r9, memory_size; jae bounds
+        emit_mem_op(e, true, 0x8D, -1, R9, RDX, -1, 0, (int32_t)a);
+        emit_reg_op(e, 0x81, -1, 7, R9);
+        emit32(e, jit->memory_size);
+        emit_jcc_stub(b, 0x83, JIT_EXIT_BOUNDS, pos);
+        // mov reg, [rsi + r9*8]
+        emit_mem_op(e, true, 0x8B, -1, reg, RSI, R9, 3, 0);
+        return true;
+    }
+    return false;
+}
+
+// Puts the address written by operand (a, mode) into r9.
+inline bool emit_dest(JitBlockBuilder *b, Jit *jit, IntWord a, int mode, int pos)
+{
+    JitEmitter *e = &b->e;
+    switch (mode)
+    {
+    case 0:
+        if (a < 0 || a >= jit->memory_size) return false;
+        emit_mov_imm(e, R9, a);
+        return true;
+    case 2:
+        if (a != (int32_t)a) return false;
+        emit_mem_op(e, true, 0x8D, -1, R9, RDX, -1, 0, (int32_t)a);
+        emit_reg_op(e, 0x81, -1, 7, R9);
+        emit32(e, jit->memory_size);
+        emit_jcc_stub(b, 0x83, JIT_EXIT_BOUNDS, pos);
+        return true;
+    }
+    return false;
+}
+
+// mov [rsi + r9*8], rax; cmp byte [rcx + r9], 0; jne smc
+inline void emit_store_result(JitBlockBuilder *b, int next_pos)
+{
+    JitEmitter *e = &b->e;
+    emit_mem_op(e, true, 0x89, -1, RAX, RSI, R9, 3, 0);
+    emit_mem_op(e, false, 0x80, -1, 7, RCX, R9, 0, 0);
+    emit8(e, 0);
+    emit_jcc_stub(b, 0x85, JIT_EXIT_SMC, next_pos);
+}
+
+// Compiles the block starting at start, or returns null when the first
+// instruction is not compiled (input, output, halt, ...).
+inline JitBlockFn jit_compile_block(Jit *jit, Code code, int start)
+{
+    if (JIT_BUFFER_SIZE - jit->used < JIT_MAX_BLOCK_BYTES)
+    {
+        jit_flush(jit);
+    }
+
+    JitBlockBuilder builder;
+    JitBlockBuilder *b = &builder;
+    b->e.start = b->e.p = jit->buffer + jit->used;
+    b->stub_num = 0;
+    JitEmitter *e = &b->e;
+
+    emit_load_ctx(e, RSI, offsetof(JitContext, data));
+    emit_load_ctx(e, RDX, offsetof(JitContext, relative_base));
+    emit_load_ctx(e, RCX, offsetof(JitContext, covered));
+
+    int pos = start;
+    int count = 0;
+    bool jumped = false;
+    while (!jumped && pos < code.code_size && count < JIT_MAX_BLOCK_INSTRS)
+    {
+        IntWord instr = code[pos];
+        if (instr < 0 || instr > 22299) break;
+        int m1, m2, m3;
+        Opcode op = decode_instr(instr, &m1, &m2, &m3);
+        int len = instr_length(op);
+        if (pos + len > code.code_size) break;
+        bool modified = false;
+        for (int i = pos; i < pos + len; i++)
+        {
+            if (jit->smc_count[i] == JIT_SMC_LIMIT) modified = true;
+        }
+        if (modified) break;
+        IntWord a1 = (len > 1) ? code[pos+1] : 0;
+        IntWord a2 = (len > 2) ? code[pos+2] : 0;
+        IntWord a3 = (len > 3) ? code[pos+3] : 0;
+
+        uint8_t *rollback = e->p;
+        int stub_rollback = b->stub_num;
+        bool ok = true;
+        switch (op)
+        {
+        case OP_Add:
+        case OP_Mul:
+        case OP_Lt:
+        case OP_Equ:
+            ok = emit_operand(b, jit, RAX, a1, m1, pos)
+                && emit_operand(b, jit, R8, a2, m2, pos)
+                && emit_dest(b, jit, a3, m3, pos);
+            if (!ok) break;
+            if (op == OP_Add)
+            {
+                emit_reg_op(e, 0x01, -1, R8, RAX); // add rax, r8
+            }
+            else if (op == OP_Mul)
+            {
+                emit_reg_op(e, 0x0F, 0xAF, RAX, R8); // imul rax, r8
+            }
+            else
+            {
+                emit_reg_op(e, 0x39, -1, R8, RAX); // cmp rax, r8
+                emit8(e, 0x0F); emit8(e, op == OP_Lt ? 0x9C : 0x94); emit8(e, 0xC0); // setl/sete al
+                emit8(e, 0x0F); emit8(e, 0xB6); emit8(e, 0xC0); // movzx eax, al
+            }
+            emit_store_result(b, pos + 4);
+            break;
+        case OP_Jnz:
+        case OP_Jz:
+            ok = emit_operand(b, jit, RAX, a1, m1, pos)
+                && emit_operand(b, jit, R8, a2, m2, pos);
+            if (!ok) break;
+            emit8(e, 0x48); emit8(e, 0x85); emit8(e, 0xC0); // test rax, rax
+            emit_mov_imm(e, RAX, pos + 3);
+            emit_reg_op(e, 0x0F, op == OP_Jnz ? 0x45 : 0x44, RAX, R8); // cmovne/cmove rax, r8
+            jumped = true;
+            break;
+        case OP_ModRel:
+            ok = emit_operand(b, jit, RAX, a1, m1, pos);
+            if (!ok) break;
+            emit_reg_op(e, 0x01, -1, RAX, RDX); // add rdx, rax
+            break;
+        default:
+            ok = false;
+        }
+        if (!ok)
+        {
+            e->p = rollback;
+            b->stub_num = stub_rollback;
+            break;
+        }
+        pos += len;
+        count++;
+    }
+
+    if (count == 0)
+    {
+        return nullptr;
+    }
+
+    if (!jumped)
+    {
+        emit_mov_imm(e, RAX, pos);
+    }
+    uint8_t *exit = e->p;
+    emit_store_ctx(e, offsetof(JitContext, relative_base), RDX);
+    emit8(e, 0xC3); // ret
+
+    for (int i = 0; i < b->stub_num; i++)
+    {
+        JitStub *stub = &b->stubs[i];
+        int32_t rel = (int32_t)(e->p - (stub->patch + 4));
+        memcpy(stub->patch, &rel, 4);
+        // mov qword [rdi + exit], reason
+        emit_mem_op(e, true, 0xC7, -1, 0, RDI, -1, 0, offsetof(JitContext, exit));
+        emit32(e, stub->exit);
+        emit_store_ctx(e, offsetof(JitContext, fault_addr), R9);
+        emit_mov_imm(e, RAX, stub->position);
+        emit8(e, 0xE9); // jmp exit
+        emit32(e, (int32_t)(exit - (e->p + 4)));
+    }
+
+    assert(e->p - e->start <= JIT_MAX_BLOCK_BYTES);
+    jit->used += e->p - e->start;
+
+    if (jit->block_num == jit->block_cap)
+    {
+        jit->block_cap = jit->block_cap ? jit->block_cap * 2 : 64;
+        jit->blocks = (JitBlock*)realloc(jit->blocks, jit->block_cap * sizeof(JitBlock));
+    }
+    jit->blocks[jit->block_num++] = { start, pos };
+    for (int i = start; i < pos; i++)
+    {
+        jit->covered_count[i]++;
+        jit->covered[i] = 1;
+        jit->compiled_from[i] = code[i];
+    }
+    jit->blocks_compiled++;
+
+    JitBlockFn fn = (JitBlockFn)(void*)e->start;
+    jit->entries[start] = fn;
+    return fn;
+}
+
+// Runs compiled blocks where possible and the interpreter for the rest.
+// Returns 0 when waiting for input and -1 on halt, like execute().
+inline int execute_jit(State *s, Code code, Jit *jit)
+{
+    JitContext *ctx = &jit->ctx;
+    ctx->data = code.data;
+    ctx->covered = jit->covered;
+
+    while (true)
+    {
+        int pos = s->position;
+        JitBlockFn fn = nullptr;
+        if (pos >= 0 && pos < jit->code_size)
+        {
+            fn = jit->entries[pos];
+            // Input, output and halt are always interpreted.
+            IntWord op = code[pos] % 100;
+            if (!fn && op != OP_Inp && op != OP_Out && op != OP_Halt)
+            {
+                fn = jit_compile_block(jit, code, pos);
+            }
+        }
+
+        if (fn)
+        {
+            ctx->relative_base = s->relative_base;
+            ctx->exit = JIT_EXIT_NEXT;
+            int64_t next = fn(ctx);
+            s->relative_base = ctx->relative_base;
+            s->position = next;
+            if (ctx->exit == JIT_EXIT_SMC)
+            {
+                jit_invalidate(jit, ctx->fault_addr);
+            }
+            if (ctx->exit != JIT_EXIT_BOUNDS)
+            {
+                continue;
+            }
+        }
+
+        IntWord addr;
+        bool writes = instr_write_addr(s, code, &addr);
+        int res = step(s, code);
+        if (res != 1) return res;
+        if (writes) jit_invalidate(jit, addr);
+    }
+}
+
+#endif // INTCODE_JIT_H
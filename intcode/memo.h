@@ -0,0 +1,527 @@
+#ifndef INTCODE_MEMO_H
+#define INTCODE_MEMO_H
+
+// Memoization of pure subroutine calls, opt-in.
+//
+// The bigger programs (17, 21) call their subroutines with a frame on a
+// stack kept at the relative base:
+//
+//     21101 ret,0,0    [rb+0] = return address
+//     1106 0,target    jump to the subroutine
+//     ...
+//     target:
+//     109 n            rb += n, arguments are at rb-n+1..
+//     ...              results are written back to the arguments
+//     109 -n
+//     2106 0,0         jump to [rb+0]
+//
+// Memo is a policy of execute_threaded() that spots the calls (a jump to a
+// `109 n` with the address after the jump in [rb+0]) and records the cells
+// each call reads and writes. A subroutine whose calls only write cells at
+// or above the caller's relative base and do no input or output is pure:
+// what it does only depends on the cells it reads. The cells it wrote are
+// kept, keyed by the cells it read, and a later call finding the same
+// values in those cells gets the writes applied and returns at once (the
+// jump hook sends the run to the return address).
+//
+// The cells of the instructions a call runs are read cells too, so a call
+// into code modified since it was recorded does not hit. A cell accessed
+// relative to the relative base is kept relative to the relative base of
+// the caller, so a call at another stack depth can hit. A cell accessed by
+// address (instructions, globals such as the function pointer read by the
+// routine at 1954 in day 21) is kept by address.
+//
+//     Memo *memo = create_memo(code);
+//     while (execute_memo(&state, code, memo) == 0) { ...give input... }
+//     print_memo_stats(memo);
+//     free_memo(memo);
+//
+// Only the first call of a subroutine decides which cells the key is made
+// of. A call reading other cells is still recorded exactly, every cell read
+// is checked before a hit.
+
+#include "intcode.h"
+
+#define MEMO_MAX_DEPTH 64         // calls recorded at the same time
+#define MEMO_MAX_EVENTS (1 << 18) // memory accesses recorded for one call
+#define MEMO_MAX_ENTRIES (1 << 20)
+
+enum MemoPurity
+{
+    MEMO_Unknown,
+    MEMO_Pure,
+    MEMO_Impure, // wrote below its frame, did I/O or got too big
+};
+
+struct MemoEvent
+{
+    IntWord addr;
+    IntWord value;
+    bool write;
+    bool absolute; // accessed by address, not relative to the relative base
+};
+
+// A cell read or written by a call, offset from the relative base of the
+// caller or, when absolute, an address.
+struct MemoCell
+{
+    IntWord offset;
+    IntWord value;
+    bool absolute;
+};
+
+inline IntWord memo_cell_addr(const MemoCell &cell, IntWord rb)
+{
+    return cell.absolute ? cell.offset : rb + cell.offset;
+}
+
+inline MemoCell make_memo_cell(const MemoEvent &ev, IntWord value, IntWord rb)
+{
+    if (ev.absolute) return { ev.addr, value, true };
+    return { ev.addr - rb, value, false };
+}
+
+struct MemoEntry
+{
+    int target;
+    uint64_t key;
+    int input_num;
+    int write_num;
+    MemoCell *cells; // input_num inputs, then write_num writes
+    MemoEntry *next;
+};
+
+struct MemoFunction
+{
+    int purity;
+    int sig_num; // the cells making the key, -1 until known
+    MemoCell *sig;
+    int64_t calls;
+    int64_t hits;
+};
+
+// A call being recorded.
+struct MemoCall
+{
+    int target;
+    int ret_pos;
+    IntWord call_rb;
+    int event_begin;
+    bool impure;
+};
+
+struct Memo
+{
+    int code_size;
+    MemoFunction *functions; // by target address
+
+    MemoEntry **buckets;
+    int bucket_num;
+    int entry_num;
+
+    MemoCall calls[MEMO_MAX_DEPTH];
+    int depth;
+    MemoEvent *events;
+    int event_num;
+    int event_capacity;
+
+    // Scratch set of the cells a call touched, for finish_call()
+    IntWord *seen_addr;
+    int *seen_input; // index in the inputs, -1 if written before read
+    int *seen_write; // index in the writes, -1 if not written
+    int seen_capacity;
+
+    int64_t calls_detected;
+    int64_t hits;
+    int64_t recorded;
+    int64_t aborted;
+
+    // The run, for the hooks
+    Code code;
+    IntWord rb;
+    bool write_absolute; // of the destination of the instruction running
+
+    static void enter(Memo *memo, const Code &code, const State *s);
+    static void leave(Memo *) { }
+    static void instr(Memo *memo, int pos, IntWord instr);
+    static void stored(Memo *memo, IntWord addr, IntWord value);
+    static void input(Memo *memo, IntWord value);
+    static void output(Memo *memo, IntWord value);
+    static void relative_base(Memo *memo, IntWord rb) { memo->rb = rb; }
+    static int jump(Memo *memo, const Code &code, int from, int to, bool taken, IntWord rb);
+};
+
+inline Memo *create_memo(Code code)
+{
+    Memo *memo = (Memo*)calloc(1, sizeof(Memo));
+    memo->code_size = code.code_size;
+    memo->functions = (MemoFunction*)calloc(code.code_size, sizeof(MemoFunction));
+    for (int i = 0; i < code.code_size; i++) memo->functions[i].sig_num = -1;
+    memo->bucket_num = 1024;
+    memo->buckets = (MemoEntry**)calloc(memo->bucket_num, sizeof(MemoEntry*));
+    return memo;
+}
+
+inline void free_memo(Memo *memo)
+{
+    for (int i = 0; i < memo->bucket_num; i++)
+    {
+        MemoEntry *e = memo->buckets[i];
+        while (e)
+        {
+            MemoEntry *next = e->next;
+            free(e->cells);
+            free(e);
+            e = next;
+        }
+    }
+    for (int i = 0; i < memo->code_size; i++) free(memo->functions[i].sig);
+    free(memo->buckets);
+    free(memo->functions);
+    free(memo->events);
+    free(memo->seen_addr);
+    free(memo->seen_input);
+    free(memo->seen_write);
+    free(memo);
+}
+
+inline uint64_t memo_hash(uint64_t h, IntWord x)
+{
+    h ^= (uint64_t)x;
+    h *= 1099511628211ull;
+    return h;
+}
+
+inline void memo_log(Memo *memo, IntWord addr, IntWord value, bool write, bool absolute)
+{
+    if (memo->event_num == memo->event_capacity)
+    {
+        memo->event_capacity = memo->event_capacity ? memo->event_capacity * 2 : 1024;
+        memo->events = (MemoEvent*)realloc(memo->events, memo->event_capacity * sizeof(MemoEvent));
+    }
+    memo->events[memo->event_num++] = { addr, value, write, absolute };
+}
+
+inline void insert_memo_entry(Memo *memo, MemoEntry *e)
+{
+    if (memo->entry_num >= memo->bucket_num)
+    {
+        int bucket_num = memo->bucket_num * 2;
+        MemoEntry **buckets = (MemoEntry**)calloc(bucket_num, sizeof(MemoEntry*));
+        for (int i = 0; i < memo->bucket_num; i++)
+        {
+            MemoEntry *x = memo->buckets[i];
+            while (x)
+            {
+                MemoEntry *next = x->next;
+                int b = x->key & (bucket_num - 1);
+                x->next = buckets[b];
+                buckets[b] = x;
+                x = next;
+            }
+        }
+        free(memo->buckets);
+        memo->buckets = buckets;
+        memo->bucket_num = bucket_num;
+    }
+    int b = e->key & (memo->bucket_num - 1);
+    e->next = memo->buckets[b];
+    memo->buckets[b] = e;
+    memo->entry_num++;
+}
+
+// Looks up the cells a call of target at rb would read. Returns null when
+// the call has not been seen with these values.
+inline MemoEntry *find_memo_entry(Memo *memo, Code code, int target, IntWord rb)
+{
+    MemoFunction *f = &memo->functions[target];
+    uint64_t key = memo_hash(14695981039346656037ull, target);
+    for (int i = 0; i < f->sig_num; i++) key = memo_hash(key, load(code, memo_cell_addr(f->sig[i], rb)));
+
+    for (MemoEntry *e = memo->buckets[key & (memo->bucket_num - 1)]; e; e = e->next)
+    {
+        if (e->key != key || e->target != target) continue;
+        bool match = true;
+        for (int i = 0; i < e->input_num && match; i++)
+        {
+            match = load(code, memo_cell_addr(e->cells[i], rb)) == e->cells[i].value;
+        }
+        if (match) return e;
+    }
+    return nullptr;
+}
+
+// Slot of the cell in the scratch set, an absolute and a relative access of
+// the same address have their own. A free slot has no input and no write.
+inline int memo_seen(Memo *memo, IntWord addr, bool absolute)
+{
+    IntWord key = addr * 2 + (absolute ? 1 : 0);
+    int mask = memo->seen_capacity - 1;
+    int i = (int)(((uint64_t)key * 0x9E3779B97F4A7C15ull) >> 40) & mask;
+    while ((memo->seen_input[i] != -1 || memo->seen_write[i] != -1) && memo->seen_addr[i] != key)
+    {
+        i = (i + 1) & mask;
+    }
+    memo->seen_addr[i] = key;
+    return i;
+}
+
+// The recorded call on top returned. Turns its events into an entry when
+// it only wrote its frame.
+inline void finish_call(Memo *memo)
+{
+    MemoCall c = memo->calls[--memo->depth];
+    MemoFunction *f = &memo->functions[c.target];
+    int event_num = memo->event_num - c.event_begin;
+    memo->recorded++;
+
+    for (int i = c.event_begin; i < memo->event_num && !c.impure; i++)
+    {
+        if (memo->events[i].write && memo->events[i].addr < c.call_rb) c.impure = true;
+    }
+    if (c.impure) f->purity = MEMO_Impure;
+    if (f->purity == MEMO_Impure) return;
+    f->purity = MEMO_Pure;
+    if (memo->entry_num >= MEMO_MAX_ENTRIES) return;
+
+    int capacity = round_up_pow2(2 * event_num + 2);
+    if (capacity > memo->seen_capacity)
+    {
+        free(memo->seen_addr);
+        free(memo->seen_input);
+        free(memo->seen_write);
+        memo->seen_capacity = capacity;
+        memo->seen_addr = (IntWord*)malloc(capacity * sizeof(IntWord));
+        memo->seen_input = (int*)malloc(capacity * sizeof(int));
+        memo->seen_write = (int*)malloc(capacity * sizeof(int));
+    }
+    memset(memo->seen_input, 0xff, memo->seen_capacity * sizeof(int));
+    memset(memo->seen_write, 0xff, memo->seen_capacity * sizeof(int));
+
+    // The inputs are the cells read before the call wrote them, the writes
+    // keep the last value written to each cell.
+    MemoCell *cells = (MemoCell*)malloc(2 * event_num * sizeof(MemoCell) + 1);
+    MemoCell *writes = cells + event_num;
+    int input_num = 0;
+    int write_num = 0;
+    for (int i = c.event_begin; i < memo->event_num; i++)
+    {
+        MemoEvent ev = memo->events[i];
+        if (ev.write && memo->seen_write[memo_seen(memo, ev.addr, !ev.absolute)] != -1)
+        {
+            // Written both ways, which of the writes is last depends on
+            // the relative base.
+            f->purity = MEMO_Impure;
+            free(cells);
+            return;
+        }
+        int s = memo_seen(memo, ev.addr, ev.absolute);
+        if (ev.write)
+        {
+            if (memo->seen_write[s] == -1)
+            {
+                memo->seen_write[s] = write_num;
+                writes[write_num++] = make_memo_cell(ev, 0, c.call_rb);
+            }
+            writes[memo->seen_write[s]].value = ev.value;
+        }
+        else if (memo->seen_input[s] == -1 && memo->seen_write[s] == -1)
+        {
+            memo->seen_input[s] = input_num;
+            cells[input_num++] = make_memo_cell(ev, ev.value, c.call_rb);
+        }
+    }
+
+    if (f->sig_num == -1)
+    {
+        f->sig_num = input_num;
+        f->sig = (MemoCell*)malloc((input_num + 1) * sizeof(MemoCell));
+        memcpy(f->sig, cells, input_num * sizeof(MemoCell));
+    }
+
+    // The key needs every cell of the signature. A call that did not read
+    // one of them could never be found.
+    uint64_t key = memo_hash(14695981039346656037ull, c.target);
+    for (int i = 0; i < f->sig_num; i++)
+    {
+        int s = memo_seen(memo, memo_cell_addr(f->sig[i], c.call_rb), f->sig[i].absolute);
+        if (memo->seen_input[s] == -1)
+        {
+            free(cells);
+            return;
+        }
+        key = memo_hash(key, cells[memo->seen_input[s]].value);
+    }
+
+    memmove(cells + input_num, writes, write_num * sizeof(MemoCell));
+    MemoEntry *e = (MemoEntry*)malloc(sizeof(MemoEntry));
+    e->target = c.target;
+    e->key = key;
+    e->input_num = input_num;
+    e->write_num = write_num;
+    e->cells = (MemoCell*)realloc(cells, (input_num + write_num + 1) * sizeof(MemoCell));
+    insert_memo_entry(memo, e);
+}
+
+// Gives up on the calls being recorded, when one of them got too big.
+inline void abort_calls(Memo *memo)
+{
+    memo->functions[memo->calls[0].target].purity = MEMO_Impure;
+    memo->aborted += memo->depth;
+    memo->depth = 0;
+    memo->event_num = 0;
+}
+
+inline void memo_store(Memo *memo, Code code, IntWord addr, IntWord value, bool absolute)
+{
+    store(code, addr, value);
+    if (memo->depth > 0) memo_log(memo, addr, value, true, absolute);
+}
+
+// The I/O makes every call being recorded impure.
+inline void memo_io(Memo *memo)
+{
+    for (int i = 0; i < memo->depth; i++) memo->calls[i].impure = true;
+}
+
+// A jump from pos to target was taken. Returns where to continue: target,
+// or the return address when the jump was a call that hit.
+inline int memo_jump(Memo *memo, Code code, int pos, int target, IntWord rb)
+{
+    // Returning from a recorded call? Calls above it never returned.
+    for (int i = memo->depth - 1; i >= 0; i--)
+    {
+        if (memo->calls[i].ret_pos == target && memo->calls[i].call_rb == rb)
+        {
+            memo->aborted += memo->depth - 1 - i;
+            memo->depth = i + 1;
+            finish_call(memo);
+            if (memo->depth == 0) memo->event_num = 0;
+            return target;
+        }
+    }
+
+    int ret_pos = pos + 3;
+    bool is_call = target >= 0 && target + 1 < memo->code_size &&
+        load(code, target) == 109 && load(code, target + 1) > 0 &&
+        load(code, rb) == ret_pos;
+    if (!is_call) return target;
+
+    MemoFunction *f = &memo->functions[target];
+    memo->calls_detected++;
+    f->calls++;
+    if (f->purity == MEMO_Impure) return target;
+
+    if (f->purity == MEMO_Pure)
+    {
+        MemoEntry *e = find_memo_entry(memo, code, target, rb);
+        if (e)
+        {
+            memo->hits++;
+            f->hits++;
+            // The calls being recorded see the call as its reads and writes.
+            for (int i = 0; i < e->input_num && memo->depth > 0; i++)
+            {
+                const MemoCell &cell = e->cells[i];
+                memo_log(memo, memo_cell_addr(cell, rb), cell.value, false, cell.absolute);
+            }
+            for (int i = e->input_num; i < e->input_num + e->write_num; i++)
+            {
+                const MemoCell &cell = e->cells[i];
+                memo_store(memo, code, memo_cell_addr(cell, rb), cell.value, cell.absolute);
+            }
+            return ret_pos;
+        }
+    }
+
+    if (memo->depth < MEMO_MAX_DEPTH)
+    {
+        memo->calls[memo->depth++] = { target, ret_pos, rb, memo->event_num, false };
+    }
+    return target;
+}
+
+inline void Memo::enter(Memo *memo, const Code &code, const State *s)
+{
+    memo->code = code;
+    memo->rb = s->relative_base;
+}
+
+// Logs the cells of the instruction and the cells its operands read, before
+// it runs. A jump logs its target operand even when it is not taken.
+inline void Memo::instr(Memo *memo, int pos, IntWord instr)
+{
+    if (memo->depth == 0) return;
+    if (memo->event_num - memo->calls[0].event_begin > MEMO_MAX_EVENTS)
+    {
+        abort_calls(memo);
+        return;
+    }
+
+    int m1, m2, m3;
+    Opcode op = decode_instr(instr, &m1, &m2, &m3);
+    int len = instr_length(op);
+    for (int i = 0; i < len; i++) memo_log(memo, pos + i, load(memo->code, pos + i), false, true);
+
+    int modes[2] = { m1, m2 };
+    int read_num = 0;
+    switch (op)
+    {
+        case OP_Add: case OP_Mul: case OP_Lt: case OP_Equ: case OP_Jnz: case OP_Jz: read_num = 2; break;
+        case OP_Out: case OP_ModRel: read_num = 1; break;
+        default: break;
+    }
+    for (int i = 0; i < read_num; i++)
+    {
+        if (modes[i] == 1) continue;
+        IntWord addr = load(memo->code, pos + 1 + i);
+        if (modes[i] == 2) addr += memo->rb;
+        memo_log(memo, addr, load(memo->code, addr), false, modes[i] == 0);
+    }
+    memo->write_absolute = ((op == OP_Inp) ? m1 : m3) != 2;
+}
+
+inline void Memo::stored(Memo *memo, IntWord addr, IntWord value)
+{
+    if (memo->depth > 0) memo_log(memo, addr, value, true, memo->write_absolute);
+}
+
+inline void Memo::input(Memo *memo, IntWord)
+{
+    memo_io(memo);
+}
+
+inline void Memo::output(Memo *memo, IntWord)
+{
+    memo_io(memo);
+}
+
+inline int Memo::jump(Memo *memo, const Code &code, int from, int to, bool taken, IntWord rb)
+{
+    if (!taken) return to;
+    return memo_jump(memo, code, from, to, rb);
+}
+
+// Runs the program like execute_threaded(), with the pure calls memoized.
+// Returns 0 when waiting for input and -1 on halt.
+inline int execute_memo(State *s, Code code, Memo *memo)
+{
+    return execute_threaded(s, code, false, memo);
+}
+
+inline void print_memo_stats(const Memo *memo)
+{
+    double rate = memo->calls_detected ? 100.0 * memo->hits / memo->calls_detected : 0.0;
+    printf("memo: %" PRId64 " calls, %" PRId64 " hits (%.1f%%), %" PRId64 " recorded, "
+           "%" PRId64 " aborted, %d entries\n",
+           memo->calls_detected, memo->hits, rate, memo->recorded, memo->aborted, memo->entry_num);
+    for (int i = 0; i < memo->code_size; i++)
+    {
+        const MemoFunction *f = &memo->functions[i];
+        if (f->calls == 0) continue;
+        const char *purity = (f->purity == MEMO_Pure) ? "pure" : (f->purity == MEMO_Impure) ? "impure" : "unknown";
+        printf("  %5d %-7s %8" PRId64 " calls %8" PRId64 " hits\n", i, purity, f->calls, f->hits);
+    }
+}
+
+#endif // INTCODE_MEMO_H
@@ -0,0 +1,111 @@
+// Checks that execute_memo() gives the outputs of execute_threaded() for
+// programs where a stale hit would not: a subroutine modified between two
+// calls with the same arguments, and one reading a global above the
+// relative base from calls at different stack depths.
+//
+//     memo_test
+
+#include "intcode.h"
+#include "memo.h"
+
+// Calls the subroutine at 60 four times with the argument 5. It returns the
+// argument plus the immediate at 64, which is changed from 1 to 3 after the
+// second call. Outputs 6, 6, 8, 8.
+IntWord modified_code[] = {
+    109,500,
+    21101,5,0,1,         // [rb+1] = 5
+    21101,13,0,0,        // [rb+0] = 13, the return address
+    1105,1,60,           // call 60
+    204,1,               // output [rb+1]
+    1001,80,1,80,        // [80] += 1
+    1008,80,2,81,        // after the second call
+    1006,81,30,
+    1101,0,3,64,         // [64] = 3
+    1007,80,4,81,        // four calls
+    1005,81,2,
+    99,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    109,2,               // 60:
+    21201,-1,1,-1,       // [rb-1] += 1 (the immediate at 64)
+    109,-2,
+    2106,0,0,            // return
+    0,0,0,0,0,0,0,0,0,0,0,0,
+};
+
+// Calls the subroutine at 60 three times, one stack cell deeper each time.
+// It returns the global at 200, which is 7 before the first call and 9
+// after it. 201 is 7 too: a read of 200 kept relative to the relative base
+// of the first call would find 7 there in the second. Outputs 7, 9, 9.
+IntWord global_read[202] = {
+    109,150,
+    21101,0,0,1,         // [rb+1] = 0
+    21101,13,0,0,        // [rb+0] = 13
+    1105,1,60,           // call 60
+    204,1,               // output [rb+1]
+    1101,0,9,200,        // [200] = 9
+    109,1,               // one cell deeper
+    1001,80,1,80,
+    1007,80,3,81,        // three calls
+    1005,81,2,
+    99,
+    0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+    109,2,               // 60:
+    21001,200,0,-1,      // [rb-1] = [200]
+    109,-2,
+    2106,0,0,            // return
+};
+
+// Runs code with and without the memo, returns whether the outputs match
+// and the memo hit expected_hits times.
+bool check_memo(const char *name, const IntWord *image, int n, int64_t expected_hits)
+{
+    IntWord plain[16];
+    IntWord memoized[16];
+    int plain_num = 0;
+    int memo_num = 0;
+    int64_t hits = 0;
+    for (int pass = 0; pass < 2; pass++)
+    {
+        Code code = make_code(image, n, 1000);
+        Buffer input = {};
+        Buffer output = {};
+        State state = {};
+        state.input = &input;
+        state.output = &output;
+        if (pass == 0)
+        {
+            execute_threaded(&state, code);
+            while (plain_num < 16 && read(&output, &plain[plain_num])) plain_num++;
+        }
+        else
+        {
+            Memo *memo = create_memo(code);
+            execute_memo(&state, code, memo);
+            while (memo_num < 16 && read(&output, &memoized[memo_num])) memo_num++;
+            hits = memo->hits;
+            free_memo(memo);
+        }
+        free_code(code);
+        free_buffer(&input);
+        free_buffer(&output);
+    }
+
+    bool ok = plain_num == memo_num && hits == expected_hits;
+    for (int i = 0; i < plain_num && ok; i++) ok = plain[i] == memoized[i];
+    printf("%-14s %s: outputs", name, ok ? "ok" : "FAILED");
+    for (int i = 0; i < memo_num; i++) printf(" %" PRId64, memoized[i]);
+    printf(" (expected");
+    for (int i = 0; i < plain_num; i++) printf(" %" PRId64, plain[i]);
+    printf("), %" PRId64 " hits (expected %" PRId64 ")\n", hits, expected_hits);
+    return ok;
+}
+
+int main()
+{
+    global_read[200] = 7;
+    global_read[201] = 7;
+    int failed = 0;
+    failed += !check_memo("modified code", modified_code, sizeof(modified_code) / sizeof(IntWord), 2);
+    failed += !check_memo("global read", global_read, sizeof(global_read) / sizeof(IntWord), 1);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,126 @@
+#ifndef INTCODE_NARROW_H
+#define INTCODE_NARROW_H
+
+// 32-bit VMs: most programs never leave the 32-bit range, so their memory
+// can be kept in half the space. A narrow copy is made of a fresh program
+// and run with execute_narrow():
+//
+//     Code code = copy_code(image);
+//     NarrowCode narrow;
+//     if (make_narrow(code, &narrow))
+//     {
+//         execute_narrow(&state, &narrow, code);
+//         ...
+//         free_narrow(&narrow);
+//     }
+//     else execute_threaded(&state, code);
+//
+// The VM runs on execute_threaded() with NarrowCells as its memory. An
+// instruction whose result does not fit 32 bits, or that reaches past the
+// flat memory, is not run on the narrow cells: their memory is copied to
+// code (the VM is promoted) and the run continues on code from that
+// instruction. Later runs of a promoted VM go to code directly. Until then
+// code is not up to date, read the memory of the VM with narrow_load().
+
+#include "intcode.h"
+
+struct NarrowCode
+{
+    int32_t *data;
+    int code_size;
+    int memory_size;
+    bool promoted; // code has the memory, the VM runs on it from now on
+};
+
+inline bool fits32(int64_t x)
+{
+    return x == (int32_t)x;
+}
+
+// Makes a 32-bit copy of code. Returns false when a cell does not fit or
+// code has cells past its flat memory, then code has to be run as it is.
+inline bool make_narrow(Code code, NarrowCode *n)
+{
+    *n = { };
+    for (int64_t i = 0; i < code.pages->table_num; i++)
+    {
+        if (code.pages->tables[i]) return false;
+    }
+    for (int i = 0; i < code.memory_size; i++)
+    {
+        if (!fits32(code.data[i])) return false;
+    }
+    n->data = (int32_t*)malloc(code.memory_size * sizeof(int32_t));
+    for (int i = 0; i < code.memory_size; i++) n->data[i] = (int32_t)code.data[i];
+    n->code_size = code.code_size;
+    n->memory_size = code.memory_size;
+    return true;
+}
+
+// Fresh copy of a narrow program that has not run, for running it many
+// times like copy_code() (the code given to execute_narrow() has to be a
+// fresh copy too).
+inline NarrowCode copy_narrow(const NarrowCode &image)
+{
+    NarrowCode n = image;
+    n.data = (int32_t*)malloc(image.memory_size * sizeof(int32_t));
+    memcpy(n.data, image.data, image.memory_size * sizeof(int32_t));
+    return n;
+}
+
+inline void free_narrow(NarrowCode *n)
+{
+    free(n->data);
+    *n = { };
+}
+
+inline IntWord narrow_load(const NarrowCode *n, Code code, IntWord addr)
+{
+    if (n->promoted || (uint64_t)addr >= (uint64_t)n->memory_size) return load(code, addr);
+    return n->data[addr];
+}
+
+// Copies the memory of the narrow VM to code.
+inline void promote_narrow(NarrowCode *n, Code code)
+{
+    for (int i = 0; i < n->memory_size; i++) code.data[i] = n->data[i];
+    n->promoted = true;
+}
+
+// The memory execute_threaded() runs a narrow VM on: its 32-bit cells, and
+// the code it is promoted to.
+struct NarrowCells
+{
+    NarrowCode *narrow;
+    Code code;
+};
+
+inline bool cells_load(const NarrowCells &c, IntWord addr, IntWord *x)
+{
+    if ((uint64_t)addr >= (uint64_t)c.narrow->memory_size) return false;
+    *x = c.narrow->data[addr];
+    return true;
+}
+
+inline bool cells_store(const NarrowCells &c, IntWord addr, IntWord x)
+{
+    if ((uint64_t)addr >= (uint64_t)c.narrow->memory_size || !fits32(x)) return false;
+    c.narrow->data[addr] = (int32_t)x;
+    return true;
+}
+
+inline Code promote_cells(const NarrowCells &c)
+{
+    promote_narrow(c.narrow, c.code);
+    return c.code;
+}
+
+// execute_threaded() on the 32-bit copy of code, with the same results.
+inline int execute_narrow(State *s, NarrowCode *n, Code code, bool stop_on_output = false)
+{
+    if (n->promoted) return execute_threaded(s, code, stop_on_output);
+    NarrowCells cells = { n, code };
+    return execute_threaded(s, cells, stop_on_output);
+}
+
+#endif // INTCODE_NARROW_H
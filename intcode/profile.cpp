@@ -0,0 +1,220 @@
+// Profiles the programs bundled with the days on the threaded engine, see
+// profile.h.
+//
+//     make profile
+//     ./profile 21 [-top N] [-json out.json] [-folded out.folded]
+//
+// The folded output goes to flamegraph.pl:
+//
+//     ./profile 21 -folded 21.folded && flamegraph.pl 21.folded > 21.svg
+
+#include "intcode.h"
+#include "profile.h"
+#include "program.h"
+
+// Runs the workload of a day with the profiler, calling profile_new_vm()
+// for every fresh copy of the program.
+typedef void (*ProfileWorkload)(Code image, Profile *prof);
+
+// Runs a fresh copy of image with the given input until it halts or waits
+// for input. The outputs are left in output.
+void run_vm(Code image, Profile *prof, const IntWord *input_data, int input_num, Buffer *output)
+{
+    Code code = copy_code(image);
+    Buffer input = {};
+    State state = {};
+    state.input = &input;
+    state.output = output;
+    write_n(&input, input_data, input_num);
+    profile_new_vm(prof);
+    execute_threaded(&state, code, false, prof);
+    free_code(code);
+    free_buffer(&input);
+}
+
+void run_ascii(Code image, Profile *prof, const char *text)
+{
+    IntWord input[256];
+    int n = 0;
+    while (text[n]) { input[n] = text[n]; n++; }
+    Buffer output = {};
+    run_vm(image, prof, input, n, &output);
+    free_buffer(&output);
+}
+
+void workload_05(Code image, Profile *prof)
+{
+    IntWord input = 5;
+    Buffer output = {};
+    run_vm(image, prof, &input, 1, &output);
+    free_buffer(&output);
+}
+
+void workload_09(Code image, Profile *prof)
+{
+    IntWord input = 2;
+    Buffer output = {};
+    run_vm(image, prof, &input, 1, &output);
+    free_buffer(&output);
+}
+
+// Plays the whole game, moving the paddle under the ball.
+void workload_13(Code image, Profile *prof)
+{
+    Code code = copy_code(image);
+    code[0] = 2;
+    Buffer input = {};
+    Buffer output = {};
+    State state = {};
+    state.input = &input;
+    state.output = &output;
+    profile_new_vm(prof);
+
+    IntWord ball_x = 0;
+    IntWord paddle_x = 0;
+    while (!state.halted)
+    {
+        execute_threaded(&state, code, false, prof);
+        IntWord t[3];
+        while (read_n(&output, t, 3) == 3)
+        {
+            if (t[2] == 4) ball_x = t[0];
+            if (t[2] == 3) paddle_x = t[0];
+        }
+        write(&input, (ball_x > paddle_x) - (ball_x < paddle_x));
+    }
+    free_code(code);
+    free_buffer(&input);
+    free_buffer(&output);
+}
+
+void workload_17(Code image, Profile *prof)
+{
+    Buffer output = {};
+    run_vm(image, prof, nullptr, 0, &output);
+    free_buffer(&output);
+}
+
+// Probes the 50x50 area of part one.
+void workload_19(Code image, Profile *prof)
+{
+    for (int y = 0; y < 50; y++)
+    {
+        for (int x = 0; x < 50; x++)
+        {
+            IntWord input[2] = { x, y };
+            Buffer output = {};
+            run_vm(image, prof, input, 2, &output);
+            free_buffer(&output);
+        }
+    }
+}
+
+// Both springscripts of the day.
+void workload_21(Code image, Profile *prof)
+{
+    run_ascii(image, prof,
+        "NOT C T\n"
+        "AND D T\n"
+        "NOT T T\n"
+        "NOT T J\n"
+        "AND A T\n"
+        "NOT T T\n"
+        "OR T J\n"
+        "WALK\n");
+    run_ascii(image, prof,
+        "NOT B T\n"
+        "NOT C J\n"
+        "OR J T\n"
+        "NOT A J\n"
+        "OR T J\n"
+        "AND E T\n"
+        "AND I T\n"
+        "OR H T\n"
+        "AND D T\n"
+        "AND T J\n"
+        "NOT A T\n"
+        "OR T J\n"
+        "RUN\n");
+}
+
+struct Day
+{
+    const char *name;
+    const char *source;
+    ProfileWorkload run;
+};
+
+Day days[] = {
+    { "05", "../05/main.cpp", workload_05 },
+    { "09", "../09/main.cpp", workload_09 },
+    { "13", "../13/main.cpp", workload_13 },
+    { "17", "../17/main.cpp", workload_17 },
+    { "19", "../19/main.cpp", workload_19 },
+    { "21", "../21/main.cpp", workload_21 },
+};
+const int day_num = sizeof(days)/sizeof(days[0]);
+
+int main(int argc, const char **argv)
+{
+    const char *json_path = nullptr;
+    const char *folded_path = nullptr;
+    int top = 20;
+    Day *day = nullptr;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-json") == 0 && i + 1 < argc) json_path = argv[++i];
+        else if (strcmp(argv[i], "-folded") == 0 && i + 1 < argc) folded_path = argv[++i];
+        else if (strcmp(argv[i], "-top") == 0 && i + 1 < argc) top = atoi(argv[++i]);
+        else
+        {
+            for (int d = 0; d < day_num; d++)
+            {
+                if (strcmp(argv[i], days[d].name) == 0) day = &days[d];
+            }
+        }
+    }
+    if (!day)
+    {
+        printf("usage: profile <day> [-top N] [-json file] [-folded file]\ndays:");
+        for (int d = 0; d < day_num; d++) printf(" %s", days[d].name);
+        printf("\n");
+        return 1;
+    }
+
+    Code image;
+    if (!load_code(day->source, 10000, &image))
+    {
+        printf("could not load %s\n", day->source);
+        return 1;
+    }
+
+    Profile *prof = create_profile(image);
+    day->run(image, prof);
+    print_profile(prof, image, top);
+
+    if (json_path)
+    {
+        FILE *f = fopen(json_path, "w");
+        if (f)
+        {
+            write_profile_json(prof, f);
+            fclose(f);
+        }
+        else printf("could not write %s\n", json_path);
+    }
+    if (folded_path)
+    {
+        FILE *f = fopen(folded_path, "w");
+        if (f)
+        {
+            write_profile_folded(prof, f);
+            fclose(f);
+        }
+        else printf("could not write %s\n", folded_path);
+    }
+
+    free_profile(prof);
+    free_code(image);
+    return 0;
+}
@@ -0,0 +1,407 @@
+#ifndef INTCODE_PROFILE_H
+#define INTCODE_PROFILE_H
+
+// Profiler for execute_threaded(), passed to it as its profiling policy:
+//
+//     Profile *prof = create_profile(code);
+//     profile_new_vm(prof);
+//     execute_threaded(&state, code, false, prof);
+//     print_profile(prof, code, 20);
+//     write_profile_json(prof, file);
+//     free_profile(prof);
+//
+// Runs without a Profile use NoProfile, whose hooks are empty, so the
+// profiler costs nothing unless it is used.
+//
+// Counts the executed instructions by instruction value (opcode and operand
+// modes) and by address, and the times each basic block was entered. A block
+// starts at the first instruction of a run and after every jump instruction,
+// taken or not. Calls and returns following the relative-base convention
+// (see memo.h) are tracked on a shadow stack to give the instructions per
+// call stack, which write_profile_folded() writes in the folded format of
+// flamegraph.pl.
+
+#include <time.h>
+
+#include "intcode.h"
+
+#define PROFILE_MAX_DEPTH 256
+#define PROFILE_MAX_INSTR 22299
+
+// A call stack: a subroutine called from the parent stack. Node 0 is the
+// program outside any call.
+struct ProfileNode
+{
+    int parent;
+    int function;
+    int64_t instructions; // executed with this stack, not in calls made from it
+};
+
+struct ProfileCall
+{
+    int node;
+    int ret_pos;
+    IntWord call_rb;
+};
+
+struct Profile
+{
+    int code_size;
+    int64_t *instr_counts; // by instruction value
+    int64_t *pc_counts;    // by address, for the program image
+    int64_t *block_counts; // by the address the block starts at
+    int64_t outside;       // instructions executed past the image
+    int64_t instructions;
+    bool block_start;      // the next instruction starts a block
+
+    timespec started;
+    double seconds;
+
+    ProfileNode *nodes;
+    int node_num;
+    int node_capacity;
+    int *node_table; // open addressing by (parent, function), -1 when free
+    int node_table_size;
+
+    ProfileCall stack[PROFILE_MAX_DEPTH];
+    int depth;
+    int current;       // node the instructions are charged to
+    int64_t charged;   // instructions charged to a node so far
+    int64_t lost_calls; // calls past PROFILE_MAX_DEPTH
+    int64_t vms;
+
+    static void enter(Profile *p, const Code &code, const State *s);
+    static void leave(Profile *p);
+    static void instr(Profile *p, int pos, IntWord instr);
+    static void stored(Profile *, IntWord, IntWord) { }
+    static void input(Profile *, IntWord) { }
+    static void output(Profile *, IntWord) { }
+    static void relative_base(Profile *, IntWord) { }
+    static int jump(Profile *p, const Code &code, int from, int to, bool taken, IntWord rb);
+};
+
+inline Profile *create_profile(Code code)
+{
+    Profile *p = (Profile*)calloc(1, sizeof(Profile));
+    p->code_size = code.code_size;
+    p->instr_counts = (int64_t*)calloc(PROFILE_MAX_INSTR + 1, sizeof(int64_t));
+    p->pc_counts = (int64_t*)calloc(code.code_size, sizeof(int64_t));
+    p->block_counts = (int64_t*)calloc(code.code_size, sizeof(int64_t));
+
+    p->node_capacity = 64;
+    p->nodes = (ProfileNode*)malloc(p->node_capacity * sizeof(ProfileNode));
+    p->nodes[0] = { -1, -1, 0 };
+    p->node_num = 1;
+    p->node_table_size = 256;
+    p->node_table = (int*)malloc(p->node_table_size * sizeof(int));
+    memset(p->node_table, 0xff, p->node_table_size * sizeof(int));
+    return p;
+}
+
+inline void free_profile(Profile *p)
+{
+    free(p->instr_counts);
+    free(p->pc_counts);
+    free(p->block_counts);
+    free(p->nodes);
+    free(p->node_table);
+    free(p);
+}
+
+inline double profile_seconds_since(const timespec &t)
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - t.tv_sec) + (now.tv_nsec - t.tv_nsec) * 1e-9;
+}
+
+// Charges the instructions since the last call or return to the current
+// stack.
+inline void profile_charge(Profile *p)
+{
+    p->nodes[p->current].instructions += p->instructions - p->charged;
+    p->charged = p->instructions;
+}
+
+inline int profile_node_slot(const Profile *p, int parent, int function)
+{
+    uint64_t h = ((uint64_t)parent * 0x9E3779B97F4A7C15ull) ^ ((uint64_t)function * 0xC2B2AE3D27D4EB4Full);
+    return (int)(h >> 32) & (p->node_table_size - 1);
+}
+
+// The node of function called from the stack parent, added when new.
+inline int profile_child(Profile *p, int parent, int function)
+{
+    int mask = p->node_table_size - 1;
+    int i = profile_node_slot(p, parent, function);
+    for (; p->node_table[i] != -1; i = (i + 1) & mask)
+    {
+        const ProfileNode &n = p->nodes[p->node_table[i]];
+        if (n.parent == parent && n.function == function) return p->node_table[i];
+    }
+
+    if (p->node_num == p->node_capacity)
+    {
+        p->node_capacity *= 2;
+        p->nodes = (ProfileNode*)realloc(p->nodes, p->node_capacity * sizeof(ProfileNode));
+    }
+    int node = p->node_num++;
+    p->nodes[node] = { parent, function, 0 };
+    p->node_table[i] = node;
+
+    if (2 * p->node_num > p->node_table_size)
+    {
+        free(p->node_table);
+        p->node_table_size *= 2;
+        p->node_table = (int*)malloc(p->node_table_size * sizeof(int));
+        memset(p->node_table, 0xff, p->node_table_size * sizeof(int));
+        for (int n = 1; n < p->node_num; n++)
+        {
+            int j = profile_node_slot(p, p->nodes[n].parent, p->nodes[n].function);
+            while (p->node_table[j] != -1) j = (j + 1) & (p->node_table_size - 1);
+            p->node_table[j] = n;
+        }
+    }
+    return node;
+}
+
+// Call before running a fresh copy of the program: the shadow stack of the
+// previous one is dropped.
+inline void profile_new_vm(Profile *p)
+{
+    profile_charge(p);
+    p->depth = 0;
+    p->current = 0;
+    p->vms++;
+}
+
+inline void Profile::enter(Profile *p, const Code &, const State *)
+{
+    p->block_start = true;
+    clock_gettime(CLOCK_MONOTONIC, &p->started);
+}
+
+inline void Profile::leave(Profile *p)
+{
+    p->seconds += profile_seconds_since(p->started);
+    profile_charge(p);
+}
+
+inline void Profile::instr(Profile *p, int pos, IntWord instr)
+{
+    p->instructions++;
+    p->instr_counts[instr]++;
+    if ((unsigned)pos < (unsigned)p->code_size)
+    {
+        p->pc_counts[pos]++;
+        if (p->block_start) p->block_counts[pos]++;
+    }
+    else
+    {
+        p->outside++;
+    }
+    p->block_start = false;
+}
+
+inline int Profile::jump(Profile *p, const Code &code, int from, int to, bool taken, IntWord rb)
+{
+    p->block_start = true;
+    if (!taken) return to;
+
+    for (int i = p->depth - 1; i >= 0; i--)
+    {
+        if (p->stack[i].ret_pos == to && p->stack[i].call_rb == rb)
+        {
+            profile_charge(p);
+            p->depth = i;
+            p->current = (i > 0) ? p->stack[i - 1].node : 0;
+            return to;
+        }
+    }
+
+    int ret_pos = from + 3;
+    bool is_call = to >= 0 && to + 1 < code.code_size &&
+        load(code, to) == 109 && load(code, to + 1) > 0 && load(code, rb) == ret_pos;
+    if (!is_call) return to;
+    if (p->depth == PROFILE_MAX_DEPTH)
+    {
+        p->lost_calls++;
+        return to;
+    }
+    profile_charge(p);
+    p->current = profile_child(p, p->current, to);
+    p->stack[p->depth++] = { p->current, ret_pos, rb };
+    return to;
+}
+
+
+// Reports
+
+struct ProfileCount
+{
+    int key;
+    int64_t count;
+};
+
+inline int compare_profile_counts(const void *a, const void *b)
+{
+    int64_t x = ((const ProfileCount*)a)->count;
+    int64_t y = ((const ProfileCount*)b)->count;
+    return (x < y) ? 1 : (x > y) ? -1 : 0;
+}
+
+// The non-zero counts of counts[0..n), most frequent first. Returns the
+// number of them, the result is malloc'd.
+inline int sorted_profile_counts(const int64_t *counts, int n, ProfileCount **result)
+{
+    ProfileCount *sorted = (ProfileCount*)malloc((n + 1) * sizeof(ProfileCount));
+    int num = 0;
+    for (int i = 0; i < n; i++)
+    {
+        if (counts[i]) sorted[num++] = { i, counts[i] };
+    }
+    qsort(sorted, num, sizeof(ProfileCount), compare_profile_counts);
+    *result = sorted;
+    return num;
+}
+
+inline void opcode_profile_counts(const Profile *p, int64_t *by_opcode)
+{
+    memset(by_opcode, 0, 100 * sizeof(int64_t));
+    for (int i = 0; i <= PROFILE_MAX_INSTR; i++) by_opcode[i % 100] += p->instr_counts[i];
+}
+
+inline const char *profile_opcode_name(int op)
+{
+    return (op > 0 && op < Opcode_Max && Opcode_names[op]) ? Opcode_names[op] : "?";
+}
+
+inline double profile_percent(const Profile *p, int64_t count)
+{
+    return p->instructions ? 100.0 * count / p->instructions : 0.0;
+}
+
+// Prints the totals and the top entries of each table.
+inline void print_profile(const Profile *p, Code code, int top)
+{
+    printf("%" PRId64 " instructions in %.3fs (%.1f M/s) over %" PRId64 " VMs\n",
+           p->instructions, p->seconds, p->seconds > 0 ? p->instructions / p->seconds * 1e-6 : 0.0,
+           p->vms);
+    if (p->outside) printf("%" PRId64 " instructions executed outside the image\n", p->outside);
+
+    int64_t by_opcode[100];
+    opcode_profile_counts(p, by_opcode);
+    ProfileCount *sorted;
+    int num = sorted_profile_counts(by_opcode, 100, &sorted);
+    printf("\nopcodes\n");
+    for (int i = 0; i < num; i++)
+    {
+        printf("  %-8s%14" PRId64 " %6.2f%%\n", profile_opcode_name(sorted[i].key),
+               sorted[i].count, profile_percent(p, sorted[i].count));
+    }
+    free(sorted);
+
+    num = sorted_profile_counts(p->instr_counts, PROFILE_MAX_INSTR + 1, &sorted);
+    printf("\nopcodes with operand modes\n");
+    for (int i = 0; i < num && i < top; i++)
+    {
+        printf("  %5d %-8s%14" PRId64 " %6.2f%%\n", sorted[i].key, profile_opcode_name(sorted[i].key % 100),
+               sorted[i].count, profile_percent(p, sorted[i].count));
+    }
+    free(sorted);
+
+    num = sorted_profile_counts(p->pc_counts, p->code_size, &sorted);
+    printf("\nhot addresses\n");
+    for (int i = 0; i < num && i < top; i++)
+    {
+        printf("  %14" PRId64 " %6.2f%%  ", sorted[i].count, profile_percent(p, sorted[i].count));
+        IntWord position = sorted[i].key;
+        print_instr(code, &position);
+        printf("\n");
+    }
+    free(sorted);
+
+    num = sorted_profile_counts(p->block_counts, p->code_size, &sorted);
+    printf("\nhot blocks (%d blocks)\n", num);
+    for (int i = 0; i < num && i < top; i++)
+    {
+        printf("  %5d %14" PRId64 "\n", sorted[i].key, sorted[i].count);
+    }
+    free(sorted);
+}
+
+// Writes the call stack of node as "main;f_1954;f_1889".
+inline void write_profile_stack(const Profile *p, FILE *f, int node)
+{
+    if (node == 0)
+    {
+        fprintf(f, "main");
+        return;
+    }
+    write_profile_stack(p, f, p->nodes[node].parent);
+    fprintf(f, ";f_%d", p->nodes[node].function);
+}
+
+// One line per call stack with the instructions executed in it, for
+// flamegraph.pl.
+inline void write_profile_folded(const Profile *p, FILE *f)
+{
+    for (int n = 0; n < p->node_num; n++)
+    {
+        if (p->nodes[n].instructions == 0) continue;
+        write_profile_stack(p, f, n);
+        fprintf(f, " %" PRId64 "\n", p->nodes[n].instructions);
+    }
+}
+
+inline void write_profile_counts(FILE *f, const char *name, const int64_t *counts, int n, bool last = false)
+{
+    fprintf(f, "  \"%s\": {", name);
+    bool first = true;
+    for (int i = 0; i < n; i++)
+    {
+        if (!counts[i]) continue;
+        fprintf(f, "%s\"%d\": %" PRId64, first ? "" : ", ", i, counts[i]);
+        first = false;
+    }
+    fprintf(f, "}%s\n", last ? "" : ",");
+}
+
+inline void write_profile_json(const Profile *p, FILE *f)
+{
+    fprintf(f, "{\n");
+    fprintf(f, "  \"instructions\": %" PRId64 ",\n", p->instructions);
+    fprintf(f, "  \"seconds\": %.6f,\n", p->seconds);
+    fprintf(f, "  \"vms\": %" PRId64 ",\n", p->vms);
+    fprintf(f, "  \"outside_image\": %" PRId64 ",\n", p->outside);
+
+    int64_t by_opcode[100];
+    opcode_profile_counts(p, by_opcode);
+    fprintf(f, "  \"opcodes\": {");
+    bool first = true;
+    for (int i = 0; i < 100; i++)
+    {
+        if (!by_opcode[i]) continue;
+        fprintf(f, "%s\"%s\": %" PRId64, first ? "" : ", ", profile_opcode_name(i), by_opcode[i]);
+        first = false;
+    }
+    fprintf(f, "},\n");
+
+    write_profile_counts(f, "instructions_by_value", p->instr_counts, PROFILE_MAX_INSTR + 1);
+    write_profile_counts(f, "addresses", p->pc_counts, p->code_size);
+    write_profile_counts(f, "blocks", p->block_counts, p->code_size);
+
+    fprintf(f, "  \"stacks\": [\n");
+    first = true;
+    for (int n = 0; n < p->node_num; n++)
+    {
+        if (p->nodes[n].instructions == 0) continue;
+        fprintf(f, "%s    {\"stack\": \"", first ? "" : ",\n");
+        write_profile_stack(p, f, n);
+        fprintf(f, "\", \"instructions\": %" PRId64 "}", p->nodes[n].instructions);
+        first = false;
+    }
+    fprintf(f, "\n  ]\n}\n");
+}
+
+#endif // INTCODE_PROFILE_H
@@ -0,0 +1,75 @@
+#ifndef INTCODE_PROGRAM_H
+#define INTCODE_PROGRAM_H
+
+// Reads the Intcode program embedded in a day's main.cpp, e.g.
+//
+//     IntWord actual_code[] = {
+//         3,225,1,225,6,6,...
+//     };
+//
+// so the tools in this directory can work on the bundled programs without
+// keeping copies of them.
+
+#include "intcode.h"
+
+// Returns the cells of the array called `name`, or null if the file or the
+// array was not found. The result is malloc'd.
+inline IntWord *load_program(const char *path, int *size, const char *name = "actual_code")
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) return nullptr;
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *text = (char*)malloc(len + 1);
+    len = fread(text, 1, len, f);
+    text[len] = 0;
+    fclose(f);
+
+    char pattern[128];
+    snprintf(pattern, sizeof(pattern), "%s[] = {", name);
+    const char *p = strstr(text, pattern);
+    if (!p)
+    {
+        free(text);
+        return nullptr;
+    }
+    p += strlen(pattern);
+
+    int cap = 1024;
+    int n = 0;
+    IntWord *data = (IntWord*)malloc(cap * sizeof(IntWord));
+    while (*p && *p != '}')
+    {
+        char *end;
+        IntWord x = strtoll(p, &end, 10);
+        if (end == p)
+        {
+            p++; // whitespace and commas
+            continue;
+        }
+        if (n == cap)
+        {
+            cap *= 2;
+            data = (IntWord*)realloc(data, cap * sizeof(IntWord));
+        }
+        data[n++] = x;
+        p = end;
+    }
+    free(text);
+
+    *size = n;
+    return data;
+}
+
+inline bool load_code(const char *path, int extra_memory, Code *code)
+{
+    int size;
+    IntWord *program = load_program(path, &size);
+    if (!program) return false;
+    *code = make_code(program, size, extra_memory);
+    free(program);
+    return true;
+}
+
+#endif // INTCODE_PROGRAM_H
@@ -0,0 +1,138 @@
+// Reads traces recorded with trace.h (e.g. "day13 trace 13.trace").
+//
+//     replay <trace> info               instructions and checkpoints in the trace
+//     replay <trace> state N [from to]  the VM before instruction N, with the
+//                                       memory from..to
+//     replay <trace> list N [count]     count instructions starting at N
+//     replay <trace> io                 inputs and outputs, with their instruction
+//
+// The VM is rebuilt from the last checkpoint before N, nothing is run again.
+
+#include "intcode.h"
+#include "trace.h"
+
+void print_info(const TraceReader &r)
+{
+    const TraceHeader *h = r.header;
+    printf("%" PRIu64 " instructions, %" PRIu64 " bytes of records (%.2f per instruction)\n",
+           h->instructions, h->written, h->instructions ? (double)h->written / h->instructions : 0.0);
+    printf("ring of %" PRIu64 " bytes, records from offset %" PRIu64 " are kept\n", r.capacity, trace_oldest(r));
+
+    int64_t first = (h->checkpoint_num > TRACE_MAX_CHECKPOINTS) ? h->checkpoint_num - TRACE_MAX_CHECKPOINTS : 0;
+    int kept = 0;
+    uint64_t earliest = h->instructions;
+    for (int64_t i = first; i < h->checkpoint_num; i++)
+    {
+        const TraceCheckpointRef &ref = h->checkpoints[i % TRACE_MAX_CHECKPOINTS];
+        if (ref.offset < trace_oldest(r)) continue;
+        kept++;
+        if (ref.instruction < earliest) earliest = ref.instruction;
+    }
+    printf("%" PRId64 " checkpoints, %d still in the ring, instructions %" PRIu64 "..%" PRIu64 " can be rebuilt\n",
+           h->checkpoint_num, kept, earliest, h->instructions);
+}
+
+void print_record(const TraceState &s)
+{
+    printf("%10" PRIu64 "  ", s.instruction);
+    IntWord position = s.position;
+    print_instr(s.code, &position);
+    if (s.has_write) printf("    ; [%" PRId64 "] = %" PRId64, s.write_addr, s.write_value);
+    if (s.has_value)
+    {
+        int op = s.instr % 100;
+        if (op == OP_Inp) printf("    ; input %" PRId64, s.value);
+        else if (op == OP_Out) printf("    ; output %" PRId64, s.value);
+        else printf("    ; B += %" PRId64, s.value);
+    }
+    printf("\n");
+}
+
+int main(int argc, const char **argv)
+{
+    if (argc < 3)
+    {
+        printf("usage: replay <trace> info | state N [from to] | list N [count] | io\n");
+        return 1;
+    }
+    TraceReader r;
+    if (!open_trace_reader(argv[1], &r))
+    {
+        printf("could not read the trace %s\n", argv[1]);
+        return 1;
+    }
+
+    const char *command = argv[2];
+    TraceState s = {};
+    if (strcmp(command, "info") == 0)
+    {
+        print_info(r);
+    }
+    else if (strcmp(command, "state") == 0 && argc >= 4)
+    {
+        uint64_t n = strtoull(argv[3], nullptr, 10);
+        if (!seek_trace(r, n, &s))
+        {
+            printf("instruction %" PRIu64 " is not in the trace\n", n);
+            return 1;
+        }
+        printf("before instruction %" PRIu64 ": position %d, relative base %" PRId64 "%s\n",
+               s.instruction, s.position, s.relative_base, s.halted ? ", halted" : "");
+        IntWord position = s.position;
+        print_instr(s.code, &position);
+        printf("\n");
+        if (argc >= 6)
+        {
+            IntWord from = strtoll(argv[4], nullptr, 10);
+            IntWord to = strtoll(argv[5], nullptr, 10);
+            for (IntWord a = from; a < to; a++)
+            {
+                if ((a - from) % 10 == 0) printf("%s%8" PRId64 ":", (a == from) ? "" : "\n", a);
+                printf(" %" PRId64, load(s.code, a));
+            }
+            printf("\n");
+        }
+    }
+    else if (strcmp(command, "list") == 0 && argc >= 4)
+    {
+        uint64_t n = strtoull(argv[3], nullptr, 10);
+        int count = (argc >= 5) ? atoi(argv[4]) : 20;
+        if (!seek_trace(r, n, &s))
+        {
+            printf("instruction %" PRIu64 " is not in the trace\n", n);
+            return 1;
+        }
+        // The operands are shown with the memory before each instruction.
+        for (int i = 0; i < count && read_trace_instr(r, &s); i++)
+        {
+            print_record(s);
+            apply_trace_instr(&s);
+        }
+    }
+    else if (strcmp(command, "io") == 0)
+    {
+        // The start may have been overwritten, go from the oldest checkpoint
+        // kept.
+        if (!seek_trace(r, trace_first_instruction(r), &s))
+        {
+            printf("no checkpoint is left in the trace\n");
+            return 1;
+        }
+        while (read_trace_instr(r, &s))
+        {
+            int op = s.instr % 100;
+            if (op == OP_Inp) printf("%10" PRIu64 "  input %" PRId64 "\n", s.instruction, s.value);
+            if (op == OP_Out) printf("%10" PRIu64 "  output %" PRId64 "\n", s.instruction, s.value);
+            apply_trace_instr(&s);
+        }
+    }
+    else
+    {
+        printf("unknown command %s\n", command);
+        return 1;
+    }
+
+    free_trace_state(&s);
+    close_trace_reader(&r);
+    return 0;
+}
@@ -0,0 +1,553 @@
+#ifndef INTCODE_TRACE_H
+#define INTCODE_TRACE_H
+
+// Execution trace of a VM, recorded by execute_threaded() when given a
+// TraceRecorder as its profiling policy:
+//
+//     TraceRecorder *trace = open_trace("13.trace");
+//     execute_threaded(&state, code, false, trace);
+//     ...
+//     close_trace(trace);
+//
+// and read back with the replay tool (replay.cpp), which can rebuild the
+// VM at any instruction without running the program again.
+//
+// The trace is a ring in a memory mapped file: a header followed by
+// `capacity` bytes of records, the oldest ones overwritten once the ring is
+// full. Every instruction is a record of a few bytes:
+//
+//     byte      opcode (low 4 bits, TRACE_Halt for 99) and TraceFlags
+//     [modes]   m1 + 3*m2 + 9*m3, when TRACE_Modes
+//     [pc]      position - position after the last instruction, when TRACE_Jump
+//     [write]   address - last address written, value, when TRACE_Write
+//     [value]   input, output or relative base change, when TRACE_Value
+//
+// The numbers are zigzag varints. Once 1/TRACE_CHECKPOINTS_PER_RING of the
+// ring (and no less than the last checkpoint) has been written since the
+// last checkpoint, a checkpoint record has the whole state of the VM
+// (position, relative base and memory), so the ring keeps the last ones
+// whatever its size. The header keeps where
+// the last TRACE_MAX_CHECKPOINTS of them are. A trace records one VM.
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "intcode.h"
+
+#define TRACE_MAGIC "ICTRACE1"
+#define TRACE_HEADER_SIZE 32768
+#define TRACE_MAX_CHECKPOINTS 2000
+#define TRACE_CHECKPOINTS_PER_RING 64
+#define TRACE_DEFAULT_CAPACITY (64 << 20)
+
+enum TraceFlags
+{
+    TRACE_Jump = 0x10,  // not at the position after the last instruction
+    TRACE_Write = 0x20,
+    TRACE_Value = 0x40,
+    TRACE_Modes = 0x80,
+};
+
+// Opcodes in the low bits of the first byte of a record, 1-9 are the
+// Intcode opcodes.
+enum TraceRecordType
+{
+    TRACE_Checkpoint = 0,
+    TRACE_Halt = 10,
+};
+
+struct TraceCheckpointRef
+{
+    uint64_t instruction; // instructions recorded before it
+    uint64_t offset;      // in the record stream
+};
+
+struct TraceHeader
+{
+    char magic[8];
+    uint64_t capacity;
+    uint64_t written; // bytes written to the ring, the ring wraps at capacity
+    uint64_t instructions;
+    int64_t checkpoint_num;
+    TraceCheckpointRef checkpoints[TRACE_MAX_CHECKPOINTS]; // checkpoint i at i % TRACE_MAX_CHECKPOINTS
+};
+
+static_assert(sizeof(TraceHeader) <= TRACE_HEADER_SIZE, "trace header does not fit");
+
+struct TraceRecorder
+{
+    int fd;
+    TraceHeader *header;
+    uint8_t *ring;
+    uint64_t capacity;
+    uint64_t written;
+    uint64_t instructions;
+    uint64_t checkpoint_end;  // written at the end of the last checkpoint
+    uint64_t checkpoint_size; // bytes of the last checkpoint
+
+    Code code; // of the current run, for the checkpoints
+    IntWord rb;
+    IntWord next_pos;   // position after the last recorded instruction
+    IntWord last_write; // address of the last write
+
+    // The instruction being run, recorded when the next one starts so a
+    // wait for input does not record the input twice.
+    bool pending;
+    int pending_pos;
+    IntWord pending_instr;
+    bool has_write;
+    IntWord write_addr;
+    IntWord write_value;
+    bool has_value;
+    IntWord value;
+
+    static void enter(TraceRecorder *t, const Code &code, const State *s);
+    static void leave(TraceRecorder *t);
+    static void instr(TraceRecorder *t, int pos, IntWord instr);
+    static void stored(TraceRecorder *t, IntWord addr, IntWord value);
+    static void input(TraceRecorder *t, IntWord value);
+    static void output(TraceRecorder *t, IntWord value);
+    static void relative_base(TraceRecorder *t, IntWord rb);
+    static int jump(TraceRecorder *, const Code &, int, int to, bool, IntWord) { return to; }
+};
+
+inline uint64_t zigzag(IntWord x)
+{
+    return ((uint64_t)x << 1) ^ (uint64_t)(x >> 63);
+}
+
+inline IntWord unzigzag(uint64_t x)
+{
+    return (IntWord)(x >> 1) ^ -(IntWord)(x & 1);
+}
+
+inline void trace_byte(TraceRecorder *t, uint8_t b)
+{
+    t->ring[t->written % t->capacity] = b;
+    t->written++;
+}
+
+inline void trace_varint(TraceRecorder *t, uint64_t x)
+{
+    while (x >= 0x80)
+    {
+        trace_byte(t, (uint8_t)(x | 0x80));
+        x >>= 7;
+    }
+    trace_byte(t, (uint8_t)x);
+}
+
+inline void sync_trace_header(TraceRecorder *t)
+{
+    t->header->written = t->written;
+    t->header->instructions = t->instructions;
+}
+
+// Creates (or truncates) the trace file. Returns null if it cannot be
+// created.
+inline TraceRecorder *open_trace(const char *path, uint64_t capacity = TRACE_DEFAULT_CAPACITY)
+{
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return nullptr;
+    if (ftruncate(fd, TRACE_HEADER_SIZE + capacity) != 0)
+    {
+        close(fd);
+        return nullptr;
+    }
+    void *map = mmap(nullptr, TRACE_HEADER_SIZE + capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    TraceRecorder *t = (TraceRecorder*)calloc(1, sizeof(TraceRecorder));
+    t->fd = fd;
+    t->header = (TraceHeader*)map;
+    t->ring = (uint8_t*)map + TRACE_HEADER_SIZE;
+    t->capacity = capacity;
+    memcpy(t->header->magic, TRACE_MAGIC, 8);
+    t->header->capacity = capacity;
+    return t;
+}
+
+inline void flush_trace_instr(TraceRecorder *t)
+{
+    if (!t->pending) return;
+    t->pending = false;
+
+    IntWord instr = t->pending_instr;
+    int op = instr % 100;
+    int m1, m2, m3;
+    decode_instr(instr, &m1, &m2, &m3);
+    int modes = m1 + 3 * m2 + 9 * m3;
+
+    uint8_t head = (op == OP_Halt) ? TRACE_Halt : op;
+    if (modes) head |= TRACE_Modes;
+    if (t->pending_pos != t->next_pos) head |= TRACE_Jump;
+    if (t->has_write) head |= TRACE_Write;
+    if (t->has_value) head |= TRACE_Value;
+    trace_byte(t, head);
+    if (modes) trace_byte(t, modes);
+    if (head & TRACE_Jump) trace_varint(t, zigzag(t->pending_pos - t->next_pos));
+    if (t->has_write)
+    {
+        trace_varint(t, zigzag(t->write_addr - t->last_write));
+        trace_varint(t, zigzag(t->write_value));
+        t->last_write = t->write_addr;
+    }
+    if (t->has_value) trace_varint(t, zigzag(t->value));
+
+    t->next_pos = t->pending_pos + instr_length((Opcode)op);
+    t->instructions++;
+}
+
+// Writes the whole state of the VM before the next instruction.
+inline void write_trace_checkpoint(TraceRecorder *t, int pos)
+{
+    int64_t n = t->header->checkpoint_num++;
+    t->header->checkpoints[n % TRACE_MAX_CHECKPOINTS] = { t->instructions, t->written };
+
+    const Code &code = t->code;
+    uint64_t start = t->written;
+    trace_byte(t, TRACE_Checkpoint);
+    trace_varint(t, t->instructions);
+    trace_varint(t, pos);
+    trace_varint(t, zigzag(t->rb));
+    trace_varint(t, zigzag(t->last_write));
+    trace_varint(t, code.code_size);
+    trace_varint(t, code.memory_size);
+    for (int i = 0; i < code.memory_size; i++) trace_varint(t, zigzag(code.data[i]));
+
+    // Cells past memory_size, as address deltas and values
+    const PagedMemory *m = code.pages;
+    int64_t cells = 0;
+    for (int64_t i = 0; i < m->table_num; i++)
+    {
+        if (!m->tables[i]) continue;
+        for (int p = 0; p < PAGE_TABLE_SIZE; p++)
+        {
+            if (!m->tables[i][p]) continue;
+            for (int c = 0; c < PAGE_CELLS; c++) cells += m->tables[i][p][c] != 0;
+        }
+    }
+    trace_varint(t, cells);
+    IntWord last = 0;
+    for (int64_t i = 0; i < m->table_num; i++)
+    {
+        if (!m->tables[i]) continue;
+        for (int p = 0; p < PAGE_TABLE_SIZE; p++)
+        {
+            const IntWord *page = m->tables[i][p];
+            if (!page) continue;
+            IntWord base = (i << (PAGE_BITS + PAGE_TABLE_BITS)) | ((IntWord)p << PAGE_BITS);
+            for (int c = 0; c < PAGE_CELLS; c++)
+            {
+                if (!page[c]) continue;
+                trace_varint(t, zigzag(base + c - last));
+                trace_varint(t, zigzag(page[c]));
+                last = base + c;
+            }
+        }
+    }
+    t->next_pos = pos;
+    t->checkpoint_end = t->written;
+    t->checkpoint_size = t->written - start;
+    sync_trace_header(t);
+}
+
+inline void TraceRecorder::enter(TraceRecorder *t, const Code &code, const State *s)
+{
+    t->code = code;
+    t->rb = s->relative_base;
+    if (t->header->checkpoint_num == 0) write_trace_checkpoint(t, s->position);
+}
+
+inline void TraceRecorder::leave(TraceRecorder *t)
+{
+    // An input that waits is run again when the VM resumes.
+    bool waiting = t->pending && t->pending_instr % 100 == OP_Inp && !t->has_value;
+    if (waiting) t->pending = false;
+    flush_trace_instr(t);
+    sync_trace_header(t);
+}
+
+inline void TraceRecorder::instr(TraceRecorder *t, int pos, IntWord instr)
+{
+    flush_trace_instr(t);
+    uint64_t interval = t->capacity / TRACE_CHECKPOINTS_PER_RING;
+    if (interval < t->checkpoint_size) interval = t->checkpoint_size;
+    if (t->written - t->checkpoint_end >= interval) write_trace_checkpoint(t, pos);
+    t->pending = true;
+    t->pending_pos = pos;
+    t->pending_instr = instr;
+    t->has_write = false;
+    t->has_value = false;
+}
+
+inline void TraceRecorder::stored(TraceRecorder *t, IntWord addr, IntWord value)
+{
+    t->has_write = true;
+    t->write_addr = addr;
+    t->write_value = value;
+}
+
+inline void TraceRecorder::input(TraceRecorder *t, IntWord value)
+{
+    t->has_value = true;
+    t->value = value;
+}
+
+inline void TraceRecorder::output(TraceRecorder *t, IntWord value)
+{
+    t->has_value = true;
+    t->value = value;
+}
+
+inline void TraceRecorder::relative_base(TraceRecorder *t, IntWord rb)
+{
+    t->has_value = true;
+    t->value = rb - t->rb;
+    t->rb = rb;
+}
+
+inline void close_trace(TraceRecorder *t)
+{
+    flush_trace_instr(t);
+    sync_trace_header(t);
+    munmap(t->header, TRACE_HEADER_SIZE + t->capacity);
+    close(t->fd);
+    free(t);
+}
+
+
+// Reading a trace
+
+struct TraceReader
+{
+    int fd;
+    const TraceHeader *header;
+    const uint8_t *ring;
+    uint64_t capacity;
+    size_t map_size;
+};
+
+inline bool open_trace_reader(const char *path, TraceReader *r)
+{
+    *r = { };
+    r->fd = open(path, O_RDONLY);
+    if (r->fd < 0) return false;
+    off_t size = lseek(r->fd, 0, SEEK_END);
+    if (size < TRACE_HEADER_SIZE)
+    {
+        close(r->fd);
+        return false;
+    }
+    void *map = mmap(nullptr, size, PROT_READ, MAP_SHARED, r->fd, 0);
+    if (map == MAP_FAILED)
+    {
+        close(r->fd);
+        return false;
+    }
+    r->map_size = size;
+    r->header = (const TraceHeader*)map;
+    r->ring = (const uint8_t*)map + TRACE_HEADER_SIZE;
+    r->capacity = r->header->capacity;
+    if (memcmp(r->header->magic, TRACE_MAGIC, 8) != 0 || TRACE_HEADER_SIZE + r->capacity > (uint64_t)size)
+    {
+        munmap(map, size);
+        close(r->fd);
+        return false;
+    }
+    return true;
+}
+
+inline void close_trace_reader(TraceReader *r)
+{
+    munmap((void*)r->header, r->map_size);
+    close(r->fd);
+    *r = { };
+}
+
+// Offset of the oldest byte still in the ring.
+inline uint64_t trace_oldest(const TraceReader &r)
+{
+    return (r.header->written > r.capacity) ? r.header->written - r.capacity : 0;
+}
+
+inline uint8_t trace_read_byte(const TraceReader &r, uint64_t *offset)
+{
+    return r.ring[(*offset)++ % r.capacity];
+}
+
+inline uint64_t trace_read_varint(const TraceReader &r, uint64_t *offset)
+{
+    uint64_t x = 0;
+    int shift = 0;
+    while (true)
+    {
+        uint8_t b = trace_read_byte(r, offset);
+        x |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) return x;
+        shift += 7;
+    }
+}
+
+// First instruction that can be rebuilt, the one of the oldest checkpoint
+// still in the ring. The number of instructions if there is none.
+inline uint64_t trace_first_instruction(const TraceReader &r)
+{
+    const TraceHeader *h = r.header;
+    int64_t first = (h->checkpoint_num > TRACE_MAX_CHECKPOINTS) ? h->checkpoint_num - TRACE_MAX_CHECKPOINTS : 0;
+    uint64_t earliest = h->instructions;
+    for (int64_t i = first; i < h->checkpoint_num; i++)
+    {
+        const TraceCheckpointRef &ref = h->checkpoints[i % TRACE_MAX_CHECKPOINTS];
+        if (ref.offset >= trace_oldest(r) && ref.instruction < earliest) earliest = ref.instruction;
+    }
+    return earliest;
+}
+
+// A VM rebuilt from a trace.
+struct TraceState
+{
+    uint64_t instruction; // instructions run before this state
+    int position;
+    IntWord relative_base;
+    Code code;
+    bool halted;
+
+    // The record of the next instruction, filled by read_trace_instr()
+    IntWord instr;
+    bool has_write;
+    IntWord write_addr;
+    IntWord write_value;
+    bool has_value;
+    IntWord value;
+
+    uint64_t offset; // of the next record
+    IntWord next_pos;
+    IntWord last_write;
+};
+
+inline void free_trace_state(TraceState *s)
+{
+    free_code(s->code);
+    *s = { };
+}
+
+// Loads the checkpoint at offset into s.
+inline void read_trace_checkpoint(const TraceReader &r, uint64_t offset, TraceState *s)
+{
+    free_trace_state(s);
+    uint8_t head = trace_read_byte(r, &offset);
+    assert(head == TRACE_Checkpoint);
+    s->instruction = trace_read_varint(r, &offset);
+    s->position = trace_read_varint(r, &offset);
+    s->relative_base = unzigzag(trace_read_varint(r, &offset));
+    s->last_write = unzigzag(trace_read_varint(r, &offset));
+    int code_size = trace_read_varint(r, &offset);
+    int memory_size = trace_read_varint(r, &offset);
+    IntWord *data = (IntWord*)malloc(memory_size * sizeof(IntWord));
+    for (int i = 0; i < memory_size; i++) data[i] = unzigzag(trace_read_varint(r, &offset));
+    s->code = make_code(data, code_size, memory_size - code_size);
+    memcpy(s->code.data, data, memory_size * sizeof(IntWord));
+    free(data);
+
+    int64_t cells = trace_read_varint(r, &offset);
+    IntWord addr = 0;
+    for (int64_t i = 0; i < cells; i++)
+    {
+        addr += unzigzag(trace_read_varint(r, &offset));
+        s->code[addr] = unzigzag(trace_read_varint(r, &offset));
+    }
+    s->next_pos = s->position;
+    s->offset = offset;
+}
+
+// Reads the record of the next instruction into s, skipping checkpoints.
+// Returns false at the end of the trace.
+inline bool read_trace_instr(const TraceReader &r, TraceState *s)
+{
+    while (true)
+    {
+        if (s->offset >= r.header->written) return false;
+        uint64_t offset = s->offset;
+        uint8_t head = trace_read_byte(r, &offset);
+        int type = head & 0x0f;
+        if (type == TRACE_Checkpoint)
+        {
+            // Same memory, but the next record is relative to its position.
+            TraceState skip = {};
+            read_trace_checkpoint(r, s->offset, &skip);
+            s->offset = skip.offset;
+            s->next_pos = skip.next_pos;
+            free_trace_state(&skip);
+            continue;
+        }
+
+        int modes = (head & TRACE_Modes) ? trace_read_byte(r, &offset) : 0;
+        int op = (type == TRACE_Halt) ? OP_Halt : type;
+        s->instr = op + 100 * (modes % 3) + 1000 * ((modes / 3) % 3) + 10000 * (modes / 9);
+        s->position = s->next_pos;
+        if (head & TRACE_Jump) s->position += unzigzag(trace_read_varint(r, &offset));
+        s->has_write = (head & TRACE_Write) != 0;
+        if (s->has_write)
+        {
+            s->write_addr = s->last_write + unzigzag(trace_read_varint(r, &offset));
+            s->write_value = unzigzag(trace_read_varint(r, &offset));
+        }
+        s->has_value = (head & TRACE_Value) != 0;
+        if (s->has_value) s->value = unzigzag(trace_read_varint(r, &offset));
+        s->offset = offset;
+        return true;
+    }
+}
+
+// Applies the instruction read by read_trace_instr() to s.
+inline void apply_trace_instr(TraceState *s)
+{
+    int op = s->instr % 100;
+    if (s->has_write)
+    {
+        s->code[s->write_addr] = s->write_value;
+        s->last_write = s->write_addr;
+    }
+    if (op == OP_ModRel && s->has_value) s->relative_base += s->value;
+    if (op == OP_Halt) s->halted = true;
+    s->next_pos = s->position + instr_length((Opcode)op);
+    s->instruction++;
+}
+
+// Rebuilds the VM as it was before instruction n ran, from the last
+// checkpoint before it. Returns false when n is not in the trace (any more).
+inline bool seek_trace(const TraceReader &r, uint64_t n, TraceState *s)
+{
+    const TraceHeader *h = r.header;
+    int64_t first = (h->checkpoint_num > TRACE_MAX_CHECKPOINTS) ? h->checkpoint_num - TRACE_MAX_CHECKPOINTS : 0;
+    int64_t best = -1;
+    for (int64_t i = first; i < h->checkpoint_num; i++)
+    {
+        const TraceCheckpointRef &ref = h->checkpoints[i % TRACE_MAX_CHECKPOINTS];
+        if (ref.offset < trace_oldest(r) || ref.instruction > n) continue;
+        if (best == -1 || ref.instruction > h->checkpoints[best % TRACE_MAX_CHECKPOINTS].instruction) best = i;
+    }
+    if (best == -1 || n > h->instructions) return false;
+
+    read_trace_checkpoint(r, h->checkpoints[best % TRACE_MAX_CHECKPOINTS].offset, s);
+    while (s->instruction < n)
+    {
+        if (!read_trace_instr(r, s)) return false;
+        apply_trace_instr(s);
+    }
+    // A jump to instruction n is only in its own record.
+    uint64_t offset = s->offset;
+    IntWord next_pos = s->next_pos;
+    if (!read_trace_instr(r, s)) s->position = next_pos;
+    s->offset = offset;
+    s->next_pos = next_pos;
+    return true;
+}
+
+#endif // INTCODE_TRACE_H
@@ -0,0 +1,247 @@
+// Translates the Intcode program embedded in a day's main.cpp to C++.
+//
+//     translate ../09/main.cpp run_day09 > translated.h
+//
+// The generated function has a label per reachable instruction with the
+// operands folded into straight-line code; jumps with immediate targets go
+// directly to their label, other jumps go through a switch on the position.
+// Positions that were not translated and instructions the program has
+// overwritten are interpreted (see aot.h), so the result behaves like
+// execute_threaded():
+//
+//     int run_day09(State *s, Code code);
+//
+// returns 0 when the program waits for input and -1 when it halts.
+
+#include "intcode.h"
+#include "cfg.h"
+#include "program.h"
+
+struct Translation
+{
+    const IntWord *image;
+    int n;
+    int *owner; // start of the instruction containing each cell, -1 if none
+};
+
+static bool is_start(Translation *t, IntWord pos)
+{
+    return pos >= 0 && pos < t->n && t->owner[pos] == pos;
+}
+
+// Formats operand (a, mode) as a C++ expression. Only addresses inside the
+// image index the memory directly, anything else may be past the flat
+// memory and goes through load().
+static const char *operand(Translation *t, char *buf, IntWord a, int mode)
+{
+    switch (mode)
+    {
+    case 0:
+        if (a >= 0 && a < t->n) sprintf(buf, "m[%" PRId64 "]", a);
+        else sprintf(buf, "load(code, %" PRId64 ")", a);
+        break;
+    case 1: sprintf(buf, "%" PRId64 "LL", a); break; // 64-bit, products of two immediates must not overflow
+    case 2: sprintf(buf, "load(code, rb %c %" PRId64 ")", (a < 0) ? '-' : '+', (a < 0) ? -a : a); break;
+    }
+    return buf;
+}
+
+static void emit_store(Translation *t, IntWord a, int mode, const char *value)
+{
+    if (mode == 0)
+    {
+        if (a >= 0 && a < t->n) printf("    m[%" PRId64 "] = %s;\n", a, value);
+        else printf("    code[%" PRId64 "] = %s;\n", a, value);
+        if (a >= 0 && a < t->n && t->owner[a] >= 0) printf("    aot_written(p, m, stale, %" PRId64 ");\n", a);
+    }
+    else
+    {
+        printf("    { IntWord a = rb %c %" PRId64 "; code[a] = %s; aot_written(p, m, stale, a); }\n",
+            (a < 0) ? '-' : '+', (a < 0) ? -a : a, value);
+    }
+}
+
+static void emit_jump(Translation *t, IntWord target, int mode, const char *cond)
+{
+    char buf[64];
+    const char *indent = cond ? "        " : "    ";
+    if (cond) printf("    if (%s)\n    {\n", cond);
+    if (mode == 1 && is_start(t, target))
+    {
+        printf("%sgoto i%" PRId64 ";\n", indent, target);
+    }
+    else
+    {
+        printf("%spos = %s;\n", indent, operand(t, buf, target, mode));
+        printf("%sgoto dispatch;\n", indent);
+    }
+    if (cond) printf("    }\n");
+}
+
+// Emits the instruction at pos, returns false when control never falls
+// through to the next instruction.
+static bool emit_instr(Translation *t, int pos)
+{
+    int m1, m2, m3;
+    Opcode op = decode_instr(t->image[pos], &m1, &m2, &m3);
+    int len = instr_length(op);
+    IntWord a1 = (len > 1) ? t->image[pos+1] : 0;
+    IntWord a2 = (len > 2) ? t->image[pos+2] : 0;
+    IntWord a3 = (len > 3) ? t->image[pos+3] : 0;
+    char x[64], y[64], value[160];
+
+    printf("i%d: // %s\n", pos, Opcode_names[op]);
+    printf("    if (stale[%d]) { pos = %d; goto interpret; }\n", pos, pos);
+    switch (op)
+    {
+    case OP_Add:
+    case OP_Mul:
+    case OP_Lt:
+    case OP_Equ:
+        operand(t, x, a1, m1);
+        operand(t, y, a2, m2);
+        if (op == OP_Add) sprintf(value, "%s + %s", x, y);
+        else if (op == OP_Mul) sprintf(value, "%s * %s", x, y);
+        else sprintf(value, "(%s %s %s) ? 1 : 0", x, (op == OP_Lt) ? "<" : "==", y);
+        emit_store(t, a3, m3, value);
+        return true;
+    case OP_Inp:
+        printf("    if (!read(s->input, &in)) { pos = %d; result = 0; goto done; }\n", pos);
+        emit_store(t, a1, m1, "in");
+        return true;
+    case OP_Out:
+        printf("    write(s->output, %s);\n", operand(t, x, a1, m1));
+        return true;
+    case OP_Jnz:
+    case OP_Jz:
+        if (m1 == 1)
+        {
+            // Constant condition
+            if ((op == OP_Jnz) == (a1 == 0)) return true;
+            emit_jump(t, a2, m2, nullptr);
+            return false;
+        }
+        sprintf(value, "%s %s 0", operand(t, x, a1, m1), (op == OP_Jnz) ? "!=" : "==");
+        emit_jump(t, a2, m2, value);
+        return true;
+    case OP_ModRel:
+        printf("    rb += %s;\n", operand(t, x, a1, m1));
+        return true;
+    case OP_Halt:
+        printf("    s->halted = true;\n");
+        printf("    pos = %d;\n", pos);
+        printf("    result = -1;\n");
+        printf("    goto done;\n");
+        return false;
+    default:
+        assert(0 && "not a translated instruction");
+        return false;
+    }
+}
+
+static void print_table(const char *type, const char *name, const int64_t *values, int n)
+{
+    printf("static const %s %s[%d] = {", type, name, n);
+    for (int i = 0; i < n; i++)
+    {
+        printf("%s%" PRId64 ",", (i % 16 == 0) ? "\n    " : " ", values[i]);
+    }
+    printf("\n};\n");
+}
+
+int main(int argc, const char **argv)
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage: %s <main.cpp> <function> [array]\n", argv[0]);
+        return 1;
+    }
+    const char *source = argv[1];
+    const char *fn = argv[2];
+    const char *array = (argc > 3) ? argv[3] : "actual_code";
+
+    int n;
+    IntWord *image = load_program(source, &n, array);
+    if (!image)
+    {
+        fprintf(stderr, "%s: no %s[] in %s\n", argv[0], array, source);
+        return 1;
+    }
+
+    // The instructions reachable from position 0 through fall-through,
+    // immediate jump targets and return addresses, see cfg.h.
+    Cfg *cfg = analyze_program(image, n);
+    Translation t = {};
+    t.image = image;
+    t.n = n;
+    t.owner = cfg->owner;
+
+    printf("// Generated by translate from %s (%s), do not edit.\n\n", source, array);
+    printf("#include \"aot.h\"\n\n");
+
+    char name[256];
+    int64_t *owner = (int64_t*)malloc(n * sizeof(int64_t));
+    for (int i = 0; i < n; i++) owner[i] = t.owner[i];
+    snprintf(name, sizeof(name), "%s_image", fn);
+    print_table("IntWord", name, image, n);
+    snprintf(name, sizeof(name), "%s_owner", fn);
+    print_table("int", name, owner, n);
+    printf("static const AotProgram %s_program = { %d, %s_image, %s_owner };\n\n", fn, n, fn, fn);
+
+    printf("static int %s(State *s, Code code)\n", fn);
+    printf("{\n");
+    printf("    const AotProgram *p = &%s_program;\n", fn);
+    printf("    assert(code.code_size == p->code_size);\n");
+    printf("    uint8_t stale[%d];\n", n);
+    printf("    aot_init_stale(p, code.data, stale);\n");
+    printf("    IntWord *m = code.data;\n");
+    printf("    IntWord rb = s->relative_base;\n");
+    printf("    int pos = s->position;\n");
+    printf("    IntWord in;\n");
+    printf("    int result;\n");
+    printf("    goto dispatch;\n\n");
+
+    bool falls_through = false;
+    int prev_next = -1;
+    for (int pos = 0; pos < n; pos++)
+    {
+        if (t.owner[pos] != pos) continue;
+        if (falls_through && prev_next != pos)
+        {
+            printf("    pos = %d;\n    goto dispatch;\n", prev_next);
+        }
+        falls_through = emit_instr(&t, pos);
+        prev_next = pos + instr_length((Opcode)(image[pos] % 100));
+    }
+    if (falls_through)
+    {
+        printf("    pos = %d;\n    goto dispatch;\n", prev_next);
+    }
+
+    printf("\ndispatch:\n");
+    printf("    switch (pos)\n");
+    printf("    {\n");
+    for (int pos = 0; pos < n; pos++)
+    {
+        if (t.owner[pos] == pos) printf("    case %d: goto i%d;\n", pos, pos);
+    }
+    printf("    }\n");
+    printf("interpret:\n");
+    printf("    s->position = pos;\n");
+    printf("    s->relative_base = rb;\n");
+    printf("    result = aot_step(p, s, code, stale);\n");
+    printf("    if (result != 1) return result;\n");
+    printf("    pos = s->position;\n");
+    printf("    rb = s->relative_base;\n");
+    printf("    goto dispatch;\n\n");
+    printf("done:\n");
+    printf("    s->position = pos;\n");
+    printf("    s->relative_base = rb;\n");
+    printf("    return result;\n");
+    printf("}\n");
+
+    free(owner);
+    free_cfg(cfg);
+    free(image);
+    return 0;
+}
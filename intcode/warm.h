@@ -0,0 +1,221 @@
+#ifndef INTCODE_WARM_H
+#define INTCODE_WARM_H
+
+// Warm starts: skipping the setup a program does before its first input.
+//
+// The first time a program is run with warm_start(), it is run until it
+// waits for input and the changes it made to its memory, its position and
+// relative base and the outputs it wrote are kept. Later runs of the same
+// program image resume from there instead of running the setup again:
+//
+//     Code code = to_code(actual_code);
+//     State state = {};
+//     ...
+//     warm_start(&state, code);
+//     execute(&state, code);
+//
+// The code has to be a fresh copy (or fork) of the program that has not run
+// yet. Programs are told apart by their image and memory size, so a copy
+// whose image was patched before running (day 02) gets a warm start of its
+// own. A warm start keeps a copy of its image, a hash of it only picks the
+// ones to compare. Warm starts are kept until free_warm_starts().
+
+#include "intcode.h"
+
+struct WarmCell
+{
+    IntWord addr;
+    IntWord value;
+};
+
+struct WarmStart
+{
+    uint64_t hash;
+    int code_size;
+    int memory_size;
+    IntWord *image; // the fresh program, code_size cells
+
+    // The memory at the first input, as the cells that differ from the
+    // fresh program.
+    WarmCell *cells;
+    int cell_num;
+
+    int position;
+    int relative_base;
+    bool halted; // halted without reading any input
+
+    IntWord *outputs; // written before the first input
+    int output_num;
+
+    WarmStart *next;
+};
+
+// Hit and miss counts, for the days to print.
+struct WarmStats
+{
+    int64_t hits;
+    int64_t misses;
+};
+
+inline WarmStart *&warm_start_list()
+{
+    static WarmStart *first = nullptr;
+    return first;
+}
+
+inline WarmStats &warm_stats()
+{
+    static WarmStats stats = {};
+    return stats;
+}
+
+// FNV-1a of the program image and the memory size, a word at a time.
+inline uint64_t hash_image(const Code &code)
+{
+    uint64_t h = 14695981039346656037ull;
+    for (int i = 0; i < code.code_size; i++)
+    {
+        h ^= (uint64_t)code.data[i];
+        h *= 1099511628211ull;
+    }
+    h ^= (uint64_t)code.memory_size;
+    h *= 1099511628211ull;
+    return h;
+}
+
+inline WarmStart *find_warm_start(const Code &code, uint64_t hash)
+{
+    WarmStart *w = __atomic_load_n(&warm_start_list(), __ATOMIC_ACQUIRE);
+    for (; w; w = w->next)
+    {
+        if (w->hash == hash && w->code_size == code.code_size && w->memory_size == code.memory_size &&
+            memcmp(w->image, code.data, code.code_size * sizeof(IntWord)) == 0)
+        {
+            return w;
+        }
+    }
+    return nullptr;
+}
+
+inline void add_warm_cell(WarmStart *w, int *capacity, IntWord addr, IntWord value)
+{
+    if (w->cell_num == *capacity)
+    {
+        *capacity = *capacity ? *capacity * 2 : 64;
+        w->cells = (WarmCell*)realloc(w->cells, *capacity * sizeof(WarmCell));
+    }
+    w->cells[w->cell_num++] = { addr, value };
+}
+
+// Runs the setup of a fresh program and records where it ended up.
+inline WarmStart *capture_warm_start(Code code, uint64_t hash)
+{
+    IntWord *image = (IntWord*)malloc(code.code_size * sizeof(IntWord));
+    memcpy(image, code.data, code.code_size * sizeof(IntWord));
+
+    // Nothing to read, so the program stops at its first input.
+    Buffer input = {};
+    Buffer output = {};
+    State state = {};
+    state.input = &input;
+    state.output = &output;
+    while (execute_threaded(&state, code) == 1);
+
+    WarmStart *w = (WarmStart*)calloc(1, sizeof(WarmStart));
+    w->hash = hash;
+    w->code_size = code.code_size;
+    w->memory_size = code.memory_size;
+    w->image = image;
+    w->position = state.position;
+    w->relative_base = state.relative_base;
+    w->halted = state.halted;
+
+    int capacity = 0;
+    for (int i = 0; i < code.memory_size; i++)
+    {
+        IntWord fresh = (i < code.code_size) ? image[i] : 0;
+        if (code.data[i] == fresh) continue;
+        add_warm_cell(w, &capacity, i, code.data[i]);
+        // The setup did not write through store().
+        if (code.decoded && i < code.code_size) invalidate_decoded(code, i);
+    }
+    const PagedMemory *m = code.pages;
+    for (int64_t t = 0; t < m->table_num; t++)
+    {
+        if (!m->tables[t]) continue;
+        for (int p = 0; p < PAGE_TABLE_SIZE; p++)
+        {
+            const IntWord *page = m->tables[t][p];
+            if (!page) continue;
+            IntWord base = (t << (PAGE_BITS + PAGE_TABLE_BITS)) | ((IntWord)p << PAGE_BITS);
+            for (int i = 0; i < PAGE_CELLS; i++)
+            {
+                if (page[i] != 0) add_warm_cell(w, &capacity, base + i, page[i]);
+            }
+        }
+    }
+
+    w->output_num = readable_num(output);
+    w->outputs = (IntWord*)malloc((w->output_num + 1) * sizeof(IntWord));
+    read_n(&output, w->outputs, w->output_num);
+
+    free_buffer(&input);
+    free_buffer(&output);
+    return w;
+}
+
+// Brings a fresh program to its first input, from the recorded warm start
+// when there is one. The input of the state is not touched, the outputs
+// written before the first input are written to its output. Returns false
+// (and does nothing) when the state has already been run.
+inline bool warm_start(State *state, Code &code)
+{
+    if (state->position != 0 || state->relative_base != 0 || state->halted) return false;
+
+    uint64_t hash = hash_image(code);
+    WarmStart *w = find_warm_start(code, hash);
+    if (w)
+    {
+        __atomic_fetch_add(&warm_stats().hits, 1, __ATOMIC_RELAXED);
+        // Only the cells the setup changed are written, so a fork only gets
+        // the pages of those copied.
+        for (int i = 0; i < w->cell_num; i++)
+        {
+            store(code, w->cells[i].addr, w->cells[i].value);
+        }
+    }
+    else
+    {
+        __atomic_fetch_add(&warm_stats().misses, 1, __ATOMIC_RELAXED);
+        // The setup runs on this code, the recording is made from it.
+        w = capture_warm_start(code, hash);
+        // Two threads can capture the same program, the later one is
+        // just never found.
+        w->next = __atomic_load_n(&warm_start_list(), __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&warm_start_list(), &w->next, w, true,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+
+    state->position = w->position;
+    state->relative_base = w->relative_base;
+    state->halted = w->halted;
+    write_n(state->output, w->outputs, w->output_num);
+    return true;
+}
+
+inline void free_warm_starts()
+{
+    WarmStart *w = warm_start_list();
+    while (w)
+    {
+        WarmStart *next = w->next;
+        free(w->image);
+        free(w->cells);
+        free(w->outputs);
+        free(w);
+        w = next;
+    }
+    warm_start_list() = nullptr;
+}
+
+#endif // INTCODE_WARM_H
@@ -0,0 +1,84 @@
+#ifndef INTCODE_WATCH_H
+#define INTCODE_WATCH_H
+
+// Watchpoints on memory cells, passed to execute_threaded() as its
+// profiling policy. A callback is called every time the program writes one
+// of the watched cells, so a controller can follow the state of a program
+// from its memory instead of decoding its outputs:
+//
+//     Watchpoints watch = {};
+//     add_watch(&watch, 388, on_ball_x, &game);
+//     add_watch(&watch, 392, on_paddle_x, &game);
+//     execute_threaded(&state, code, false, &watch);
+//
+// The callback gets the address and the value written, which is already in
+// memory when it is called. Runs without watchpoints use NoProfile and cost
+// nothing. With them, a write outside the watched range costs two compares.
+
+#include "intcode.h"
+
+#define MAX_WATCHPOINTS 8
+
+typedef void (*WatchCallback)(void *user, IntWord addr, IntWord value);
+
+struct Watchpoint
+{
+    IntWord addr;
+    WatchCallback callback;
+    void *user;
+};
+
+struct Watchpoints
+{
+    Watchpoint points[MAX_WATCHPOINTS];
+    int point_num;
+    IntWord min_addr; // of the watched cells, for skipping the others
+    IntWord max_addr;
+
+    static void enter(Watchpoints *, const Code &, const State *) { }
+    static void leave(Watchpoints *) { }
+    static void instr(Watchpoints *, int, IntWord) { }
+    static void stored(Watchpoints *w, IntWord addr, IntWord value)
+    {
+        if (addr < w->min_addr || addr > w->max_addr) return;
+        for (int i = 0; i < w->point_num; i++)
+        {
+            const Watchpoint &p = w->points[i];
+            if (p.addr == addr) p.callback(p.user, addr, value);
+        }
+    }
+    static void input(Watchpoints *, IntWord) { }
+    static void output(Watchpoints *, IntWord) { }
+    static void relative_base(Watchpoints *, IntWord) { }
+    static int jump(Watchpoints *, const Code &, int, int to, bool, IntWord) { return to; }
+};
+
+// Calls callback(user, addr, value) when the program writes addr. Returns
+// false when all MAX_WATCHPOINTS are in use.
+inline bool add_watch(Watchpoints *w, IntWord addr, WatchCallback callback, void *user)
+{
+    if (w->point_num == MAX_WATCHPOINTS) return false;
+    w->points[w->point_num++] = { addr, callback, user };
+    if (w->point_num == 1 || addr < w->min_addr) w->min_addr = addr;
+    if (w->point_num == 1 || addr > w->max_addr) w->max_addr = addr;
+    return true;
+}
+
+inline void remove_watch(Watchpoints *w, IntWord addr)
+{
+    int n = 0;
+    for (int i = 0; i < w->point_num; i++)
+    {
+        if (w->points[i].addr != addr) w->points[n++] = w->points[i];
+    }
+    w->point_num = n;
+    w->min_addr = 1;
+    w->max_addr = 0;
+    for (int i = 0; i < n; i++)
+    {
+        if (i == 0 || w->points[i].addr < w->min_addr) w->min_addr = w->points[i].addr;
+        if (i == 0 || w->points[i].addr > w->max_addr) w->max_addr = w->points[i].addr;
+    }
+}
+
+#endif // INTCODE_WATCH_H